@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Host benchmark of the gyro report, in both modes: GYRO_MODE_AXIS_ABSOLUTE
+(orientation math, to gamepad axes) and GYRO_MODE_ALWAYS_ON (incremental mouse
+math). Each one runs Gyro__report, the same call the profiler stages
+PROFILER_GYRO_ABSOLUTE and PROFILER_GYRO_INCREMENTAL measure on the device.
+The IMU values come from the sensors snapshot (as when core1 samples them,
+see sensors.c), changing on every call, so only the gyro math and its output
+are timed.
+
+The host has hardware double precision, unlike the RP2040, so the numbers are
+useful to compare two versions of the code against each other, not as an
+estimate of the time on the device. To compare, build this file against each
+version of src (with CMAKE_BUILD_TYPE=Release) and run both.
+
+Usage: bench_gyro [calls]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "replay.h"
+#include "fakes.h"
+#include "sensors.h"
+#include "button.h"
+#include "gyro.h"
+#include "hid.h"
+#include "pin.h"
+
+#define BENCH_ROUNDS 5  // Best of.
+
+static double bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Nanoseconds per call, the best of a few rounds.
+static double bench_mode(GyroMode mode, uint32_t calls) {
+    Gyro gyro = Gyro_(mode, PIN_NONE);
+    Actions x_neg = {GAMEPAD_AXIS_LX_NEG};
+    Actions x_pos = {GAMEPAD_AXIS_LX};
+    Actions y_neg = {GAMEPAD_AXIS_LY_NEG};
+    Actions y_pos = {GAMEPAD_AXIS_LY};
+    if (mode == GYRO_MODE_ALWAYS_ON) {
+        x_neg[0] = MOUSE_X_NEG;
+        x_pos[0] = MOUSE_X;
+        y_neg[0] = MOUSE_Y_NEG;
+        y_pos[0] = MOUSE_Y;
+    }
+    gyro.config_x(&gyro, -45, 45, x_neg, x_pos);
+    gyro.config_y(&gyro, -45, 45, y_neg, y_pos);
+    gyro.reset(&gyro);
+    SensorsSnapshot *snapshot = sensors_get();
+    double best = 0;
+    for(uint8_t round=0; round<BENCH_ROUNDS; round++) {
+        double start = bench_now_ns();
+        for(uint32_t i=0; i<calls; i++) {
+            int16_t wave = (int16_t)((i * 37) % 4000) - 2000;
+            snapshot->gyro.x = wave;
+            snapshot->gyro.y = -wave / 2;
+            snapshot->gyro.z = wave / 3;
+            snapshot->accel.x = wave / 8;
+            snapshot->accel.y = -wave / 8;
+            snapshot->accel.z = 16384;
+            gyro.report(&gyro);
+        }
+        double elapsed = (bench_now_ns() - start) / calls;
+        if (!round || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    uint32_t calls = argc > 1 ? atoi(argv[1]) : 1000000;
+    replay_boot();
+    fakes_set_sensors_active(true);
+    double absolute = bench_mode(GYRO_MODE_AXIS_ABSOLUTE, calls);
+    double incremental = bench_mode(GYRO_MODE_ALWAYS_ON, calls);
+    printf("Gyro report, %u calls, best of %u\n", calls, BENCH_ROUNDS);
+    printf("  absolute:     %6.1f ns\n", absolute);
+    printf("  incremental:  %6.1f ns\n", incremental);
+    return 0;
+}
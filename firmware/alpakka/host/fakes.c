@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#include <stdio.h>
+#include <string.h>
+#include "fakes.h"
+#include "hal.h"
+#include "config.h"
+#include "nvm.h"
+#include "led.h"
+#include "power.h"
+#include "esp.h"
+#include "sensors.h"
+#include "uart.h"
+#include "webusb.h"
+#include "xinput.h"
+#include "tusb_config.h"
+
+static DeviceMode device_mode = WIRED;
+static bool sensors_active = false;
+static uint8_t flash[PICO_FLASH_SIZE_BYTES];
+static bool flash_erased = false;
+
+static uint8_t tx[FAKES_UART_SIZE];
+static uint32_t tx_len = 0;
+static uint32_t tx_frames = 0;
+static uint8_t rx[FAKES_UART_SIZE];
+static uint32_t rx_read = 0;
+static uint32_t rx_write = 0;
+
+void fakes_reset() {
+    device_mode = WIRED;
+    sensors_active = false;
+    tx_len = 0;
+    tx_frames = 0;
+    rx_read = 0;
+    rx_write = 0;
+    memset(flash, 0xFF, sizeof(flash));
+    flash_erased = true;
+}
+
+void fakes_set_device_mode(DeviceMode mode) {
+    device_mode = mode;
+}
+
+void fakes_set_sensors_active(bool value) {
+    sensors_active = value;
+}
+
+// Loop.
+
+DeviceMode loop_get_device_mode() {
+    return device_mode;
+}
+
+int16_t loop_get_sof_lead() {
+    return 0;
+}
+
+// Flash, in memory.
+
+void nvm_read(uint32_t addr, uint8_t* buffer, uint32_t size) {
+    if (!flash_erased) fakes_reset();
+    memcpy(buffer, &flash[addr], size);
+}
+
+void nvm_write(uint32_t addr, uint8_t* buffer, uint32_t size) {
+    if (!flash_erased) fakes_reset();
+    memcpy(&flash[addr], buffer, size);
+}
+
+// LEDs, power and ESP.
+
+void led_set_mode(LEDMode mode) {}
+void led_idle_mask(uint8_t mask) {}
+void led_static_mask(uint8_t mask) {}
+void led_blink_mask(uint8_t mask) {}
+void led_show() {}
+void power_restart() {}
+void power_bootsel() {}
+void power_dormant() {}
+void esp_init() {}
+void esp_restart() {}
+
+// Sensors, core1 is not running so the consumers read the buses directly,
+// unless the snapshot is filled by the test itself.
+
+static SensorsSnapshot snapshot;
+
+void sensors_sync() {}
+SensorsSnapshot *sensors_get() { return &snapshot; }
+uint64_t sensors_get_timestamp() { return hal_time_us(); }
+bool sensors_is_running() { return false; }
+bool sensors_is_active() { return sensors_active; }
+void sensors_pause() {}
+void sensors_resume() {}
+
+// USB stack.
+
+bool usb_reenumerate(int16_t timeout) {
+    return true;
+}
+
+bool xinput_send_report(XInputReport *report) {
+    hal_host_report_capture(HAL_HOST_INSTANCE_XINPUT, 0, report, XINPUT_REPORT_SIZE);
+    return true;
+}
+
+void webusb_write(char *msg) {}
+bool webusb_flush() { return true; }
+void webusb_set_pending_config_share(bool value) {}
+void webusb_handle(Ctrl ctrl) {}
+
+// UART transport.
+
+void uart_rx_init() {}
+void uart_rx_reset() {}
+void uart_rx_set_idle_callback(UartCallback callback) {}
+uint32_t uart_rx_get_bursts() { return 0; }
+
+uint16_t uart_rx_available() {
+    uint32_t available = rx_write - rx_read;
+    return available > 0xFFFF ? 0xFFFF : available;
+}
+
+uint8_t *uart_rx_peek(uint16_t len) {
+    return &rx[rx_read];
+}
+
+void uart_rx_consume(uint16_t len) {
+    rx_read += len;
+    if (rx_read == rx_write) {
+        rx_read = 0;
+        rx_write = 0;
+    }
+}
+
+void fakes_uart_rx_feed(const uint8_t *data, uint32_t len) {
+    if (rx_write + len > FAKES_UART_SIZE) {
+        // Compact the unread bytes to the start.
+        memmove(rx, &rx[rx_read], rx_write - rx_read);
+        rx_write -= rx_read;
+        rx_read = 0;
+    }
+    if (rx_write + len > FAKES_UART_SIZE) abort();
+    memcpy(&rx[rx_write], data, len);
+    rx_write += len;
+}
+
+uint32_t fakes_uart_rx_pending() {
+    return rx_write - rx_read;
+}
+
+void uart_tx_init() {}
+void uart_tx_reset() {}
+void uart_tx_log_stats() {}
+
+bool uart_tx_send(uint8_t *data, uint8_t len, uint8_t tag) {
+    if (tx_len + len > FAKES_UART_SIZE) return false;
+    memcpy(&tx[tx_len], data, len);
+    tx_len += len;
+    tx_frames++;
+    return true;
+}
+
+uint32_t fakes_uart_tx_len() {
+    return tx_len;
+}
+
+uint8_t *fakes_uart_tx_data() {
+    return tx;
+}
+
+uint32_t fakes_uart_tx_frames() {
+    return tx_frames;
+}
+
+void fakes_uart_tx_clear() {
+    tx_len = 0;
+    tx_frames = 0;
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Host replacements of the modules that only make sense on the hardware (flash,
+LEDs, power, core1 sensors, USB stack, ESP and the UART transport), see
+fakes.c. The UART transport is a pair of byte queues the test can feed and
+drain, so the AT protocol in wireless.c runs unmodified.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "loop.h"
+
+#define FAKES_UART_SIZE 65536
+
+void fakes_reset();
+void fakes_set_device_mode(DeviceMode mode);
+// Consumers read the core1 snapshot (sensors_get) instead of the buses.
+void fakes_set_sensors_active(bool value);
+
+// Bytes queued by uart_tx_send (what this side sends to the ESP).
+uint32_t fakes_uart_tx_len();
+uint8_t *fakes_uart_tx_data();
+void fakes_uart_tx_clear();
+uint32_t fakes_uart_tx_frames();
+
+// Bytes made available to uart_rx_peek (what this side receives).
+void fakes_uart_rx_feed(const uint8_t *data, uint32_t len);
+uint32_t fakes_uart_rx_pending();
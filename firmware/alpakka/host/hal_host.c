@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#include <time.h>
+#include "hal.h"
+
+typedef struct HalHostPin_struct {
+    bool level;
+    bool output;
+    uint32_t edges;  // Enabled interrupt edges.
+    uint32_t events;  // Pending interrupt events.
+    HalGpioCallback callback;
+    int8_t follows;  // Output pin followed by this input, or -1.
+    uint32_t follow_delay;
+    uint64_t follow_at;  // When the input settles to the followed level.
+} HalHostPin;
+
+typedef struct HalHostRegisters_struct {
+    uint8_t id;
+    uint8_t pointer;
+    uint8_t data[256];
+} HalHostRegisters;
+
+#define HAL_HOST_HANDLERS 8
+#define HAL_HOST_DEVICES 8
+
+static uint64_t now = 0;
+static HalHostPin pins[HAL_HOST_PINS];
+static HalGpioHandler handlers[HAL_HOST_HANDLERS];
+static uint8_t handlers_len = 0;
+static uint16_t adc[HAL_HOST_ADC_CHANNELS];
+static uint8_t adc_channel = 0;
+static HalHostRegisters i2c[HAL_HOST_DEVICES];
+static HalHostRegisters spi[HAL_HOST_DEVICES];
+static HalHostRegisters *spi_selected = NULL;
+static bool spi_pointer_pending = false;
+static HalHostReport reports[HAL_HOST_REPORTS];
+static uint32_t reports_len = 0;
+static uint32_t random_state = 1;
+
+void hal_host_reset() {
+    now = 0;
+    memset(pins, 0, sizeof(pins));
+    for(uint8_t i=0; i<HAL_HOST_PINS; i++) pins[i].follows = -1;
+    handlers_len = 0;
+    for(uint8_t i=0; i<HAL_HOST_ADC_CHANNELS; i++) adc[i] = 2048;
+    memset(i2c, 0, sizeof(i2c));
+    memset(spi, 0, sizeof(spi));
+    spi_selected = NULL;
+    reports_len = 0;
+    random_state = 1;
+}
+
+// Clock.
+
+uint64_t hal_time_us() {
+    return now;
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    now += (uint64_t)ms * 1000;
+}
+
+void hal_host_set_time(uint64_t timestamp) {
+    if (timestamp > now) now = timestamp;
+}
+
+void hal_host_advance(uint64_t us) {
+    now += us;
+}
+
+// Pins.
+
+// The button constructor also initializes the expander pins (100 and above)
+// as if they were GPIOs, those end up in a scratch pin without effects.
+static HalHostPin *pin_get(uint8_t pin) {
+    static HalHostPin scratch;
+    if (pin >= HAL_HOST_PINS) {
+        scratch = (HalHostPin){.follows = -1};
+        return &scratch;
+    }
+    return &pins[pin];
+}
+
+static void pin_interrupt(uint8_t pin, bool value) {
+    HalHostPin *self = pin_get(pin);
+    uint32_t event = value ? HAL_GPIO_EDGE_RISE : HAL_GPIO_EDGE_FALL;
+    if (!(self->edges & event)) return;
+    self->events |= event;
+    if (self->callback) {
+        self->callback(pin, self->events);
+        self->events = 0;
+    }
+    for(uint8_t i=0; i<handlers_len; i++) handlers[i]();
+}
+
+bool hal_gpio_get(uint8_t pin) {
+    HalHostPin *self = pin_get(pin);
+    if (self->follows >= 0) {
+        bool target = pins[self->follows].level;
+        if (self->level != target) {
+            // Settling, reading the pin takes time.
+            if (now >= self->follow_at) self->level = target;
+            else now += 1;
+        }
+    }
+    return self->level;
+}
+
+void hal_gpio_put(uint8_t pin, bool value) {
+    HalHostPin *self = pin_get(pin);
+    if (self->level != value) {
+        for(uint8_t i=0; i<HAL_HOST_PINS; i++) {
+            if (pins[i].follows == pin) pins[i].follow_at = now + pins[i].follow_delay;
+        }
+    }
+    self->level = value;
+    // Chip select of a fake SPI device.
+    for(uint8_t i=0; i<HAL_HOST_DEVICES; i++) {
+        if (spi[i].id != pin + 1) continue;
+        if (!value) {
+            spi_selected = &spi[i];
+            spi_pointer_pending = true;
+        }
+        else if (spi_selected == &spi[i]) spi_selected = NULL;
+    }
+}
+
+void hal_gpio_pull_up(uint8_t pin) {
+    HalHostPin *self = pin_get(pin);
+    if (!self->output) self->level = true;
+}
+
+void hal_gpio_init_input(uint8_t pin, bool pull_up) {
+    HalHostPin *self = pin_get(pin);
+    self->output = false;
+    self->level = pull_up;
+}
+
+void hal_gpio_init_output(uint8_t pin) {
+    HalHostPin *self = pin_get(pin);
+    self->output = true;
+}
+
+uint32_t hal_gpio_irq_events(uint8_t pin) {
+    return pin_get(pin)->events;
+}
+
+void hal_gpio_irq_acknowledge(uint8_t pin, uint32_t events) {
+    pin_get(pin)->events &= ~events;
+}
+
+void hal_gpio_irq_callback(uint8_t pin, uint32_t edges, HalGpioCallback callback) {
+    HalHostPin *self = pin_get(pin);
+    self->edges |= edges;
+    self->callback = callback;
+}
+
+void hal_gpio_irq_handler(uint8_t pin, HalGpioHandler handler) {
+    HalHostPin *self = pin_get(pin);
+    self->edges |= HAL_GPIO_EDGE_FALL | HAL_GPIO_EDGE_RISE;
+    for(uint8_t i=0; i<handlers_len; i++) {
+        if (handlers[i] == handler) return;
+    }
+    if (handlers_len == HAL_HOST_HANDLERS) abort();
+    handlers[handlers_len++] = handler;
+}
+
+void hal_host_gpio_set(uint8_t pin, bool value) {
+    HalHostPin *self = pin_get(pin);
+    if (self->level == value) return;
+    self->level = value;
+    pin_interrupt(pin, value);
+}
+
+// Contact bounce, the pin changes to the value with an odd number of edges
+// (back and forth), faster than the interrupt is serviced: every edge reaches
+// the callback, but reading the pin already gives the settled value.
+void hal_host_gpio_bounce(uint8_t pin, bool value, uint8_t edges) {
+    HalHostPin *self = pin_get(pin);
+    if (self->level == value) return;
+    self->level = value;
+    for(uint8_t i=0; i<edges; i++) pin_interrupt(pin, i % 2 ? !value : value);
+}
+
+void hal_host_gpio_follow(uint8_t output, uint8_t input, uint32_t delay_us) {
+    HalHostPin *self = pin_get(input);
+    self->follows = output;
+    // Never instantaneous, the touch sampling loops until time passes.
+    self->follow_delay = delay_us ? delay_us : 1;
+    self->follow_at = now + self->follow_delay;
+}
+
+// ADC.
+
+void hal_adc_select(uint8_t channel) {
+    adc_channel = channel % HAL_HOST_ADC_CHANNELS;
+}
+
+uint16_t hal_adc_read() {
+    return adc[adc_channel];
+}
+
+void hal_host_adc_set(uint8_t channel, uint16_t value) {
+    adc[channel % HAL_HOST_ADC_CHANNELS] = value & 0xFFF;
+}
+
+// Buses.
+
+static HalHostRegisters *registers_get(HalHostRegisters *devices, uint8_t id) {
+    HalHostRegisters *empty = NULL;
+    for(uint8_t i=0; i<HAL_HOST_DEVICES; i++) {
+        if (devices[i].id == id) return &devices[i];
+        if (!devices[i].id && !empty) empty = &devices[i];
+    }
+    if (!empty) abort();
+    empty->id = id;
+    return empty;
+}
+
+int hal_i2c_write(uint8_t device, const uint8_t *data, size_t len, bool nostop) {
+    HalHostRegisters *self = registers_get(i2c, device + 1);
+    if (len == 0) return 0;
+    self->pointer = data[0];
+    for(size_t i=1; i<len; i++) self->data[self->pointer++] = data[i];
+    return len;
+}
+
+int hal_i2c_read(uint8_t device, uint8_t *data, size_t len, bool nostop) {
+    HalHostRegisters *self = registers_get(i2c, device + 1);
+    for(size_t i=0; i<len; i++) data[i] = self->data[self->pointer++];
+    return len;
+}
+
+void hal_host_i2c_set(uint8_t device, uint8_t reg, uint8_t value) {
+    registers_get(i2c, device + 1)->data[reg] = value;
+}
+
+uint8_t hal_host_i2c_get(uint8_t device, uint8_t reg) {
+    return registers_get(i2c, device + 1)->data[reg];
+}
+
+int hal_spi_write(const uint8_t *data, size_t len) {
+    if (!spi_selected) return len;
+    for(size_t i=0; i<len; i++) {
+        if (spi_pointer_pending) {
+            spi_selected->pointer = data[i] & 0x7F;
+            spi_pointer_pending = false;
+        }
+        else spi_selected->data[spi_selected->pointer++] = data[i];
+    }
+    return len;
+}
+
+int hal_spi_read(uint8_t *data, size_t len) {
+    for(size_t i=0; i<len; i++) {
+        data[i] = spi_selected ? spi_selected->data[spi_selected->pointer++] : 0;
+    }
+    return len;
+}
+
+void hal_host_spi_set(uint8_t cs, uint8_t reg, const uint8_t *data, uint8_t len) {
+    HalHostRegisters *self = registers_get(spi, cs + 1);
+    for(uint8_t i=0; i<len; i++) self->data[(uint8_t)(reg + i)] = data[i];
+}
+
+// USB HID.
+
+void hal_host_report_capture(
+    uint8_t instance,
+    uint8_t report_id,
+    const void *report,
+    uint16_t len
+) {
+    if (reports_len == HAL_HOST_REPORTS) {
+        fprintf(stderr, "HAL: Report capture full\n");
+        abort();
+    }
+    HalHostReport *self = &reports[reports_len++];
+    self->timestamp = now;
+    self->instance = instance;
+    self->report_id = report_id;
+    self->len = len < HAL_HOST_REPORT_SIZE ? len : HAL_HOST_REPORT_SIZE;
+    memcpy(self->data, report, self->len);
+}
+
+bool hal_usb_hid_report(
+    uint8_t instance,
+    uint8_t report_id,
+    const void *report,
+    uint16_t len
+) {
+    hal_host_report_capture(instance, report_id, report, len);
+    return true;
+}
+
+HalHostReport *hal_host_reports(uint32_t *len) {
+    *len = reports_len;
+    return reports;
+}
+
+void hal_host_reports_clear() {
+    reports_len = 0;
+}
+
+// Board.
+
+void hal_board_id(char *buffer, uint8_t len) {
+    snprintf(buffer, len, "HOST");
+}
+
+uint32_t hal_rand_32() {
+    // Deterministic xorshift.
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Cycle counter.
+
+uint32_t hal_cycles() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return (uint32_t)(-ns);
+}
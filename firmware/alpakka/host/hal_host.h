@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Host implementation of the hardware abstraction (see src/headers/hal.h), so
+the logic modules can be built and exercised on a desktop machine.
+
+- Clock: virtual, it only moves when the test (or a blocking sleep) advances
+  it, so every run is deterministic.
+- Pins: levels set by the test, input edges are dispatched synchronously to
+  the registered interrupt handlers. An input can follow an output with a
+  delay (touch probe), the clock moves 1us on every read while it settles.
+- ADC: one value per channel, set by the test.
+- I2C and SPI: a register file per I2C address and per SPI chip-select pin,
+  with the register pointer set by the first written byte and auto-increment.
+  For SPI the register byte has the read flag (0x80) stripped.
+- USB: always ready, the HID reports are captured instead of sent.
+- Cycle counter: nanoseconds of the real monotonic clock (counting down, like
+  the SysTick), for the benchmarks.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int uint;
+
+#ifndef __packed
+    #define __packed __attribute__((packed))
+#endif
+
+#define HAL_HOST_PINS 32
+#define HAL_HOST_ADC_CHANNELS 4
+#define HAL_HOST_REPORTS 4096
+#define HAL_HOST_REPORT_SIZE 64
+#define HAL_HOST_INSTANCE_XINPUT 0xFF  // Instance used for captured XInput.
+
+// Clock.
+uint64_t hal_time_us();
+#define hal_time_us_32()  ((uint32_t)hal_time_us())
+void hal_sleep_ms(uint32_t ms);
+
+// Interrupts and memory barriers (single threaded).
+#define hal_dmb()  __sync_synchronize()
+#define hal_irq_save()  0
+#define hal_irq_restore(status)  (void)(status)
+
+// Pins.
+#define HAL_GPIO_EDGE_FALL  0x4
+#define HAL_GPIO_EDGE_RISE  0x8
+#define HAL_GPIO_FUNC_I2C  3
+#define HAL_GPIO_FUNC_SPI  1
+#define HAL_GPIO_FUNC_UART  2
+typedef void (*HalGpioCallback)(uint gpio, uint32_t events);
+typedef void (*HalGpioHandler)();
+bool hal_gpio_get(uint8_t pin);
+void hal_gpio_put(uint8_t pin, bool value);
+void hal_gpio_pull_up(uint8_t pin);
+void hal_gpio_init_input(uint8_t pin, bool pull_up);
+void hal_gpio_init_output(uint8_t pin);
+#define hal_gpio_set_function(pin, function)  (void)0
+uint32_t hal_gpio_irq_events(uint8_t pin);
+void hal_gpio_irq_acknowledge(uint8_t pin, uint32_t events);
+void hal_gpio_irq_callback(uint8_t pin, uint32_t edges, HalGpioCallback callback);
+void hal_gpio_irq_handler(uint8_t pin, HalGpioHandler handler);
+
+// ADC.
+#define hal_adc_init()  (void)0
+#define hal_adc_gpio_init(pin)  (void)0
+void hal_adc_select(uint8_t channel);
+uint16_t hal_adc_read();
+
+// Buses.
+#define hal_i2c_init(freq)  (void)0
+int hal_i2c_write(uint8_t device, const uint8_t *data, size_t len, bool nostop);
+int hal_i2c_read(uint8_t device, uint8_t *data, size_t len, bool nostop);
+#define hal_spi_init(freq)  (void)0
+int hal_spi_write(const uint8_t *data, size_t len);
+int hal_spi_read(uint8_t *data, size_t len);
+
+// Secondary UART (the transport itself is faked in fakes.c).
+#define hal_uart_init(baud)  (void)0
+#define hal_uart_deinit()  (void)0
+
+// USB HID.
+#define hal_usb_task()  (void)0
+#define hal_usb_ready()  true
+#define hal_usb_suspended()  false
+#define hal_usb_remote_wakeup()  (void)0
+#define hal_usb_hid_ready(instance)  true
+#define hal_usb_hid_is_boot(instance)  false
+bool hal_usb_hid_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len);
+
+// Board.
+void hal_board_id(char *buffer, uint8_t len);
+uint32_t hal_rand_32();
+
+// Cycle counter.
+uint32_t hal_cycles();
+#define hal_cycles_init(mask)  (void)(mask)
+
+// Test side.
+typedef struct HalHostReport_struct {
+    uint64_t timestamp;
+    uint8_t instance;
+    uint8_t report_id;
+    uint8_t len;
+    uint8_t data[HAL_HOST_REPORT_SIZE];
+} HalHostReport;
+
+void hal_host_reset();
+void hal_host_set_time(uint64_t timestamp);
+void hal_host_advance(uint64_t us);
+void hal_host_gpio_set(uint8_t pin, bool value);
+void hal_host_gpio_bounce(uint8_t pin, bool value, uint8_t edges);
+void hal_host_gpio_follow(uint8_t output, uint8_t input, uint32_t delay_us);
+void hal_host_adc_set(uint8_t channel, uint16_t value);
+void hal_host_i2c_set(uint8_t device, uint8_t reg, uint8_t value);
+uint8_t hal_host_i2c_get(uint8_t device, uint8_t reg);
+void hal_host_spi_set(uint8_t cs, uint8_t reg, const uint8_t *data, uint8_t len);
+void hal_host_report_capture(uint8_t instance, uint8_t report_id, const void *report, uint16_t len);
+HalHostReport *hal_host_reports(uint32_t *len);
+void hal_host_reports_clear();
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "link.h"
+#include "uart.h"
+#include "ctrl.h"
+
+#define LINK_BITS_PER_BYTE 10  // Start, 8 data and stop bits.
+
+typedef struct LinkSide_struct {
+    UartTxSlot slots[UART_TX_SLOTS];
+    bool lost[UART_TX_SLOTS];
+    uint8_t head;
+    uint8_t count;
+    uint8_t offset;  // Bytes of the head frame already sent.
+    uint64_t budget;  // Bit-microseconds available to send.
+    uint8_t rx[LINK_RX_SIZE];
+    uint32_t rx_read;
+    uint32_t rx_write;
+    uint32_t stat_bytes;
+    uint32_t stat_frames;
+    uint32_t stat_rejected;
+    uint32_t stat_lost;
+} LinkSide;
+
+static LinkSide sides[2];
+static uint32_t link_baud = 0;
+static float link_loss = 0;
+static float link_busy = 0;
+static uint32_t refused = 0;
+static uint32_t random_state = 1;
+static LinkReportCallback report_callback = NULL;
+static uint32_t foreign = 0;
+
+static float link_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return (float)random_state / UINT32_MAX;
+}
+
+void link_reset(uint32_t baud, float loss, uint32_t seed) {
+    memset(sides, 0, sizeof(sides));
+    link_baud = baud;
+    link_loss = loss;
+    link_busy = 0;
+    refused = 0;
+    random_state = seed ? seed : 1;
+    report_callback = NULL;
+    foreign = 0;
+}
+
+static void link_receive(LinkSide *self, const uint8_t *data, uint32_t len) {
+    if (self->rx_write + len > LINK_RX_SIZE) {
+        // Compact the unread bytes to the start.
+        memmove(self->rx, &self->rx[self->rx_read], self->rx_write - self->rx_read);
+        self->rx_write -= self->rx_read;
+        self->rx_read = 0;
+    }
+    if (self->rx_write + len > LINK_RX_SIZE) abort();
+    memcpy(&self->rx[self->rx_write], data, len);
+    self->rx_write += len;
+}
+
+void link_advance(uint32_t us) {
+    static const uint64_t BYTE_COST = LINK_BITS_PER_BYTE * 1000000ULL;
+    for(uint8_t end=0; end<2; end++) {
+        LinkSide *self = &sides[end];
+        LinkSide *other = &sides[!end];
+        if (!self->count) {
+            self->budget = 0;
+            continue;
+        }
+        self->budget += (uint64_t)us * link_baud;
+        while(self->count && self->budget >= BYTE_COST) {
+            self->budget -= BYTE_COST;
+            UartTxSlot *slot = &self->slots[self->head];
+            if (!self->lost[self->head]) link_receive(other, &slot->data[self->offset], 1);
+            self->stat_bytes++;
+            self->offset++;
+            if (self->offset == slot->len) {
+                self->head = (self->head + 1) % UART_TX_SLOTS;
+                self->count--;
+                self->offset = 0;
+            }
+        }
+    }
+}
+
+void link_inject(LinkEnd end, const uint8_t *data, uint32_t len) {
+    link_receive(&sides[end], data, len);
+}
+
+void link_set_report_callback(LinkReportCallback callback) {
+    report_callback = callback;
+}
+
+void link_set_busy(float busy) {
+    link_busy = busy;
+}
+
+uint32_t link_tx_bytes(LinkEnd end) {
+    return sides[end].stat_bytes;
+}
+
+uint32_t link_tx_frames(LinkEnd end) {
+    return sides[end].stat_frames;
+}
+
+uint32_t link_tx_rejected(LinkEnd end) {
+    return sides[end].stat_rejected;
+}
+
+uint32_t link_tx_queued(LinkEnd end) {
+    return sides[end].count;
+}
+
+uint32_t link_lost(LinkEnd end) {
+    return sides[end].stat_lost;
+}
+
+uint32_t link_rx_pending(LinkEnd end) {
+    return sides[end].rx_write - sides[end].rx_read;
+}
+
+uint8_t *link_rx_next(LinkEnd end) {
+    return &sides[end].rx[sides[end].rx_read];
+}
+
+uint32_t link_foreign() {
+    return foreign;
+}
+
+uint32_t link_refused() {
+    return refused;
+}
+
+// Transport of each end.
+
+static bool link_tx_send(LinkSide *self, uint8_t *data, uint8_t len) {
+    if (self->count == UART_TX_SLOTS) {
+        self->stat_rejected++;
+        return false;
+    }
+    uint8_t index = (self->head + self->count) % UART_TX_SLOTS;
+    self->slots[index].len = len;
+    memcpy(self->slots[index].data, data, len);
+    self->lost[index] = link_loss > 0 && link_random() < link_loss;
+    if (self->lost[index]) self->stat_lost++;
+    self->count++;
+    self->stat_frames++;
+    return true;
+}
+
+static uint16_t link_rx_available(LinkSide *self) {
+    uint32_t available = self->rx_write - self->rx_read;
+    return available > 0xFFFF ? 0xFFFF : available;
+}
+
+static void link_rx_consume(LinkSide *self, uint16_t len) {
+    self->rx_read += len;
+    if (self->rx_read == self->rx_write) {
+        self->rx_read = 0;
+        self->rx_write = 0;
+    }
+}
+
+bool controller_uart_tx_send(uint8_t *data, uint8_t len, uint8_t tag) {
+    return link_tx_send(&sides[LINK_CONTROLLER], data, len);
+}
+
+bool dongle_uart_tx_send(uint8_t *data, uint8_t len, uint8_t tag) {
+    return link_tx_send(&sides[LINK_DONGLE], data, len);
+}
+
+uint16_t controller_uart_rx_available() {
+    return link_rx_available(&sides[LINK_CONTROLLER]);
+}
+
+uint16_t dongle_uart_rx_available() {
+    return link_rx_available(&sides[LINK_DONGLE]);
+}
+
+uint8_t *controller_uart_rx_peek(uint16_t len) {
+    return &sides[LINK_CONTROLLER].rx[sides[LINK_CONTROLLER].rx_read];
+}
+
+uint8_t *dongle_uart_rx_peek(uint16_t len) {
+    return &sides[LINK_DONGLE].rx[sides[LINK_DONGLE].rx_read];
+}
+
+void controller_uart_rx_consume(uint16_t len) {
+    link_rx_consume(&sides[LINK_CONTROLLER], len);
+}
+
+void dongle_uart_rx_consume(uint16_t len) {
+    link_rx_consume(&sides[LINK_DONGLE], len);
+}
+
+// Dispatch targets of each end. Only the dongle end delivers HID reports, the
+// tests only send HID frames so anything else is counted as foreign. The USB
+// endpoint of the dongle refuses reports with the given probability, as when
+// it is still busy with the previous one.
+
+bool dongle_hid_report_dongle(uint8_t report_id, uint8_t *payload) {
+    if (link_busy > 0 && link_random() < link_busy) {
+        refused++;
+        return false;
+    }
+    if (report_callback) report_callback(report_id, payload);
+    return true;
+}
+
+bool controller_hid_report_dongle(uint8_t report_id, uint8_t *payload) { foreign++; return true; }
+void controller_config_set_protocol(uint8_t preset) { foreign++; }
+void dongle_config_set_protocol(uint8_t preset) { foreign++; }
+void controller_webusb_handle(Ctrl ctrl) { foreign++; }
+void dongle_webusb_handle(Ctrl ctrl) { foreign++; }
+bool controller_webusb_transfer_wired(Ctrl ctrl) { foreign++; return true; }
+bool dongle_webusb_transfer_wired(Ctrl ctrl) { foreign++; return true; }
+
+// Logging of each end, the bytes forwarded as ESP log text (between frames)
+// are binary noise in these tests, so only the messages are printed.
+
+static void link_info(char *end, char *msg, va_list args) {
+    if (!strncmp(msg, "%.*s", 4)) return;
+    printf("%s: ", end);
+    vprintf(msg, args);
+}
+
+void controller_info(char *msg, ...) {
+    va_list args;
+    va_start(args, msg);
+    link_info("Controller", msg, args);
+    va_end(args);
+}
+
+void dongle_info(char *msg, ...) {
+    va_list args;
+    va_start(args, msg);
+    link_info("Dongle", msg, args);
+    va_end(args);
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Simulated radio link between a controller and a dongle, each running its own
+copy of wireless.c (see wireless_role.h).
+
+Every end has a transmit queue of UART_TX_SLOTS frames and a receive buffer.
+The frames leave the transmit queue at the UART byte rate as the virtual time
+advances, and arrive byte by byte to the receive buffer of the other end,
+like the ESP relays them. A frame can be lost as a whole, with the given
+probability, as a lost radio packet. Raw bytes can also be injected directly
+into a receive buffer, to test the parser with corrupted streams. The USB
+endpoint of the dongle can refuse reports, with the given probability.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LINK_RX_SIZE 8192
+
+typedef enum LinkEnd_enum {
+    LINK_CONTROLLER,
+    LINK_DONGLE,
+} LinkEnd;
+
+typedef void (*LinkReportCallback)(uint8_t report_id, uint8_t *report);
+
+void link_reset(uint32_t baud, float loss, uint32_t seed);
+void link_advance(uint32_t us);
+void link_inject(LinkEnd end, const uint8_t *data, uint32_t len);
+void link_set_report_callback(LinkReportCallback callback);
+void link_set_busy(float busy);  // Probability of the dongle USB endpoint refusing a report.
+
+uint32_t link_tx_bytes(LinkEnd end);  // Bytes that left the transmit queue.
+uint32_t link_tx_frames(LinkEnd end);  // Frames accepted to the transmit queue.
+uint32_t link_tx_rejected(LinkEnd end);  // Frames rejected, queue full.
+uint32_t link_tx_queued(LinkEnd end);  // Frames still in the transmit queue.
+uint32_t link_lost(LinkEnd end);  // Frames lost on the way out.
+uint32_t link_rx_pending(LinkEnd end);
+uint8_t *link_rx_next(LinkEnd end);  // Next unread byte (the frame being dispatched).
+uint32_t link_foreign();  // Dispatches of other than HID reports.
+uint32_t link_refused();  // Reports refused by the dongle USB endpoint.
+
+// Both copies of wireless.c.
+void controller_wireless_send_hid(uint8_t report_id, void *packet, uint8_t len);
+bool controller_wireless_retransmit();
+void controller_wireless_uart_commands();
+void controller_wireless_log_stats();
+void dongle_wireless_dongle_task();
+void dongle_wireless_uart_commands();
+void dongle_wireless_log_stats();
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+#include "fakes.h"
+#include "hal.h"
+#include "config.h"
+#include "pin.h"
+#include "bus.h"
+#include "imu.h"
+#include "hid.h"
+#include "touch.h"
+#include "button.h"
+#include "rotary.h"
+#include "thumbstick.h"
+#include "profile.h"
+#include "profiler.h"
+#include "macro.h"
+
+#define REPLAY_LINE_LEN 256
+#define REPLAY_IMU_ID 0x6B  // LSM6DSR who am I.
+#define REPLAY_TOUCH_IDLE_US 2  // Discharge time when not touched.
+#define REPLAY_THUMBSTICK_OFFSET 0.01  // Thumbsticks do not report uncalibrated.
+
+static uint64_t epoch = 0;  // End of the boot, microseconds.
+
+static void replay_io_set(uint8_t pin, bool pressed) {
+    uint8_t device = pin >= PIN_GROUP_IO_1 ? I2C_IO_1 : I2C_IO_0;
+    uint8_t bit = pin - (pin >= PIN_GROUP_IO_1 ? PIN_GROUP_IO_1 : PIN_GROUP_IO_0);
+    uint8_t reg = I2C_IO_REG_INPUT + bit / 8;
+    uint8_t value = hal_host_i2c_get(device, reg);
+    if (pressed) value |= 1 << (bit % 8);
+    else value &= ~(1 << (bit % 8));
+    hal_host_i2c_set(device, reg, value);
+}
+
+static void replay_gyro_set(uint8_t cs, int16_t x, int16_t y, int16_t z) {
+    // See imu_read_gyro_bits for the axes order.
+    int16_t values[3] = {y, z, -x};
+    uint8_t data[6];
+    for(uint8_t i=0; i<3; i++) {
+        data[i*2] = values[i] & 0xFF;
+        data[i*2 + 1] = (uint16_t)values[i] >> 8;
+    }
+    hal_host_spi_set(cs, IMU_OUTX_L_G, data, 6);
+}
+
+static void replay_rotary(int8_t steps, uint8_t edges) {
+    for(uint8_t i=0; i<abs(steps); i++) {
+        // The rotary direction is given by the level of B after an edge of A.
+        bool a = !hal_gpio_get(PIN_ROTARY_A);
+        hal_host_gpio_set(PIN_ROTARY_B, steps > 0 ? a : !a);
+        hal_host_gpio_bounce(PIN_ROTARY_A, a, edges);
+    }
+}
+
+void replay_boot() {
+    hal_host_reset();
+    fakes_reset();
+    uint8_t id = REPLAY_IMU_ID;
+    hal_host_spi_set(PIN_SPI_CS0, IMU_WHO_AM_I, &id, 1);
+    hal_host_spi_set(PIN_SPI_CS1, IMU_WHO_AM_I, &id, 1);
+    hal_host_gpio_follow(PIN_TOUCH_OUT, PIN_TOUCH_IN, REPLAY_TOUCH_IDLE_US);
+    config_init();
+    float offset = REPLAY_THUMBSTICK_OFFSET;
+    config_set_thumbstick_offset(offset, offset, offset, offset);
+    bus_init();
+    hid_init();
+    thumbstick_init();
+    touch_init();
+    rotary_init();
+    imu_init();
+    profiler_init();
+    profile_init();
+    hal_host_reports_clear();
+    epoch = hal_time_us();
+}
+
+// Same sequence as loop_controller_task, in wired mode.
+void replay_tick() {
+    hid_apply_events();
+    profile_report_active();
+    macro_report();
+    hid_report_wired();
+}
+
+static void replay_write_reports(FILE *output) {
+    uint32_t len;
+    HalHostReport *reports = hal_host_reports(&len);
+    for(uint32_t i=0; i<len; i++) {
+        HalHostReport *report = &reports[i];
+        fprintf(
+            output,
+            "%llu %u %u ",
+            (unsigned long long)(report->timestamp - epoch),
+            report->instance,
+            report->report_id
+        );
+        for(uint8_t j=0; j<report->len; j++) fprintf(output, "%02x", report->data[j]);
+        fprintf(output, "\n");
+    }
+    hal_host_reports_clear();
+}
+
+static bool replay_event(char *line, bool *end) {
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    double ms;
+    char kind[16];
+    int consumed;
+    if (sscanf(line, " %lf %15s%n", &ms, kind, &consumed) < 2) {
+        // Blank or comment line.
+        return strspn(line, " \t\r\n") == strlen(line);
+    }
+    char *args = line + consumed;
+    int a, b, c, d;
+    int count;
+    if (!strcmp(kind, "end")) *end = true;
+    else if (!strcmp(kind, "pin") && sscanf(args, "%i %i", &a, &b) == 2) hal_host_gpio_set(a, b);
+    else if (!strcmp(kind, "io") && sscanf(args, "%i %i", &a, &b) == 2) replay_io_set(a, b);
+    else if (!strcmp(kind, "adc") && sscanf(args, "%i %i", &a, &b) == 2) hal_host_adc_set(a, b);
+    else if (!strcmp(kind, "gyro") && sscanf(args, "%i %i %i %i", &a, &b, &c, &d) == 4) replay_gyro_set(a, b, c, d);
+    else if (!strcmp(kind, "touch") && sscanf(args, "%i", &a) == 1) hal_host_gpio_follow(PIN_TOUCH_OUT, PIN_TOUCH_IN, a);
+    else if (!strcmp(kind, "rotary") && (count = sscanf(args, "%i %i", &a, &b)) >= 1) replay_rotary(a, count == 2 ? b : 1);
+    else return false;
+    return true;
+}
+
+bool replay_run(FILE *trace, FILE *output) {
+    char line[REPLAY_LINE_LEN];
+    uint32_t line_number = 0;
+    uint64_t tick = hal_time_us();
+    bool end = false;
+    while(!end && fgets(line, sizeof(line), trace)) {
+        line_number++;
+        // Peek the time of the event, run the ticks until then.
+        double ms;
+        if (sscanf(line, " %lf", &ms) == 1) {
+            uint64_t at = epoch + (uint64_t)(ms * 1000);
+            while(tick < at) {
+                hal_host_set_time(tick);
+                replay_tick();
+                tick += CFG_TICK_INTERVAL_IN_US;
+            }
+            hal_host_set_time(at);
+        }
+        if (!replay_event(line, &end)) {
+            fprintf(stderr, "Replay: Invalid event in line %u: %s", line_number, line);
+            return false;
+        }
+        replay_write_reports(output);
+    }
+    replay_write_reports(output);
+    return true;
+}
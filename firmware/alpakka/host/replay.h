@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Trace replay, boots the controller logic on the host fakes and plays a text
+trace of input events against the virtual clock, running the same tick as
+loop_controller_task (wired mode) every CFG_TICK_INTERVAL_IN_US.
+
+One event per line, times in milliseconds since the end of the boot, "#"
+starts a comment:
+
+    <ms> pin <gpio> <level>       Board pin level (buttons are active low).
+    <ms> io <pin> <pressed>       IO expander button (pin 100-115, 200-215).
+    <ms> adc <channel> <value>    Raw 12-bit ADC value.
+    <ms> gyro <cs> <x> <y> <z>    Raw IMU gyro registers of the given CS pin.
+    <ms> touch <us>               Touch discharge time (above threshold is touched).
+    <ms> rotary <steps> [edges]   Rotary encoder steps (negative is down), each
+                                  with that many bouncing edges (odd, default 1).
+    <ms> end                      Stop the replay.
+
+Every captured USB report is written to the output as one line:
+
+    <us> <instance> <report_id> <hex bytes>
+*/
+
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+void replay_boot();
+void replay_tick();
+bool replay_run(FILE *trace, FILE *output);
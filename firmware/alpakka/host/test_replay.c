@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Replays a trace (see replay.h) and compares the captured USB reports with the
+expected ones, line by line.
+
+Usage: test_replay <trace> <expected> [--update]
+With --update the expected file is (re)written instead.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <trace> <expected> [--update]\n", argv[0]);
+        return 2;
+    }
+    bool update = argc > 3 && !strcmp(argv[3], "--update");
+    FILE *trace = fopen(argv[1], "r");
+    if (!trace) {
+        perror(argv[1]);
+        return 2;
+    }
+    char *actual = NULL;
+    size_t actual_len = 0;
+    FILE *output = open_memstream(&actual, &actual_len);
+    replay_boot();
+    bool valid = replay_run(trace, output);
+    fclose(output);
+    fclose(trace);
+    if (!valid) return 1;
+    if (update) {
+        FILE *expected = fopen(argv[2], "w");
+        fwrite(actual, 1, actual_len, expected);
+        fclose(expected);
+        printf("Updated %s\n", argv[2]);
+        return 0;
+    }
+    FILE *expected = fopen(argv[2], "r");
+    if (!expected) {
+        perror(argv[2]);
+        return 2;
+    }
+    // Compare line by line, report the first difference.
+    FILE *actual_file = fmemopen(actual, actual_len, "r");
+    char line_expected[512];
+    char line_actual[512];
+    uint32_t line = 0;
+    uint32_t reports = 0;
+    while(true) {
+        char *e = fgets(line_expected, sizeof(line_expected), expected);
+        char *a = fgets(line_actual, sizeof(line_actual), actual_file);
+        line++;
+        if (!e && !a) break;
+        if (!e || !a || strcmp(e, a)) {
+            printf("FAIL %s line %u\n", argv[1], line);
+            printf("  expected: %s", e ? e : "(end)\n");
+            printf("  actual:   %s", a ? a : "(end)\n");
+            return 1;
+        }
+        reports++;
+    }
+    printf("OK %s (%u reports)\n", argv[1], reports);
+    return 0;
+}
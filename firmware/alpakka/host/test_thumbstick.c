@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Bounds the error of the Q15 thumbstick pipeline (Thumbstick__position) against
+the float pipeline it replaced, over random ADC values, offsets and profile
+settings.
+
+Usage: test_thumbstick [samples]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "fakes.h"
+#include "hal.h"
+#include "config.h"
+#include "pin.h"
+#include "common.h"
+#include "thumbstick.h"
+
+#define MAX_ERROR_RADIUS 0.0015
+#define MAX_ERROR_XY 0.002
+#define MAX_ERROR_ANGLE 0.1  // Degrees, away from the center.
+#define ANGLE_MIN_RADIUS 0.05  // Below any deadzone preset.
+#define DEADZONE_EDGE 0.002  // Radius too close to the deadzone to compare.
+#define OFFSET_SETS 8
+
+typedef struct Reference_struct {
+    float x;
+    float y;
+    float angle;  // Degrees.
+    float radius;
+} Reference;
+
+static float random_float(float low, float high) {
+    return low + (high - low) * ((float)rand() / RAND_MAX);
+}
+
+// The float pipeline as it was before the Q15 port, smoothing disabled.
+static Reference reference_position(
+    Thumbstick *self,
+    uint16_t raw_x,
+    uint16_t raw_y,
+    float offset_x,
+    float offset_y
+) {
+    float x = ((float)raw_x - BIT_11) / BIT_11 * THUMBSTICK_BASELINE_SATURATION - offset_x;
+    float y = ((float)raw_y - BIT_11) / BIT_11 * THUMBSTICK_BASELINE_SATURATION - offset_y;
+    x /= self->saturation;
+    y /= self->saturation;
+    x = constrain(x, -1, 1) * (self->invert_x ? -1 : 1);
+    y = constrain(y, -1, 1) * (self->invert_y ? -1 : 1);
+    float deadzone = self->deadzone / self->saturation;
+    float angle = atan2(x, -y) * (180 / M_PI);
+    float radius = sqrt(powf(x, 2) + powf(y, 2));
+    radius = constrain(radius, 0, 1);
+    Reference ref = {0, 0, angle, radius};
+    if (radius < deadzone) {
+        radius = 0;
+    } else {
+        radius = ramp_low(radius, deadzone);
+        radius = ramp_inv(radius, self->antideadzone);
+    }
+    ref.x = sin(radians(angle)) * radius;
+    ref.y = -cos(radians(angle)) * radius;
+    ref.radius = radius;
+    return ref;
+}
+
+int main(int argc, char **argv) {
+    uint32_t samples = argc > 1 ? atoi(argv[1]) : 200000;
+    hal_host_reset();
+    fakes_reset();
+    config_init();
+    srand(1);
+    float max_radius = 0;
+    float max_xy = 0;
+    float max_angle = 0;
+    uint32_t compared = 0;
+    for(uint8_t set=0; set<OFFSET_SETS; set++) {
+        float offset_x = random_float(-0.1, 0.1);
+        float offset_y = random_float(-0.1, 0.1);
+        config_set_thumbstick_offset(offset_x, offset_y, offset_x, offset_y);
+        thumbstick_init();
+        for(uint32_t i=0; i<samples/OFFSET_SETS; i++) {
+            Thumbstick thumbstick = Thumbstick_(
+                0,
+                PIN_THUMBSTICK_LX,
+                PIN_THUMBSTICK_LY,
+                rand() % 2,
+                rand() % 2,
+                THUMBSTICK_MODE_4DIR,
+                THUMBSTICK_DISTANCE_AXIAL,
+                true,
+                random_float(0, 0.3),
+                random_float(0, 0.3),
+                random_float(0, 1),
+                random_float(0.5, THUMBSTICK_BASELINE_SATURATION)
+            );
+            uint16_t raw_x = rand() % 4096;
+            uint16_t raw_y = rand() % 4096;
+            hal_host_adc_set(PIN_THUMBSTICK_LX - PIN_ADC_FIRST, raw_x);
+            hal_host_adc_set(PIN_THUMBSTICK_LY - PIN_ADC_FIRST, raw_y);
+            ThumbstickPosition pos = thumbstick.position(&thumbstick);
+            Reference ref = reference_position(&thumbstick, raw_x, raw_y, offset_x, offset_y);
+            // Around the deadzone edge the radius jumps from zero to the
+            // anti-deadzone, so a rounding difference there is not an error.
+            float x = ((float)raw_x - BIT_11) / BIT_11 * THUMBSTICK_BASELINE_SATURATION - offset_x;
+            float y = ((float)raw_y - BIT_11) / BIT_11 * THUMBSTICK_BASELINE_SATURATION - offset_y;
+            float magnitude = fminf(sqrtf(x*x + y*y) / thumbstick.saturation, 1);
+            float deadzone = thumbstick.deadzone / thumbstick.saturation;
+            if (fabsf(magnitude - deadzone) < DEADZONE_EDGE) continue;
+            float error_radius = fabsf(pos.radius - ref.radius);
+            float error_xy = fmaxf(fabsf(pos.x - ref.x), fabsf(pos.y - ref.y));
+            max_radius = fmaxf(max_radius, error_radius);
+            max_xy = fmaxf(max_xy, error_xy);
+            // Near the center the ADC step is a few degrees, in both pipelines.
+            if (magnitude > ANGLE_MIN_RADIUS) {
+                float angle = pos.angle * 360.0 / 65536.0;
+                float error_angle = fabsf(angle - ref.angle);
+                error_angle = fminf(error_angle, 360 - error_angle);
+                max_angle = fmaxf(max_angle, error_angle);
+            }
+            compared++;
+        }
+    }
+    printf("Compared %u samples\n", compared);
+    printf("  radius error %.6f (max %.6f)\n", max_radius, MAX_ERROR_RADIUS);
+    printf("  x/y error    %.6f (max %.6f)\n", max_xy, MAX_ERROR_XY);
+    printf("  angle error  %.4f deg (max %.4f)\n", max_angle, MAX_ERROR_ANGLE);
+    if (max_radius > MAX_ERROR_RADIUS || max_xy > MAX_ERROR_XY || max_angle > MAX_ERROR_ANGLE) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Feeds the dongle end of wireless.c (wireless_uart_commands) with a stream of
+AT_HID frames where some of them are corrupted: a flipped byte, a truncated
+tail, or a bogus length. The stream is fed one byte at a time, and checks:
+
+- No frame with a bad CRC is ever dispatched. The bytes of every dispatched
+  frame are checked again when dispatched, with a bitwise CRC-16/CCITT-FALSE
+  independent from the nibble table in wireless.c.
+- A flipped byte inside the checked bytes is always detected (CRC-16 catches
+  any burst up to 16 bits), so a flipped frame is never dispatched.
+- Every intact frame is dispatched, at most AT_FRAME_MAX_LEN bytes after its
+  last byte arrived (the parser resynchronizes within one maximum frame).
+
+A truncated frame or a bogus length makes the parser check the CRC over bytes
+of the next frame, which matches by chance once every 65536 checks. Those
+collisions are counted and reported, an intact frame may only be missed when
+a collision swallowed it.
+
+Usage: test_wireless_fuzz [frames] [seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "link.h"
+#include "uart.h"
+#include "hid.h"
+
+#define FUZZ_CORRUPTED_PERCENT 30
+
+typedef enum FuzzMutation_enum {
+    FUZZ_INTACT,
+    FUZZ_FLIP,
+    FUZZ_TRUNCATE,
+    FUZZ_BOGUS_LENGTH,
+    FUZZ_MUTATIONS,
+} FuzzMutation;
+
+typedef struct FuzzFrame_struct {
+    FuzzMutation mutation;
+    uint32_t end;  // Stream offset after the last byte.
+    bool dispatched;
+    uint32_t dispatched_at;
+} FuzzFrame;
+
+static FuzzFrame *frames;
+static uint32_t frames_len = 0;
+static uint32_t fed = 0;
+static uint32_t bad_crc_dispatches = 0;
+static uint32_t collisions = 0;
+static uint32_t flipped_dispatches = 0;
+
+static uint16_t crc16_bitwise(uint8_t *data, uint16_t len) {
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i=0; i<len; i++) {
+        crc ^= data[i] << 8;
+        for(uint8_t bit=0; bit<8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint8_t build_frame(uint8_t *frame, uint32_t index) {
+    uint8_t len = 2 + sizeof(GamepadReport);
+    uint8_t *payload = &frame[AT_HEADER_LEN];
+    frame[0] = UART_CONTROL_0;
+    frame[1] = UART_CONTROL_1;
+    frame[2] = UART_CONTROL_2;
+    frame[3] = AT_HID;
+    frame[4] = len;
+    payload[0] = REPORT_GAMEPAD;
+    payload[1] = index & 0xFF;
+    // The report starts with the frame index, so the dispatch can be traced
+    // back to its frame, the rest is noise.
+    memcpy(&payload[2], &index, sizeof(index));
+    for(uint8_t i=2+sizeof(index); i<len; i++) payload[i] = rand();
+    uint16_t crc = crc16_bitwise(&frame[3], 2 + len);
+    frame[AT_HEADER_LEN + len] = crc & 0xFF;
+    frame[AT_HEADER_LEN + len + 1] = crc >> 8;
+    return AT_HEADER_LEN + len + AT_CRC_LEN;
+}
+
+static uint8_t mutate(uint8_t *frame, uint8_t len, FuzzMutation mutation) {
+    if (mutation == FUZZ_FLIP) {
+        // Not the length, that is a bogus length.
+        uint8_t index = rand() % (len - 1);
+        if (index >= 4) index++;
+        frame[index] ^= 1 + rand() % 255;
+    }
+    if (mutation == FUZZ_TRUNCATE) {
+        len = 1 + rand() % (len - 1);
+    }
+    if (mutation == FUZZ_BOGUS_LENGTH) {
+        uint8_t bogus = rand();
+        if (bogus == frame[4]) bogus++;
+        frame[4] = bogus;
+    }
+    return len;
+}
+
+static void on_report(uint8_t report_id, uint8_t *report) {
+    // The frame stays in the receive buffer until it is dispatched.
+    uint8_t *frame = link_rx_next(LINK_DONGLE);
+    uint8_t len = frame[4];
+    uint16_t crc = frame[AT_HEADER_LEN + len] | (frame[AT_HEADER_LEN + len + 1] << 8);
+    if (crc != crc16_bitwise(&frame[3], 2 + len)) {
+        bad_crc_dispatches++;
+        return;
+    }
+    uint32_t index;
+    memcpy(&index, report, sizeof(index));
+    if (report_id != REPORT_GAMEPAD || index >= frames_len || frames[index].mutation != FUZZ_INTACT) {
+        if (index < frames_len && frames[index].mutation == FUZZ_FLIP) flipped_dispatches++;
+        else collisions++;
+        return;
+    }
+    frames[index].dispatched = true;
+    frames[index].dispatched_at = fed;
+}
+
+static void feed(uint8_t *data, uint32_t len) {
+    for(uint32_t i=0; i<len; i++) {
+        link_inject(LINK_DONGLE, &data[i], 1);
+        fed++;
+        dongle_wireless_uart_commands();
+    }
+}
+
+int main(int argc, char **argv) {
+    frames_len = argc > 1 ? atoi(argv[1]) : 20000;
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+    frames = calloc(frames_len, sizeof(FuzzFrame));
+    link_reset(0, 0, 1);
+    link_set_report_callback(on_report);
+    uint32_t mutations[FUZZ_MUTATIONS] = {0,};
+    for(uint32_t i=0; i<frames_len; i++) {
+        uint8_t frame[AT_FRAME_MAX_LEN];
+        uint8_t len = build_frame(frame, i);
+        FuzzMutation mutation = FUZZ_INTACT;
+        if (rand() % 100 < FUZZ_CORRUPTED_PERCENT) mutation = 1 + rand() % (FUZZ_MUTATIONS - 1);
+        len = mutate(frame, len, mutation);
+        mutations[mutation]++;
+        frames[i].mutation = mutation;
+        frames[i].end = fed + len;
+        feed(frame, len);
+    }
+    // Enough filler for a bogus length at the very end to time out.
+    uint8_t filler[AT_FRAME_MAX_LEN] = {0,};
+    feed(filler, sizeof(filler));
+    uint32_t missed = 0;
+    uint32_t latency_max = 0;
+    for(uint32_t i=0; i<frames_len; i++) {
+        if (frames[i].mutation != FUZZ_INTACT) continue;
+        if (!frames[i].dispatched) {
+            if (!missed) printf("Frame %u not dispatched\n", i);
+            missed++;
+            continue;
+        }
+        uint32_t latency = frames[i].dispatched_at - frames[i].end;
+        if (latency > latency_max) latency_max = latency;
+    }
+    printf(
+        "Frames %u: intact=%u flipped=%u truncated=%u bogus_length=%u\n",
+        frames_len,
+        mutations[FUZZ_INTACT],
+        mutations[FUZZ_FLIP],
+        mutations[FUZZ_TRUNCATE],
+        mutations[FUZZ_BOGUS_LENGTH]
+    );
+    printf("  bad CRC dispatched:    %u\n", bad_crc_dispatches);
+    printf("  flipped dispatched:    %u\n", flipped_dispatches);
+    printf("  CRC collisions:        %u\n", collisions);
+    printf("  intact not dispatched: %u\n", missed);
+    printf("  other dispatches:      %u\n", link_foreign());
+    printf("  resync latency max:    %u bytes (max %u)\n", latency_max, AT_FRAME_MAX_LEN);
+    free(frames);
+    if (
+        bad_crc_dispatches ||
+        flipped_dispatches ||
+        missed > collisions ||
+        link_foreign() ||
+        latency_max > AT_FRAME_MAX_LEN
+    ) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Throughput of the radio link: a controller and a dongle (both running
+wireless.c, see link.h) connected through UARTs at ESP_DATA_BAUD, with the
+controller producing input on every tick for a few seconds and then going
+quiet.
+
+Every tick the controller sends a single report like hid_report_wireless
+does: the keyboard first if it changed, otherwise the mouse or the gamepad
+(alternating, both change on every tick), and then the retransmissions that
+timed out. The mouse motion accumulates until its report is sent.
+
+Checks that the link keeps up (nothing rejected by the transmit queue), that
+the gamepad reports arrive within a few ticks, that the keyboard state of the
+dongle catches up with the controller in a bounded time even while the other
+classes never go idle (a lost key release must not stick), and that the
+dongle ends with the same state as the controller (and, without loss, the same
+total mouse motion). Prints the report rate, the bytes per frame and the link
+usage.
+
+With a busy ratio, the USB endpoint of the dongle refuses that share of the
+reports, and the same checks apply: a refused report must reach the USB later
+(the dongle acknowledged it already, so the controller does not send it
+again), with the mouse motion of the reports that replaced it.
+
+Usage: test_wireless_link [loss] [seed] [busy]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "link.h"
+#include "hal.h"
+#include "hid.h"
+#include "esp.h"
+#include "config.h"
+
+#define LINK_INPUT_MS 5000
+#define LINK_QUIET_MS 1000
+#define LINK_KEY_INTERVAL_MS 100
+#define LINK_LATENCY_MAX_TICKS 3  // Gamepad, without loss.
+#define LINK_STALE_MAX_TICKS 50  // Keyboard state behind the controller.
+#define LINK_SENT_HISTORY 64  // Gamepad reports remembered for the latency.
+
+static KeyboardReport dongle_keyboard = {0,};
+static GamepadReport dongle_gamepad = {0,};
+static int64_t dongle_motion_x = 0;
+static int64_t dongle_motion_y = 0;
+
+static GamepadReport sent_gamepad[LINK_SENT_HISTORY];
+static uint32_t sent_gamepad_at[LINK_SENT_HISTORY];
+static uint32_t sent_gamepad_len = 0;
+static uint32_t tick = 0;
+static uint32_t latency_max = 0;
+static uint64_t latency_sum = 0;
+static uint32_t latency_count = 0;
+
+static void on_report(uint8_t report_id, uint8_t *report) {
+    if (report_id == REPORT_KEYBOARD) {
+        memcpy(&dongle_keyboard, report, sizeof(KeyboardReport));
+    }
+    if (report_id == REPORT_MOUSE) {
+        MouseReport mouse;
+        memcpy(&mouse, report, sizeof(MouseReport));
+        dongle_motion_x += mouse.x;
+        dongle_motion_y += mouse.y;
+    }
+    if (report_id == REPORT_GAMEPAD) {
+        memcpy(&dongle_gamepad, report, sizeof(GamepadReport));
+        for(uint32_t i=0; i<LINK_SENT_HISTORY && i<sent_gamepad_len; i++) {
+            uint32_t index = (sent_gamepad_len - 1 - i) % LINK_SENT_HISTORY;
+            if (memcmp(&sent_gamepad[index], report, sizeof(GamepadReport))) continue;
+            uint32_t latency = tick - sent_gamepad_at[index];
+            if (latency > latency_max) latency_max = latency;
+            latency_sum += latency;
+            latency_count++;
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    float loss = argc > 1 ? atof(argv[1]) : 0;
+    uint32_t seed = argc > 2 ? atoi(argv[2]) : 1;
+    float busy = argc > 3 ? atof(argv[3]) : 0;
+    hal_host_reset();
+    link_reset(ESP_DATA_BAUD, loss, seed);
+    link_set_busy(busy);
+    link_set_report_callback(on_report);
+    KeyboardReport keyboard = {0,};
+    GamepadReport gamepad = {0,};
+    MouseReport mouse = {0,};
+    int64_t motion_x = 0;
+    int64_t motion_y = 0;
+    bool keyboard_dirty = false;
+    bool mouse_dirty = false;
+    bool gamepad_dirty = false;
+    bool mouse_turn = false;
+    uint32_t reports = 0;
+    uint32_t retransmits = 0;
+    uint32_t queued_max = 0;
+    uint32_t stale = 0;
+    uint32_t stale_max = 0;
+    for(tick=0; tick<LINK_INPUT_MS+LINK_QUIET_MS; tick++) {
+        // Input.
+        if (tick < LINK_INPUT_MS) {
+            if (tick % LINK_KEY_INTERVAL_MS == 0) {
+                keyboard.keycode[0] = keyboard.keycode[0] ? 0 : 4 + (tick / LINK_KEY_INTERVAL_MS) % 26;
+                keyboard_dirty = true;
+            }
+            int16_t dx = 3;
+            int16_t dy = (tick % 7) - 3;
+            mouse.x += dx;
+            mouse.y += dy;
+            motion_x += dx;
+            motion_y += dy;
+            mouse_dirty = true;
+            gamepad.lx = 20000 * sin(tick / 100.0);
+            gamepad.ly = 20000 * cos(tick / 100.0);
+            gamepad.buttons = (tick / 250) % 2;
+            gamepad_dirty = true;
+        }
+        // Report, one per tick.
+        if (keyboard_dirty) {
+            controller_wireless_send_hid(REPORT_KEYBOARD, &keyboard, sizeof(keyboard));
+            keyboard_dirty = false;
+            reports++;
+        }
+        else if (mouse_dirty && (mouse_turn || !gamepad_dirty)) {
+            controller_wireless_send_hid(REPORT_MOUSE, &mouse, sizeof(mouse));
+            mouse = (MouseReport){0,};
+            mouse_dirty = false;
+            mouse_turn = false;
+            reports++;
+        }
+        else if (gamepad_dirty) {
+            controller_wireless_send_hid(REPORT_GAMEPAD, &gamepad, sizeof(gamepad));
+            uint32_t index = sent_gamepad_len++ % LINK_SENT_HISTORY;
+            sent_gamepad[index] = gamepad;
+            sent_gamepad_at[index] = tick;
+            gamepad_dirty = false;
+            mouse_turn = true;
+            reports++;
+        }
+        if (controller_wireless_retransmit()) retransmits++;
+        if (link_tx_queued(LINK_CONTROLLER) > queued_max) queued_max = link_tx_queued(LINK_CONTROLLER);
+        // One tick of UART time, then both ends read what arrived.
+        hal_host_advance(CFG_TICK_INTERVAL_IN_US);
+        link_advance(CFG_TICK_INTERVAL_IN_US);
+        dongle_wireless_dongle_task();
+        controller_wireless_uart_commands();
+        stale = memcmp(&keyboard, &dongle_keyboard, sizeof(keyboard)) ? stale + 1 : 0;
+        if (stale > stale_max) stale_max = stale;
+    }
+    float seconds = (LINK_INPUT_MS + LINK_QUIET_MS) / 1000.0;
+    uint32_t bytes = link_tx_bytes(LINK_CONTROLLER);
+    uint32_t frames = link_tx_frames(LINK_CONTROLLER);
+    float capacity = ESP_DATA_BAUD / 10.0 * seconds;
+    printf(
+        "Link at %u baud, loss %.1f%%, busy %.1f%%, %.0f seconds\n",
+        ESP_DATA_BAUD, loss * 100, busy * 100, seconds
+    );
+    printf("  reports:      %u (%.0f/s while active), retransmits %u\n",
+        reports, reports / (LINK_INPUT_MS / 1000.0), retransmits);
+    printf("  frame bytes:  %.1f average\n", (float)bytes / frames);
+    printf("  capacity:     %.0f frames/s of that size\n", ESP_DATA_BAUD / 10.0 / ((float)bytes / frames));
+    printf("  link usage:   %.1f%% to the dongle, %.1f%% to the controller\n",
+        bytes / capacity * 100, link_tx_bytes(LINK_DONGLE) / capacity * 100);
+    printf("  queued max:   %u frames, rejected %u\n", queued_max, link_tx_rejected(LINK_CONTROLLER));
+    printf("  gamepad latency: %.2f ticks average, %u max\n",
+        latency_count ? (float)latency_sum / latency_count : 0, latency_max);
+    printf("  keyboard stale:  %u ticks max\n", stale_max);
+    printf("  USB refused:     %u reports\n", link_refused());
+    controller_wireless_log_stats();
+    dongle_wireless_log_stats();
+    bool valid = true;
+    if (link_tx_rejected(LINK_CONTROLLER) || link_tx_rejected(LINK_DONGLE)) {
+        printf("Transmit queue overflow\n");
+        valid = false;
+    }
+    if (memcmp(&keyboard, &dongle_keyboard, sizeof(keyboard))) {
+        printf("Keyboard state differs\n");
+        valid = false;
+    }
+    if (memcmp(&gamepad, &dongle_gamepad, sizeof(gamepad))) {
+        printf("Gamepad state differs\n");
+        valid = false;
+    }
+    if (!loss && (motion_x != dongle_motion_x || motion_y != dongle_motion_y)) {
+        printf("Mouse motion differs\n");
+        valid = false;
+    }
+    if (stale_max > LINK_STALE_MAX_TICKS) {
+        printf("Keyboard state behind for more than %u ticks\n", LINK_STALE_MAX_TICKS);
+        valid = false;
+    }
+    // Every refusal delays the report by a tick.
+    if (!loss && !busy && latency_max > LINK_LATENCY_MAX_TICKS) {
+        printf("Gamepad latency above %u ticks\n", LINK_LATENCY_MAX_TICKS);
+        valid = false;
+    }
+    printf(valid ? "OK\n" : "FAIL\n");
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+// wireless.c as the controller end of the link, see wireless_role.h.
+
+#define WIRELESS_ROLE controller_
+#include "wireless_role.h"
+#include "wireless.c"
@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+// wireless.c as the dongle end of the link, see wireless_role.h.
+
+#undef DEVICE_IS_ALPAKKA
+#undef DEVICE_ALPAKKA_V0
+#define DEVICE_DONGLE 1
+#define DEVICE_HAS_MARMOTA 1
+
+#define WIRELESS_ROLE dongle_
+#include "wireless_role.h"
+#include "wireless.c"
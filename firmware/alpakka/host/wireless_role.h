@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Builds wireless.c once per end of the simulated radio link (see link.h).
+
+The including file defines WIRELESS_ROLE (eg: controller_) and then includes
+wireless.c. The public functions of wireless.c, and the transport and USB
+functions it calls, get that prefix, while its static state is private to the
+translation unit. So the controller and the dongle run the same code with
+their own state, and their own UART, in a single test binary.
+*/
+
+#pragma once
+
+#define WIRELESS_ROLE_CONCAT_(a, b) a##b
+#define WIRELESS_ROLE_CONCAT(a, b) WIRELESS_ROLE_CONCAT_(a, b)
+#define WIRELESS_ROLE_NAME(name) WIRELESS_ROLE_CONCAT(WIRELESS_ROLE, name)
+
+// Defined by wireless.c.
+#define wireless_set_uart_data_mode WIRELESS_ROLE_NAME(wireless_set_uart_data_mode)
+#define wireless_init WIRELESS_ROLE_NAME(wireless_init)
+#define wireless_send_hid WIRELESS_ROLE_NAME(wireless_send_hid)
+#define wireless_send_webusb WIRELESS_ROLE_NAME(wireless_send_webusb)
+#define wireless_send_usb_protocol WIRELESS_ROLE_NAME(wireless_send_usb_protocol)
+#define wireless_retransmit WIRELESS_ROLE_NAME(wireless_retransmit)
+#define wireless_log_stats WIRELESS_ROLE_NAME(wireless_log_stats)
+#define wireless_uart_commands WIRELESS_ROLE_NAME(wireless_uart_commands)
+#define wireless_controller_task WIRELESS_ROLE_NAME(wireless_controller_task)
+#define wireless_dongle_task WIRELESS_ROLE_NAME(wireless_dongle_task)
+#define wireless_dongle_forward WIRELESS_ROLE_NAME(wireless_dongle_forward)
+
+// Provided by link.c, one for each end.
+#define uart_tx_send WIRELESS_ROLE_NAME(uart_tx_send)
+#define uart_rx_available WIRELESS_ROLE_NAME(uart_rx_available)
+#define uart_rx_peek WIRELESS_ROLE_NAME(uart_rx_peek)
+#define uart_rx_consume WIRELESS_ROLE_NAME(uart_rx_consume)
+#define hid_report_dongle WIRELESS_ROLE_NAME(hid_report_dongle)
+#define config_set_protocol WIRELESS_ROLE_NAME(config_set_protocol)
+#define webusb_handle WIRELESS_ROLE_NAME(webusb_handle)
+#define webusb_transfer_wired WIRELESS_ROLE_NAME(webusb_transfer_wired)
+#define info WIRELESS_ROLE_NAME(info)
@@ -4,26 +4,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <hardware/gpio.h>
-#include <hardware/i2c.h>
-#include <hardware/spi.h>
 #include "bus.h"
+#include "hal.h"
 #include "config.h"
 #include "pin.h"
 #include "common.h"
 #include "logging.h"
+#include "sensors.h"
 
 uint16_t io_cache_0;
 uint16_t io_cache_1;
 
 int8_t bus_i2c_acknowledge(uint8_t device) {
     uint8_t buf = 0;
-    return i2c_read_blocking(I2C_CHANNEL, device, &buf, 1, false);
+    return hal_i2c_read(device, &buf, 1, false);
 }
 
 void bus_i2c_read(uint8_t device, uint8_t reg, uint8_t *buf, uint8_t len) {
-    i2c_write_blocking(I2C_CHANNEL, device, &reg, 1, true);
-    i2c_read_blocking(I2C_CHANNEL, device, buf, len, false);
+    hal_i2c_write(device, &reg, 1, true);
+    hal_i2c_read(device, buf, len, false);
 }
 
 uint8_t bus_i2c_read_one(uint8_t device, uint8_t reg) {
@@ -40,7 +39,7 @@ uint16_t bus_i2c_read_two(uint8_t device, uint8_t reg) {
 
 void bus_i2c_write(uint8_t device, uint8_t reg, uint8_t value) {
     uint8_t data[] = {reg, value};
-    i2c_write_blocking(I2C_CHANNEL, device, data, 2, false);
+    hal_i2c_write(device, data, 2, false);
 }
 
 Tristate bus_i2c_io_tristate(uint8_t index) {
@@ -71,6 +70,11 @@ void bus_i2c_io_pcb_gen_determine() {
 }
 
 void bus_i2c_io_cache_update() {
+    if (sensors_is_active()) {
+        io_cache_0 = sensors_get()->io_0;
+        io_cache_1 = sensors_get()->io_1;
+        return;
+    }
     io_cache_0 = bus_i2c_read_two(I2C_IO_0, I2C_IO_REG_INPUT);
     io_cache_1 = bus_i2c_read_two(I2C_IO_1, I2C_IO_REG_INPUT);
 }
@@ -85,26 +89,26 @@ bool bus_i2c_io_read(uint8_t device_id, uint8_t bit_index) {
 }
 
 void bus_spi_write_32(uint8_t cs, uint8_t reg, uint8_t buf[32]) {
-    gpio_put(cs, false);
+    hal_gpio_put(cs, false);
     uint8_t regbuf[33] = {reg};
     memcpy(&regbuf[1], buf, 32);
-    spi_write_blocking(SPI_CHANNEL, regbuf, 33);
-    gpio_put(cs, true);
+    hal_spi_write(regbuf, 33);
+    hal_gpio_put(cs, true);
 }
 
 void bus_spi_write(uint8_t cs, uint8_t reg, uint8_t value) {
-    gpio_put(cs, false);
+    hal_gpio_put(cs, false);
     uint8_t tuple[2] = {reg, value};
-    spi_write_blocking(SPI_CHANNEL, tuple, 2);
-    gpio_put(cs, true);
+    hal_spi_write(tuple, 2);
+    hal_gpio_put(cs, true);
 }
 
 void bus_spi_read(uint8_t cs, uint8_t reg, uint8_t *buf, uint8_t size) {
-    gpio_put(cs, false);
+    hal_gpio_put(cs, false);
     // reg |= 0b10000000;  // Read byte.  // TODO fix IO expander read/write byte
-    spi_write_blocking(SPI_CHANNEL, &reg, 1);
-    spi_read_blocking(SPI_CHANNEL, 0, buf, size);
-    gpio_put(cs, true);
+    hal_spi_write(&reg, 1);
+    hal_spi_read(buf, size);
+    hal_gpio_put(cs, true);
 }
 
 uint8_t bus_spi_read_one(uint8_t cs, uint8_t reg) {
@@ -115,12 +119,12 @@ uint8_t bus_spi_read_one(uint8_t cs, uint8_t reg) {
 
 void bus_i2c_init() {
     info("INIT: I2C bus\n");
-    i2c_init(I2C_CHANNEL, I2C_FREQ);
-    gpio_set_function(PIN_I2C_SDA, GPIO_FUNC_I2C);
-    gpio_set_function(PIN_I2C_SCL, GPIO_FUNC_I2C);
-    gpio_pull_up(PIN_I2C_SDA);
-    gpio_pull_up(PIN_I2C_SCL);
-    if (!gpio_get(PIN_I2C_SDA) || !gpio_get(PIN_I2C_SCL)) {
+    hal_i2c_init(I2C_FREQ);
+    hal_gpio_set_function(PIN_I2C_SDA, HAL_GPIO_FUNC_I2C);
+    hal_gpio_set_function(PIN_I2C_SCL, HAL_GPIO_FUNC_I2C);
+    hal_gpio_pull_up(PIN_I2C_SDA);
+    hal_gpio_pull_up(PIN_I2C_SCL);
+    if (!hal_gpio_get(PIN_I2C_SDA) || !hal_gpio_get(PIN_I2C_SCL)) {
         error("I2C bus is not clean, unplug the controller\n");
         exit(1);
     }
@@ -147,17 +151,15 @@ void bus_i2c_io_init() {
 
 void bus_spi_init() {
     info("INIT: SPI bus\n");
-    spi_init(SPI_CHANNEL, SPI_FREQ);
-    gpio_set_function(PIN_SPI_CK, GPIO_FUNC_SPI);
-    gpio_set_function(PIN_SPI_TX, GPIO_FUNC_SPI);
-    gpio_set_function(PIN_SPI_RX, GPIO_FUNC_SPI);
+    hal_spi_init(SPI_FREQ);
+    hal_gpio_set_function(PIN_SPI_CK, HAL_GPIO_FUNC_SPI);
+    hal_gpio_set_function(PIN_SPI_TX, HAL_GPIO_FUNC_SPI);
+    hal_gpio_set_function(PIN_SPI_RX, HAL_GPIO_FUNC_SPI);
     // IMUs.
-    gpio_init(PIN_SPI_CS0);
-    gpio_init(PIN_SPI_CS1);
-    gpio_set_dir(PIN_SPI_CS0, GPIO_OUT);
-    gpio_set_dir(PIN_SPI_CS1, GPIO_OUT);
-    gpio_put(PIN_SPI_CS0, true);
-    gpio_put(PIN_SPI_CS1, true);
+    hal_gpio_init_output(PIN_SPI_CS0);
+    hal_gpio_init_output(PIN_SPI_CS1);
+    hal_gpio_put(PIN_SPI_CS0, true);
+    hal_gpio_put(PIN_SPI_CS1, true);
 }
 
 void bus_init() {
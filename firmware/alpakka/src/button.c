@@ -1,18 +1,117 @@
 // SPDX-License-Identifier: GPL-2.0-only
 // Copyright (C) 2022, Input Labs Oy.
 
+/*
+Buttons connected directly to the board pins (eg: home) are not polled, but
+captured by GPIO interrupts into a lock-free ring per pin, with the time of the
+edge in microseconds. The button logic consumes at most one edge per tick, so
+a press shorter than a tick is still seen (one tick pressed, the next one
+released), and the hold and double press logic measure the true edge times
+instead of the poll times.
+
+The interrupt handler is the only producer of each ring, and the main loop
+(same core) the only consumer. Edges within the debounce time of the previous
+one are ignored, and since that could drop a genuine release, the consumer
+also reconciles the ring with the pin level once the debounce time is over
+(doing so with the interrupts disabled, so there is still a single producer).
+*/
+
 #include <stdio.h>
 #include <string.h>
-#include <pico/time.h>
-#include <hardware/gpio.h>
 #include "button.h"
+#include "hal.h"
 #include "config.h"
 #include "hid.h"
 #include "bus.h"
+#include "sensors.h"
 #include "pin.h"
 #include "common.h"
+#include "logging.h"
 
-bool Button__is_pressed(Button *self) {
+static ButtonEdgeRing edge_rings[BUTTON_EDGE_PINS];
+static uint8_t edge_rings_len = 0;
+static volatile ButtonCallback idle_wake = NULL;
+
+static ButtonEdgeRing *button_edge_get_ring(uint8_t pin) {
+    for(uint8_t i=0; i<edge_rings_len; i++) {
+        if (edge_rings[i].pin == pin) return &edge_rings[i];
+    }
+    return NULL;
+}
+
+// Producer, called from the interrupt or with the interrupts disabled.
+static void button_edge_push(ButtonEdgeRing *ring, uint64_t now) {
+    bool pressed = !hal_gpio_get(ring->pin);
+    if (pressed == ring->last_pushed.pressed) return;
+    if (now - ring->last_pushed.timestamp < BUTTON_EDGE_DEBOUNCE_US) return;
+    uint8_t head = ring->head;
+    // If full, drop the edge and let the reconciliation catch up later.
+    if ((uint8_t)(head - ring->tail) == BUTTON_EDGE_RING_LEN) return;
+    ring->last_pushed = (ButtonEdge){.timestamp=now, .pressed=pressed};
+    ring->edges[head & (BUTTON_EDGE_RING_LEN - 1)] = ring->last_pushed;
+    hal_dmb();
+    ring->head = head + 1;
+}
+
+static void button_edge_callback() {
+    uint64_t now = hal_time_us();
+    for(uint8_t i=0; i<edge_rings_len; i++) {
+        ButtonEdgeRing *ring = &edge_rings[i];
+        uint32_t events = hal_gpio_irq_events(ring->pin);
+        if (!events) continue;
+        hal_gpio_irq_acknowledge(ring->pin, events);
+        button_edge_push(ring, now);
+    }
+    ButtonCallback wake = idle_wake;
+    if (wake) wake();
+}
+
+// While idle, an edge wakes the main task right away, so the first press is
+// not delayed by the slower tick.
+void button_set_idle(bool value, ButtonCallback wake) {
+    idle_wake = value ? wake : NULL;
+}
+
+void button_edge_init(uint8_t pin) {
+    if (button_edge_get_ring(pin)) return;
+    if (edge_rings_len == BUTTON_EDGE_PINS) {
+        warn("Button: No edge capture for pin %i\n", pin);
+        return;
+    }
+    ButtonEdgeRing *ring = &edge_rings[edge_rings_len];
+    *ring = (ButtonEdgeRing){.pin = pin};
+    ring->last_pushed.pressed = !hal_gpio_get(pin);
+    ring->last_popped = ring->last_pushed;
+    edge_rings_len++;
+    // Raw handler, so it does not replace the rotary callback.
+    hal_gpio_irq_handler(pin, button_edge_callback);
+}
+
+// Consumer, returns the state after the next edge (if any), and its time.
+bool button_edge_read(uint8_t pin, uint64_t *timestamp) {
+    ButtonEdgeRing *ring = button_edge_get_ring(pin);
+    if (ring == NULL) {
+        *timestamp = hal_time_us();
+        return !hal_gpio_get(pin);
+    }
+    if (ring->tail == ring->head) {
+        uint32_t status = hal_irq_save();
+        button_edge_push(ring, hal_time_us());
+        hal_irq_restore(status);
+    }
+    uint8_t tail = ring->tail;
+    if (tail != ring->head) {
+        hal_dmb();
+        ring->last_popped = ring->edges[tail & (BUTTON_EDGE_RING_LEN - 1)];
+        hal_dmb();
+        ring->tail = tail + 1;
+    }
+    *timestamp = ring->last_popped.timestamp;
+    return ring->last_popped.pressed;
+}
+
+static bool button_read(Button *self) {
+    self->state_timestamp = hal_time_us();
     if (self->pin == PIN_NONE) return false;
     // Virtual buttons.
     else if (self->pin == PIN_VIRTUAL) {
@@ -25,19 +124,28 @@ bool Button__is_pressed(Button *self) {
     }
     // Buttons connected directly to Pico.
     else if (is_between(self->pin, PIN_GROUP_BOARD, PIN_GROUP_BOARD_END)) {
-        return !gpio_get(self->pin);
+        return button_edge_read(self->pin, &self->state_timestamp);
     }
     // Buttons connected to 1st IO expander.
     else if (is_between(self->pin, PIN_GROUP_IO_0, PIN_GROUP_IO_0_END)) {
+        self->state_timestamp = sensors_get_timestamp();
         return bus_i2c_io_cache_read(0, self->pin - PIN_GROUP_IO_0);
     }
     // Buttons connected to 2nd IO expander.
     else if (is_between(self->pin, PIN_GROUP_IO_1, PIN_GROUP_IO_1_END)) {
+        self->state_timestamp = sensors_get_timestamp();
         return bus_i2c_io_cache_read(1, self->pin - PIN_GROUP_IO_1);
     }
     return false;  // Prevent undefined behavior.
 }
 
+// The actions triggered by this read carry the time the state was sampled.
+bool Button__is_pressed(Button *self) {
+    bool pressed = button_read(self);
+    hid_set_input_timestamp(self->state_timestamp);
+    return pressed;
+}
+
 void Button__report(Button *self) {
     if (self->mode == NORMAL) self->handle_normal(self);
     if ( (self->mode & HOLD) && !(self->mode & DOUBLE)) self->handle_hold(self);
@@ -48,12 +156,12 @@ void Button__report(Button *self) {
 
 void Button__handle_normal(Button *self) {
     uint64_t debounce = self->press_timestamp + (CFG_PRESS_DEBOUNCE * 1000);
-    if (time_us_64() < debounce) return;
+    if (hal_time_us() < debounce) return;
     bool pressed = self->is_pressed(self);
     if(pressed && !self->state_primary) {
         hid_press_multiple(self->actions);
         self->state_primary = true;
-        self->press_timestamp = time_us_64();
+        self->press_timestamp = self->state_timestamp;
         return;
     }
     if((!pressed) && self->state_primary) {
@@ -71,11 +179,11 @@ void Button__handle_hold(Button *self) {
         // Initial press.
         if (immediate) hid_press_multiple(self->actions);
         self->state_primary = true;
-        self->press_timestamp = time_us_64();
+        self->press_timestamp = self->state_timestamp;
         return;
     }
     if(pressed && self->state_primary && !self->state_secondary) {
-        if (time_us_64() > self->press_timestamp + (time * 1000)) {
+        if (hal_time_us() > self->press_timestamp + (time * 1000)) {
             // Pressed and being held long enough.
             hid_press_multiple(self->actions_secondary);
             if (!immediate) self->state_primary = false;
@@ -107,7 +215,7 @@ void Button__handle_double(Button *self) {
     bool pressed = self->is_pressed(self);
     if (pressed && !self->timestamps_updated) {
         self->press_timestamp_prev = self->press_timestamp;
-        self->press_timestamp = time_us_64();
+        self->press_timestamp = self->state_timestamp;
         self->timestamps_updated = true;
     }
     if (!pressed) {
@@ -129,7 +237,7 @@ void Button__handle_double(Button *self) {
                     hid_press_multiple(self->actions);
                     self->emitted_primary = true;
                 } else {
-                    uint64_t timeout = time_us_64() > self->press_timestamp + (time * 1000);
+                    uint64_t timeout = hal_time_us() > self->press_timestamp + (time * 1000);
                     if (timeout) {
                         // It has been held so long that the next press cannot be a double press.
                         hid_press_multiple(self->actions);
@@ -147,7 +255,7 @@ void Button__handle_double(Button *self) {
             self->state_primary = false;
             self->emitted_primary = false;
         } else {
-            uint64_t timeout = time_us_64() > self->press_timestamp + (time * 1000);
+            uint64_t timeout = hal_time_us() > self->press_timestamp + (time * 1000);
             if (timeout) {
                 // Released for so long that the next press cannot be a double press.
                 hid_press_multiple(self->actions);
@@ -171,7 +279,7 @@ void Button__handle_hold_double(Button *self) {
     bool pressed = self->is_pressed(self);
     if (pressed && !self->timestamps_updated) {
         self->press_timestamp_prev = self->press_timestamp;
-        self->press_timestamp = time_us_64();
+        self->press_timestamp = self->state_timestamp;
         self->timestamps_updated = true;
     }
     if (!pressed) {
@@ -192,7 +300,7 @@ void Button__handle_hold_double(Button *self) {
                     hid_press_multiple(self->actions);
                     self->emitted_primary = true;
                 }
-                uint64_t timeout = time_us_64() > self->press_timestamp + (hold_time * 1000);
+                uint64_t timeout = hal_time_us() > self->press_timestamp + (hold_time * 1000);
                 if (timeout) {
                     // It has been held so long that is considered held.
                     hid_press_multiple(self->actions_secondary);
@@ -208,7 +316,7 @@ void Button__handle_hold_double(Button *self) {
         self->emitted_primary = false;
     }
     if(!pressed && self->state_primary && !self->state_secondary && !self->state_terciary && !immediate) {
-        uint64_t timeout = time_us_64() > self->press_timestamp + (double_time * 1000);
+        uint64_t timeout = hal_time_us() > self->press_timestamp + (double_time * 1000);
         if (timeout) {
             // Released for so long that the next press cannot be a double press.
             hid_press_multiple(self->actions);
@@ -260,9 +368,10 @@ Button Button_ (
     Actions actions_terciary
 ) {
     if (pin) {
-        gpio_init(pin);
-        gpio_set_dir(pin, GPIO_IN);
-        gpio_pull_up(pin);
+        hal_gpio_init_input(pin, true);
+    }
+    if (is_between(pin, PIN_GROUP_BOARD, PIN_GROUP_BOARD_END)) {
+        button_edge_init(pin);
     }
     Button button;
     memcpy(button.actions, actions, 4);
@@ -283,6 +392,7 @@ Button Button_ (
     button.state_terciary = false;
     button.emitted_primary = false;
     button.virtual_press = false;
+    button.state_timestamp = 0;
     button.press_timestamp = 0;
     button.press_timestamp_prev = 0;
     button.timestamps_updated = false;
@@ -2,7 +2,7 @@
 // Copyright (C) 2022, Input Labs Oy.
 
 #include <stdio.h>
-#include "pico/rand.h"
+#include "common.h"
 
 uint32_t bin(uint8_t k) {
     return (k == 0 || k == 1 ? k : ((k % 2) + 10 * bin(k / 2)));
@@ -13,7 +13,7 @@ uint32_t bin16(uint16_t k) {
 }
 
 uint8_t random8() {
-    return (uint8_t)get_rand_32();
+    return (uint8_t)hal_rand_32();
 }
 
 void print_array(uint8_t *array, uint8_t len) {
@@ -4,9 +4,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <hardware/sync.h>
-#include <pico/unique_id.h>
 #include "config.h"
+#include "hal.h"
 #include "nvm.h"
 #include "led.h"
 #include "hid.h"
@@ -17,7 +16,10 @@
 #include "webusb.h"
 #include "common.h"
 #include "logging.h"
+#include "profiler.h"
 #include "power.h"
+#include "loop.h"
+#include "tusb_config.h"
 
 // Config values.
 Config config_cache;
@@ -104,12 +106,9 @@ void config_profile_set_sync(uint8_t index, bool state) {
     config_profile_cache_synced[index] = state;
 }
 
+// Called periodically by the scheduler (see NVM_SYNC_INTERVAL_IN_US).
 void config_sync() {
-    // Do not check in every cycle.
-    static uint16_t i = 0;
-    i++;
-    if (i != NVM_SYNC_FREQUENCY) return;
-    else i = 0;
+    uint32_t start = profiler_start();
     // Sync main config.
     if (!config_cache_synced) {
         config_write();
@@ -122,6 +121,7 @@ void config_sync() {
             }
         }
     #endif
+    profiler_stop(PROFILER_CONFIG_SYNC, start);
 }
 
 void config_write_init() {
@@ -157,6 +157,7 @@ void config_write_init() {
         .swap_gyros = 0,
         .touch_invert_polarity = 0,
         .thumbstick_smooth_samples = 0,
+        .sof_lead = CFG_SOF_LEAD_DEFAULT / 10,
     };
     config_cache.sens_mouse_values[0] = 1.0,
     config_cache.sens_mouse_values[1] = 1.5,
@@ -380,7 +381,7 @@ void config_calibrate() {
     led_set_mode(LED_MODE_BLINK);
     for(uint8_t i=0; i<5; i++) {
         info("%i... ", 5-i);
-        sleep_ms(1000);
+        hal_sleep_ms(1000);
     }
     info("\n");
     config_calibrate_execute();
@@ -406,6 +407,13 @@ uint8_t config_get_protocol() {
     return config_cache.protocol;
 }
 
+bool config_get_keyboard_nkro() {
+    if (config_cache.protocol == PROTOCOL_XINPUT_WIN) return CFG_KEYBOARD_NKRO_XINPUT_WIN;
+    if (config_cache.protocol == PROTOCOL_XINPUT_UNIX) return CFG_KEYBOARD_NKRO_XINPUT_UNIX;
+    if (config_cache.protocol == PROTOCOL_GENERIC) return CFG_KEYBOARD_NKRO_GENERIC;
+    return false;
+}
+
 uint8_t config_get_touch_sens_preset() {
     return config_cache.sens_touch;
 }
@@ -424,8 +432,8 @@ void config_set_protocol(uint8_t preset) {
     config_write();
     info("Config: Protocol preset %i\n", preset);
     #ifdef DEVICE_DONGLE
-        // On dongle: Restart directly.
-        power_restart();
+        // On dongle: Enumerate again directly.
+        usb_reenumerate(USB_WAIT_FOR_INIT_MS);
     #else
         // On controllers: Schedule restart.
         profile_notify_protocol_changed(preset);
@@ -536,6 +544,20 @@ void config_set_thumbstick_smooth_samples(uint8_t value) {
     thumbstick_update_smooth_samples();
 }
 
+void config_set_sof_lead(uint8_t value) {
+    info("Config: sof_lead=%ius\n", value * 10);
+    config_cache.sof_lead = value;
+    config_cache_synced = false;
+}
+
+// In microseconds, zero if disabled. Configs stored before this setting
+// existed read zero there, so zero is taken as the default.
+uint16_t config_get_sof_lead() {
+    if (config_cache.sof_lead == CFG_SOF_LEAD_OFF) return 0;
+    if (config_cache.sof_lead == 0) return CFG_SOF_LEAD_DEFAULT;
+    return config_cache.sof_lead * 10;
+}
+
 void config_set_problem(uint8_t flag, bool state) {
     problems_state = bitmask_set(problems_state, flag, state);
     led_show();
@@ -626,7 +648,7 @@ void config_init_profiles_from_nvm() {
 
 void config_init() {
     char board_id[64];
-    pico_get_unique_board_id_string(board_id, 64);
+    hal_board_id(board_id, 64);
     info("Board UID: %s\n", board_id);
     info("INIT: Config\n");
     config_load();
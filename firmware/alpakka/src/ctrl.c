@@ -6,6 +6,8 @@
 #include "ctrl.h"
 #include "config.h"
 #include "version.h"
+#include "loop.h"
+#include "profiler.h"
 #include "logging.h"
 
 Ctrl ctrl_empty() {
@@ -99,6 +101,9 @@ void ctrl_config_set(Ctrl_cfg_type key, uint8_t preset, uint8_t values[5]) {
     else if (key == THUMBSTICK_SMOOTH_SAMPLES) {
         config_set_thumbstick_smooth_samples(preset);
     }
+    else if (key == SOF_LEAD) {
+        config_set_sof_lead(preset);
+    }
 }
 
 Ctrl ctrl_config_share(uint8_t index) {
@@ -154,6 +159,12 @@ Ctrl ctrl_config_share(uint8_t index) {
     else if (index == THUMBSTICK_SMOOTH_SAMPLES) {
         ctrl.payload[1] = config->thumbstick_smooth_samples;
     }
+    else if (index == SOF_LEAD) {
+        // Configured and measured lead, both in tens of microseconds.
+        uint16_t lead = config_get_sof_lead();
+        ctrl.payload[1] = lead ? lead / 10 : CFG_SOF_LEAD_OFF;
+        ctrl.payload[2] = loop_get_sof_lead() / 10;
+    }
     return ctrl;
 }
 
@@ -176,3 +187,18 @@ Ctrl ctrl_section_share(uint8_t profile_index, uint8_t section_index) {
     }
     return ctrl;
 }
+
+Ctrl ctrl_profiler_share(uint8_t stage) {
+    ProfilerHistogram *histogram = profiler_get(stage);
+    Ctrl ctrl = {
+        .protocol_flags = CTRL_FLAG_NONE,
+        .device_id = ALPAKKA,
+        .message_type = PROFILER_SHARE,
+        .len = 2 + sizeof(ProfilerHistogram)
+    };
+    // Stage, number of buckets, then the histogram as is (little endian).
+    ctrl.payload[0] = stage;
+    ctrl.payload[1] = PROFILER_BUCKETS;
+    memcpy(&ctrl.payload[2], histogram, sizeof(ProfilerHistogram));
+    return ctrl;
+}
@@ -3,11 +3,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <pico/time.h>
 #include "config.h"
 #include "pin.h"
 #include "button.h"
 #include "dhat.h"
+#include "hal.h"
 #include "hid.h"
 
 bool Dhat__update(Dhat *self) {
@@ -19,10 +19,10 @@ bool Dhat__update(Dhat *self) {
     bool push = self->push.is_pressed(&self->push);
     // Debounce.
     if (left || right || up || down || push) {
-        if (time_us_64() <= self->timestamp + CFG_DHAT_DEBOUNCE_TIME*1000) {
+        if (hal_time_us() <= self->timestamp + CFG_DHAT_DEBOUNCE_TIME*1000) {
             return true;
         }
-        self->timestamp = time_us_64();
+        self->timestamp = hal_time_us();
     }
     // Cardinals.
     self->up_center.virtual_press = (up && !left && !right);
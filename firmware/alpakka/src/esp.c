@@ -73,6 +73,11 @@ void esp_bootsel() {
     #include <esp-serial-flasher/examples/common/example_common.h>
     #include "../../esp_llama/build/llama.bin.c"
     // #include "../../esp_llama/build/llama_empty.bin.c"  // Empty version for faster development.
+    #include "uart.h"
+    // The relay image must be built for the same frames (see uart.h).
+    #if !defined ESP_LLAMA_AT_PROTOCOL || ESP_LLAMA_AT_PROTOCOL != AT_PROTOCOL_VERSION
+        #error "ESP relay image built for another AT_PROTOCOL_VERSION, rebuild esp_llama"
+    #endif
 
     void esp_flash() {
         info("RF: ESP flash start\n");
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Integer math for the hot paths, since the RP2040 has no FPU and every float
+operation (and specially trigonometry) is a soft-float library call. Division
+is cheap in comparison thanks to the hardware divider.
+*/
+
+#include <stdlib.h>
+#include "fixed.h"
+
+// Arctangent of 0..1 in steps of 1/32, as binary angle.
+static const int16_t atan_table[33] = {
+    0, 326, 651, 975, 1297, 1617, 1933, 2246, 2555, 2860, 3159, 3453, 3742,
+    4025, 4302, 4572, 4836, 5094, 5344, 5589, 5826, 6058, 6282, 6500, 6712,
+    6917, 7117, 7310, 7498, 7679, 7856, 8026, 8192,
+};
+
+// Integer square root, rounded down.
+uint32_t fixed_sqrt(uint32_t x) {
+    uint32_t result = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= result + bit) {
+            x -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+// Arctangent of a ratio between 0 and 1 (Q15), interpolating the table.
+static int32_t fixed_atan_unit(uint32_t ratio) {
+    uint32_t index = ratio >> 10;
+    uint32_t fraction = ratio & 0x3FF;
+    if (index >= 32) return atan_table[32];
+    int32_t low = atan_table[index];
+    int32_t high = atan_table[index + 1];
+    return low + (((high - low) * (int32_t)fraction) >> 10);
+}
+
+// Same convention as atan2() from math.h, but returning a binary angle.
+// Inputs must be within 16 bits (eg: Q15 up to 2.0).
+int16_t fixed_atan2(int32_t y, int32_t x) {
+    uint32_t ax = abs(x);
+    uint32_t ay = abs(y);
+    if (!ax && !ay) return 0;
+    int32_t angle;
+    // Reduce to the first octant.
+    if (ax >= ay) angle = fixed_atan_unit((ay << 15) / ax);
+    else angle = ANGLE_90 - fixed_atan_unit((ax << 15) / ay);
+    if (x < 0) angle = ANGLE_180 - angle;
+    if (y < 0) angle = -angle;
+    return (int16_t)angle;
+}
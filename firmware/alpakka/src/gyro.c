@@ -13,8 +13,12 @@
 #include "pin.h"
 #include "touch.h"
 #include "vector.h"
+#include "profiler.h"
 
-double sensitivity_multiplier;
+// Sensitivity per axis, including the user multiplier.
+float sensitivity_x;
+float sensitivity_y;
+float sensitivity_z;
 
 uint8_t world_init = 0;
 Vector world_top;
@@ -24,15 +28,19 @@ Vector accel_smooth;
 
 void gyro_update_sensitivity() {
     uint8_t preset = config_get_mouse_sens_preset();
-    sensitivity_multiplier = config_get_mouse_sens_value(preset);
+    double multiplier = config_get_mouse_sens_value(preset);
+    sensitivity_x = CFG_GYRO_SENSITIVITY_X * multiplier;
+    sensitivity_y = CFG_GYRO_SENSITIVITY_Y * multiplier;
+    sensitivity_z = CFG_GYRO_SENSITIVITY_Z * multiplier;
 }
 
 void gyro_accel_correction() {
     Vector accel = imu_read_accel();
     // Convert to inverted unit value.
-    accel.x /= -BIT_14;
-    accel.y /= -BIT_14;
-    accel.z /= -BIT_14;
+    static const float scale = -1.0f / BIT_14;
+    accel.x *= scale;
+    accel.y *= scale;
+    accel.z *= scale;
     // Get a smoothed gravity vector.
     accel_smooth = vector_smooth(accel_smooth, accel, CFG_ACCEL_CORRECTION_SMOOTH);
     if (world_init < CFG_ACCEL_CORRECTION_SMOOTH) {
@@ -43,8 +51,8 @@ void gyro_accel_correction() {
         world_init++;
     } else {
         // Correction.
-        float rate_fw = (world_right.z - accel_smooth.x) * CFG_ACCEL_CORRECTION_RATE;
-        float rate_r = (world_fw.z - accel_smooth.y) * CFG_ACCEL_CORRECTION_RATE;
+        float rate_fw = (world_right.z - accel_smooth.x) * (float)CFG_ACCEL_CORRECTION_RATE;
+        float rate_r = (world_fw.z - accel_smooth.y) * (float)CFG_ACCEL_CORRECTION_RATE;
         Vector4 correction_fw = quaternion(world_fw, rate_fw);
         Vector4 correction_r = quaternion(world_right, -rate_r);
         Vector4 correction = qmultiply(correction_fw, correction_r);
@@ -58,25 +66,25 @@ void gyro_absolute_output(float value, uint8_t *actions, bool *pressed) {
     for(uint8_t i=0; i<4; i++) {
         uint8_t action = actions[i];
         if (hid_is_axis(action)) {
-            value = fabs(value);
-            if      (action == GAMEPAD_AXIS_LX)     hid_gamepad_axis(LX,  value);
-            else if (action == GAMEPAD_AXIS_LY)     hid_gamepad_axis(LY,  value);
-            else if (action == GAMEPAD_AXIS_LZ)     hid_gamepad_axis(LZ,  value);
-            else if (action == GAMEPAD_AXIS_RX)     hid_gamepad_axis(RX,  value);
-            else if (action == GAMEPAD_AXIS_RY)     hid_gamepad_axis(RY,  value);
-            else if (action == GAMEPAD_AXIS_RZ)     hid_gamepad_axis(RZ,  value);
-            else if (action == GAMEPAD_AXIS_LX_NEG) hid_gamepad_axis(LX, -value);
-            else if (action == GAMEPAD_AXIS_LY_NEG) hid_gamepad_axis(LY, -value);
-            else if (action == GAMEPAD_AXIS_LZ_NEG) hid_gamepad_axis(LZ, -value);
-            else if (action == GAMEPAD_AXIS_RX_NEG) hid_gamepad_axis(RX, -value);
-            else if (action == GAMEPAD_AXIS_RY_NEG) hid_gamepad_axis(RY, -value);
-            else if (action == GAMEPAD_AXIS_RZ_NEG) hid_gamepad_axis(RZ, -value);
+            value = fabsf(value);
+            if      (action == GAMEPAD_AXIS_LX)     hid_gamepad_axis(LX, HID_AXIS_SOURCE_GYRO,  value);
+            else if (action == GAMEPAD_AXIS_LY)     hid_gamepad_axis(LY, HID_AXIS_SOURCE_GYRO,  value);
+            else if (action == GAMEPAD_AXIS_LZ)     hid_gamepad_axis(LZ, HID_AXIS_SOURCE_GYRO,  value);
+            else if (action == GAMEPAD_AXIS_RX)     hid_gamepad_axis(RX, HID_AXIS_SOURCE_GYRO,  value);
+            else if (action == GAMEPAD_AXIS_RY)     hid_gamepad_axis(RY, HID_AXIS_SOURCE_GYRO,  value);
+            else if (action == GAMEPAD_AXIS_RZ)     hid_gamepad_axis(RZ, HID_AXIS_SOURCE_GYRO,  value);
+            else if (action == GAMEPAD_AXIS_LX_NEG) hid_gamepad_axis(LX, HID_AXIS_SOURCE_GYRO, -value);
+            else if (action == GAMEPAD_AXIS_LY_NEG) hid_gamepad_axis(LY, HID_AXIS_SOURCE_GYRO, -value);
+            else if (action == GAMEPAD_AXIS_LZ_NEG) hid_gamepad_axis(LZ, HID_AXIS_SOURCE_GYRO, -value);
+            else if (action == GAMEPAD_AXIS_RX_NEG) hid_gamepad_axis(RX, HID_AXIS_SOURCE_GYRO, -value);
+            else if (action == GAMEPAD_AXIS_RY_NEG) hid_gamepad_axis(RY, HID_AXIS_SOURCE_GYRO, -value);
+            else if (action == GAMEPAD_AXIS_RZ_NEG) hid_gamepad_axis(RZ, HID_AXIS_SOURCE_GYRO, -value);
         } else {
-            if (!(*pressed) && value >= 0.5) {
+            if (!(*pressed) && value >= 0.5f) {
                 hid_press(action);
                 if (i==3) *pressed = true;
             }
-            else if (*pressed && value < 0.5) {
+            else if (*pressed && value < 0.5f) {
                 hid_release(action);
                 if (i==3) *pressed = false;
             }
@@ -84,7 +92,7 @@ void gyro_absolute_output(float value, uint8_t *actions, bool *pressed) {
     }
 }
 
-void gyro_incremental_output(double value, uint8_t *actions) {
+void gyro_incremental_output(float value, uint8_t *actions) {
     for(uint8_t i=0; i<4; i++) {
         uint8_t action = actions[i];
         if      (action == MOUSE_X)     hid_mouse_move(value, 0);
@@ -94,9 +102,9 @@ void gyro_incremental_output(double value, uint8_t *actions) {
     }
 }
 
-double hssnf(double t, double k, double x) {
-    double a = x - (x * k);
-    double b = 1 - (x * k * (1/t));
+float hssnf(float t, float k, float x) {
+    float a = x - (x * k);
+    float b = 1 - (x * k * (1/t));
     return a / b;
 }
 
@@ -105,11 +113,11 @@ void Gyro__report_absolute(Gyro *self) {
     gyro_accel_correction();
     // Get data from gyros.
     Vector gyro = imu_read_gyro();
-    static float sens = -BIT_18 * M_PI;
+    static const float sens = -1.0f / (BIT_18 * M_PI);
     // Rotate world space orientation.
-    Vector4 rx = quaternion(world_right, gyro.y / sens);
-    Vector4 ry = quaternion(world_fw, gyro.z / sens);
-    Vector4 rz = quaternion(world_top, gyro.x / sens);
+    Vector4 rx = quaternion(world_right, gyro.y * sens);
+    Vector4 ry = quaternion(world_fw, gyro.z * sens);
+    Vector4 rz = quaternion(world_top, gyro.x * sens);
     static uint8_t i = 0;
     Vector4 r;
     if      (i==0) r = qmultiply(qmultiply(rx, ry), rz);
@@ -126,18 +134,20 @@ void Gyro__report_absolute(Gyro *self) {
     // Debug.
     bool debug = 0;
     if (debug) {
-        hid_gamepad_axis(LX, world_top.x);
-        hid_gamepad_axis(LY, -world_top.y);
-        hid_gamepad_axis(RX, world_fw.x);
-        hid_gamepad_axis(RY, -world_fw.y);
+        hid_gamepad_axis(LX, HID_AXIS_SOURCE_GYRO, world_top.x);
+        hid_gamepad_axis(LY, HID_AXIS_SOURCE_GYRO, -world_top.y);
+        hid_gamepad_axis(RX, HID_AXIS_SOURCE_GYRO, world_fw.x);
+        hid_gamepad_axis(RY, HID_AXIS_SOURCE_GYRO, -world_fw.y);
         return;
     }
     // Output calculation.
-    float x = degrees(asin(-world_right.z)) / 90;
-    float y = degrees(asin(-world_top.z)) / 90;
-    float z = degrees(asin(world_fw.z)) / 90;
-    if (fabs(x) > 0.5 && z < 0) x += -z * 2 * sign(x); // Steering lock.
-    x = constrain(x * 1.1, -1, 1); // Additional saturation.
+    // Degrees divided by 90.
+    static const float unit = 2 / M_PI;
+    float x = asinf(-world_right.z) * unit;
+    float y = asinf(-world_top.z) * unit;
+    float z = asinf(world_fw.z) * unit;
+    if (fabsf(x) > 0.5f && z < 0) x += -z * 2 * sign(x); // Steering lock.
+    x = constrain(x * 1.1f, -1, 1); // Additional saturation.
     x = ramp(x, self->absolute_x_min/90, self->absolute_x_max/90); // Adjust range.
     y = ramp(y, self->absolute_y_min/90, self->absolute_y_max/90); // Adjust range.
     // Output mapping.
@@ -149,17 +159,17 @@ void Gyro__report_absolute(Gyro *self) {
 }
 
 void Gyro__report_incremental(Gyro *self) {
-    static double sub_x = 0;
-    static double sub_y = 0;
-    static double sub_z = 0;
+    static float sub_x = 0;
+    static float sub_y = 0;
+    static float sub_z = 0;
      // Read gyro values.
     Vector imu_gyro = imu_read_gyro();
-    double x = imu_gyro.x * CFG_GYRO_SENSITIVITY_X * sensitivity_multiplier;
-    double y = imu_gyro.y * CFG_GYRO_SENSITIVITY_Y * sensitivity_multiplier;
-    double z = imu_gyro.z * CFG_GYRO_SENSITIVITY_Z * sensitivity_multiplier;
+    float x = imu_gyro.x * sensitivity_x;
+    float y = imu_gyro.y * sensitivity_y;
+    float z = imu_gyro.z * sensitivity_z;
     // Additional processing.
-    double t = 1.0;
-    double k = 0.5;
+    float t = 1.0f;
+    float k = 0.5f;
     if      (x > 0 && x <  t) x =  hssnf(t, k,  x);
     else if (x < 0 && x > -t) x = -hssnf(t, k, -x);
     if      (y > 0 && y <  t) y =  hssnf(t, k,  y);
@@ -171,9 +181,9 @@ void Gyro__report_incremental(Gyro *self) {
     y += sub_y;
     z += sub_z;
     // Round down and save leftovers.
-    sub_x = modf(x, &x);
-    sub_y = modf(y, &y);
-    sub_z = modf(z, &z);
+    sub_x = modff(x, &x);
+    sub_y = modff(y, &y);
+    sub_z = modff(z, &z);
     // Report.
     if (x >= 0) gyro_incremental_output( x, self->actions_x_pos);
     else        gyro_incremental_output(-x, self->actions_x_neg);
@@ -185,25 +195,36 @@ void Gyro__report_incremental(Gyro *self) {
 
 bool Gyro__is_engaged(Gyro *self) {
     if (self->engage == PIN_NONE) return false;
-    if (self->engage == PIN_TOUCH_IN) return touch_status();
+    if (self->engage == PIN_TOUCH_IN) {
+        uint32_t start = profiler_start();
+        bool engaged = touch_status();
+        profiler_stop(PROFILER_TOUCH, start);
+        return engaged;
+    }
     return self->engage_button.is_pressed(&(self->engage_button));
 }
 
+// Both modes are profiled at the same level, the engage check is left out.
 void Gyro__report(Gyro *self) {
+    bool incremental = false;
     if (self->mode == GYRO_MODE_TOUCH_ON) {
-        if (self->is_engaged(self)) self->report_incremental(self);
+        incremental = self->is_engaged(self);
     }
     else if (self->mode == GYRO_MODE_TOUCH_OFF) {
-        if (!self->is_engaged(self)) self->report_incremental(self);
+        incremental = !self->is_engaged(self);
     }
     else if (self->mode == GYRO_MODE_ALWAYS_ON) {
-        self->report_incremental(self);
+        incremental = true;
     }
     else if (self->mode == GYRO_MODE_AXIS_ABSOLUTE) {
+        uint32_t start = profiler_start();
         self->report_absolute(self);
+        profiler_stop(PROFILER_GYRO_ABSOLUTE, start);
     }
-    else if (self->mode == GYRO_MODE_OFF) {
-        return;
+    if (incremental) {
+        uint32_t start = profiler_start();
+        self->report_incremental(self);
+        profiler_stop(PROFILER_GYRO_INCREMENTAL, start);
     }
 }
 
@@ -217,21 +238,21 @@ void Gyro__reset(Gyro *self) {
     self->pressed_z_neg = false;
 }
 
-void Gyro__config_x(Gyro *self, double min, double max, Actions neg, Actions pos) {
+void Gyro__config_x(Gyro *self, float min, float max, Actions neg, Actions pos) {
     self->absolute_x_min = min;
     self->absolute_x_max = max;
     memcpy(self->actions_x_neg, neg, ACTIONS_LEN);
     memcpy(self->actions_x_pos, pos, ACTIONS_LEN);
 }
 
-void Gyro__config_y(Gyro *self, double min, double max, Actions neg, Actions pos) {
+void Gyro__config_y(Gyro *self, float min, float max, Actions neg, Actions pos) {
     self->absolute_y_min = min;
     self->absolute_y_max = max;
     memcpy(self->actions_y_neg, neg, ACTIONS_LEN);
     memcpy(self->actions_y_pos, pos, ACTIONS_LEN);
 }
 
-void Gyro__config_z(Gyro *self, double min, double max, Actions neg, Actions pos) {
+void Gyro__config_z(Gyro *self, float min, float max, Actions neg, Actions pos) {
     self->absolute_z_min = min;
     self->absolute_z_max = max;
     memcpy(self->actions_z_neg, neg, ACTIONS_LEN);
@@ -3,12 +3,16 @@
 
 #pragma once
 #include <stdbool.h>
-#include <pico/stdlib.h>
+#include <stdint.h>
 #include "ctrl.h"
 
 #define ACTIONS_LEN 4
+#define BUTTON_EDGE_PINS 4  // Board pins with edge capture.
+#define BUTTON_EDGE_RING_LEN 8  // Power of 2.
+#define BUTTON_EDGE_DEBOUNCE_US 5000
 
 typedef uint8_t Actions[ACTIONS_LEN];
+typedef void (*ButtonCallback)();
 
 typedef enum _ButtonMode {
     NORMAL = 1,
@@ -19,6 +23,20 @@ typedef enum _ButtonMode {
     STICKY = 32,
 } ButtonMode;
 
+typedef struct ButtonEdge_struct {
+    uint64_t timestamp;  // Microseconds since boot.
+    bool pressed;
+} ButtonEdge;
+
+typedef struct ButtonEdgeRing_struct {
+    uint8_t pin;
+    ButtonEdge edges[BUTTON_EDGE_RING_LEN];
+    volatile uint8_t head;  // Written only by the producer.
+    volatile uint8_t tail;  // Written only by the consumer.
+    ButtonEdge last_pushed;  // Producer side.
+    ButtonEdge last_popped;  // Consumer side.
+} ButtonEdgeRing;
+
 typedef struct Button_struct Button;
 struct Button_struct {
     bool (*is_pressed) (Button *self);
@@ -39,11 +57,16 @@ struct Button_struct {
     bool state_terciary;
     bool emitted_primary;
     bool virtual_press;
+    uint64_t state_timestamp;  // Edge time for board pins, otherwise poll time.
     uint64_t press_timestamp;
     uint64_t press_timestamp_prev;
     bool timestamps_updated;
 };
 
+void button_edge_init(uint8_t pin);
+bool button_edge_read(uint8_t pin, uint64_t *timestamp);
+void button_set_idle(bool value, ButtonCallback wake);
+
 Button Button_ (
     uint8_t pin,
     ButtonMode mode,
@@ -2,7 +2,7 @@
 // Copyright (C) 2022, Input Labs Oy.
 
 #pragma once
-#include <pico/stdlib.h>
+#include "hal.h"
 #include <math.h>
 
 #define BIT_18 262143
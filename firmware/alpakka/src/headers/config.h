@@ -32,11 +32,17 @@
 #endif
 
 #define CFG_IMU_TICK_SAMPLES 8  // Multi-sampling per pooling cycle.
+#define CFG_DUAL_CORE 1  // Sensor acquisition on core1 (see sensors.c).
+#define CFG_SOF_LEAD_DEFAULT 300  // Microseconds before the USB frame.
+#define CFG_SOF_LEAD_OFF 255  // Stored value that disables it (zero is the default).
+#define CFG_IDLE_TIMEOUT 10  // Seconds without inputs before lowering the tick rate.
+#define CFG_IDLE_TICK_FREQUENCY 125  // Hz, only in wireless mode.
 
 #define CFG_TICK_INTERVAL_IN_MS  (1000 / CFG_TICK_FREQUENCY)
 #define CFG_TICK_INTERVAL_IN_US  (1000000 / CFG_TICK_FREQUENCY)
+#define CFG_IDLE_TICK_INTERVAL_IN_US  (1000000 / CFG_IDLE_TICK_FREQUENCY)
 
-#define NVM_SYNC_FREQUENCY  (CFG_TICK_FREQUENCY / 2)
+#define NVM_SYNC_INTERVAL_IN_US  (1000000 / 2)  // 2 Hz.
 
 #define CFG_CALIBRATION_SAMPLES_THUMBSTICK 100000  // Samples.
 #define CFG_CALIBRATION_SAMPLES_GYRO 500000  // Samples.
@@ -61,6 +67,12 @@
 
 #define CFG_DHAT_DEBOUNCE_TIME 100  // Milliseconds.
 
+// Keyboard report per protocol, one bit per key (NKRO) or the 6 keys boot
+// layout (6KRO). Under the USB boot protocol it is always 6KRO.
+#define CFG_KEYBOARD_NKRO_XINPUT_WIN 1
+#define CFG_KEYBOARD_NKRO_XINPUT_UNIX 1
+#define CFG_KEYBOARD_NKRO_GENERIC 1
+
 typedef enum _Protocol {
     PROTOCOL_UNDEFINED = -1,
     PROTOCOL_XINPUT_WIN = 0,
@@ -111,6 +123,7 @@ typedef struct __packed _Config {
     bool swap_gyros;
     bool touch_invert_polarity;
     uint8_t thumbstick_smooth_samples;
+    uint8_t sof_lead;  // Tens of microseconds, zero for the default.
     uint8_t padding[256]; // Guarantee block is at least 256 bytes or more.
 } Config;
 
@@ -136,6 +149,7 @@ void config_set_pcb_gen(uint8_t gen);
 uint8_t config_get_pcb_gen();
 
 uint8_t config_get_protocol();
+bool config_get_keyboard_nkro();
 uint8_t config_get_touch_sens_preset();
 uint8_t config_get_mouse_sens_preset();
 uint8_t config_get_deadzone_preset();
@@ -160,6 +174,8 @@ void config_set_swap_gyros(bool value);
 void config_set_touch_invert_polarity(bool value);
 void config_set_gyro_user_offset(int8_t x, int8_t y, int8_t z);
 void config_set_thumbstick_smooth_samples(uint8_t value);
+void config_set_sof_lead(uint8_t value);
+uint16_t config_get_sof_lead();
 
 // Profiles.
 uint8_t config_get_profile();
@@ -31,6 +31,8 @@ typedef enum Ctrl_msg_type_enum {
     STATUS_SET,
     STATUS_SHARE,
     PROFILE_OVERWRITE,
+    PROFILER_GET,
+    PROFILER_SHARE,
 } Ctrl_msg_type;
 
 typedef enum Ctrl_cfg_type_enum {
@@ -44,6 +46,7 @@ typedef enum Ctrl_cfg_type_enum {
     TOUCH_INVERT_POLARITY,
     GYRO_USER_OFFSET,
     THUMBSTICK_SMOOTH_SAMPLES,
+    SOF_LEAD,
 } Ctrl_cfg_type;
 
 typedef enum CtrlSectionType_enum {
@@ -195,7 +198,8 @@ typedef struct __packed _CtrlGyro {
     // Must be packed (58 bytes).
     uint8_t mode;
     uint8_t engage;
-    uint8_t _padding[56];
+    uint8_t axis_mix;  // HidAxisMix, of the gamepad axes fed by several sources.
+    uint8_t _padding[55];
 } CtrlGyro;
 
 typedef struct __packed _CtrlGyroAxis {
@@ -236,5 +240,6 @@ Ctrl ctrl_log(uint8_t* offset_ptr, uint8_t len);
 Ctrl ctrl_status_share();
 Ctrl ctrl_config_share(uint8_t index);
 Ctrl ctrl_section_share(uint8_t profile_index, uint8_t section_index);
+Ctrl ctrl_profiler_share(uint8_t stage);
 
 void ctrl_config_set(Ctrl_cfg_type key, uint8_t preset, uint8_t values[5]);
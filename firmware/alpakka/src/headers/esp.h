@@ -2,7 +2,8 @@
 // Copyright (C) 2022, Input Labs Oy.
 
 #pragma once
-#include <hardware/uart.h>
+#include <stdbool.h>
+#include "hal.h"
 
 #define ESP_UART uart1
 #define ESP_BOOTLOADER_ADDR 0x0
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+
+// Q15 values are stored in int32, so intermediate results can exceed the unit
+// range, but products must stay within the unit range to not overflow.
+#define Q15_ONE 32768
+#define Q15_FROM_FLOAT(x)  ( (int32_t)((x) * Q15_ONE) )
+#define Q15_TO_FLOAT(x)  ( (float)(x) / Q15_ONE )
+#define q15_mul(a, b)  ( ((a) * (b)) >> 15 )
+
+// Binary angles, a full turn is 65536 so int16 wraps around naturally.
+#define ANGLE_FROM_DEGREES(x)  ( (int32_t)((x) * 65536.0 / 360.0) )
+#define ANGLE_22_5 4096
+#define ANGLE_45 8192
+#define ANGLE_90 16384
+#define ANGLE_180 32768
+
+uint32_t fixed_sqrt(uint32_t x);
+int16_t fixed_atan2(int32_t y, int32_t x);
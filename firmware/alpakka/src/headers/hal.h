@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Thin hardware abstraction used by the logic modules (HID, buttons,
+thumbsticks, gyro, profiles and their dependencies), so none of them call the
+pico SDK or TinyUSB directly: the clock, the pins and their interrupts, the
+ADC, the I2C and SPI buses, the secondary UART setup, the USB HID interface
+and the cycle counter of the profiler.
+
+On target every call maps 1:1 to the SDK, without any overhead. The bus and
+UART instances are the ones selected in bus.h and esp.h, so those headers
+must be included by the modules using them.
+
+The host build (see host/ next to src/) defines HAL_HOST and provides its own
+implementation, with fake pins, ADC and buses, a virtual clock, and the USB
+reports captured instead of sent.
+*/
+
+#pragma once
+
+#ifdef HAL_HOST
+    #include "hal_host.h"
+#else
+
+#include <pico/stdlib.h>
+#include <pico/rand.h>
+#include <pico/unique_id.h>
+#include <hardware/gpio.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <hardware/adc.h>
+#include <hardware/i2c.h>
+#include <hardware/spi.h>
+#include <hardware/uart.h>
+#include <hardware/structs/systick.h>
+#include <tusb.h>
+
+// Clock.
+#define hal_time_us()  time_us_64()
+#define hal_time_us_32()  time_us_32()
+#define hal_sleep_ms(ms)  sleep_ms(ms)
+
+// Interrupts and memory barriers.
+#define hal_dmb()  __dmb()
+#define hal_irq_save()  save_and_disable_interrupts()
+#define hal_irq_restore(status)  restore_interrupts(status)
+
+// Pins.
+#define HAL_GPIO_EDGE_FALL  GPIO_IRQ_EDGE_FALL
+#define HAL_GPIO_EDGE_RISE  GPIO_IRQ_EDGE_RISE
+#define HAL_GPIO_FUNC_I2C  GPIO_FUNC_I2C
+#define HAL_GPIO_FUNC_SPI  GPIO_FUNC_SPI
+#define HAL_GPIO_FUNC_UART  GPIO_FUNC_UART
+#define hal_gpio_get(pin)  gpio_get(pin)
+#define hal_gpio_put(pin, value)  gpio_put(pin, value)
+#define hal_gpio_pull_up(pin)  gpio_pull_up(pin)
+#define hal_gpio_set_function(pin, function)  gpio_set_function(pin, function)
+#define hal_gpio_irq_events(pin)  gpio_get_irq_event_mask(pin)
+#define hal_gpio_irq_acknowledge(pin, events)  gpio_acknowledge_irq(pin, events)
+#define hal_gpio_irq_callback(pin, edges, callback)  \
+    gpio_set_irq_enabled_with_callback(pin, edges, true, callback)
+
+static inline void hal_gpio_init_input(uint8_t pin, bool pull_up) {
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_IN);
+    if (pull_up) gpio_pull_up(pin);
+    else gpio_set_pulls(pin, false, false);
+}
+
+static inline void hal_gpio_init_output(uint8_t pin) {
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_OUT);
+}
+
+// Raw handler for both edges, so it does not replace the shared callback.
+static inline void hal_gpio_irq_handler(uint8_t pin, void (*handler)()) {
+    gpio_add_raw_irq_handler(pin, handler);
+    gpio_set_irq_enabled(pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// ADC.
+#define hal_adc_init()  adc_init()
+#define hal_adc_gpio_init(pin)  adc_gpio_init(pin)
+#define hal_adc_select(channel)  adc_select_input(channel)
+#define hal_adc_read()  adc_read()
+
+// Buses.
+#define hal_i2c_init(freq)  i2c_init(I2C_CHANNEL, freq)
+#define hal_i2c_write(device, data, len, nostop)  \
+    i2c_write_blocking(I2C_CHANNEL, device, data, len, nostop)
+#define hal_i2c_read(device, data, len, nostop)  \
+    i2c_read_blocking(I2C_CHANNEL, device, data, len, nostop)
+#define hal_spi_init(freq)  spi_init(SPI_CHANNEL, freq)
+#define hal_spi_write(data, len)  spi_write_blocking(SPI_CHANNEL, data, len)
+#define hal_spi_read(data, len)  spi_read_blocking(SPI_CHANNEL, 0, data, len)
+
+// Secondary UART (ESP).
+#define hal_uart_init(baud)  uart_init(ESP_UART, baud)
+#define hal_uart_deinit()  uart_deinit(ESP_UART)
+
+// USB HID.
+#define hal_usb_task()  tud_task()
+#define hal_usb_ready()  tud_ready()
+#define hal_usb_suspended()  tud_suspended()
+#define hal_usb_remote_wakeup()  tud_remote_wakeup()
+#define hal_usb_hid_ready(instance)  tud_hid_n_ready(instance)
+#define hal_usb_hid_report(instance, report_id, report, len)  \
+    tud_hid_n_report(instance, report_id, report, len)
+#define hal_usb_hid_is_boot(instance)  \
+    (tud_hid_n_get_protocol(instance) == HID_PROTOCOL_BOOT)
+
+// Board.
+#define hal_board_id(buffer, len)  pico_get_unique_board_id_string(buffer, len)
+#define hal_rand_32()  get_rand_32()
+
+// Cycle counter (SysTick of the core, counts down).
+#define hal_cycles()  (systick_hw->cvr)
+
+static inline void hal_cycles_init(uint32_t mask) {
+    // Free running from the processor clock, without interrupt.
+    systick_hw->rvr = mask;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0b101;
+}
+
+#endif
@@ -3,7 +3,7 @@
 
 #pragma once
 #include <stdbool.h>
-#include <pico/time.h>
+#include "hal.h"
 
 #define MODIFIER_INDEX 154
 #define MOUSE_INDEX 162
@@ -263,18 +263,56 @@
 #define PROC_SLEEP  PROC_INDEX + 42
 #define PROC_PAIR  PROC_INDEX + 43
 
+// Special values only valid within macro sequences (see macro.c), followed by
+// one argument byte.
+#define MACRO_INDEX 250
+#define MACRO_DELAY  MACRO_INDEX + 0
+#define MACRO_HOLD   MACRO_INDEX + 1
+#define MACRO_GAP    MACRO_INDEX + 2
+#define MACRO_DOWN   MACRO_INDEX + 3
+#define MACRO_UP     MACRO_INDEX + 4
+#define MACRO_CHAIN  MACRO_INDEX + 5
+
 typedef enum _ReportType {
     REPORT_KEYBOARD = 1,
     REPORT_MOUSE,
     REPORT_GAMEPAD,
     REPORT_XINPUT,
     REPORT_WEBUSB,
-    REPORT_REPLAY_KEYBOARD = 11,
-    REPORT_REPLAY_MOUSE,
-    REPORT_REPLAY_GAMEPAD,
-    REPORT_REPLAY_XINPUT,
 } ReportType;
 
+typedef enum _HidEventType {
+    HID_EVENT_PRESS,
+    HID_EVENT_RELEASE,
+    HID_EVENT_PRESS_MULTIPLE,
+    HID_EVENT_RELEASE_MULTIPLE,
+    HID_EVENT_THANKS,
+} HidEventType;
+
+// Action deferred to a later tick.
+typedef struct _HidEvent {
+    uint8_t *keys;  // Only for the multiple variants.
+    uint32_t due;  // Milliseconds since boot.
+    uint8_t type;
+    uint8_t key;
+    uint8_t next;  // Next event in the same wheel slot, index plus one.
+} HidEvent;
+
+// Report classes, each one with its own dirty range in the state matrix.
+typedef enum _HidClass {
+    HID_CLASS_KEYBOARD,
+    HID_CLASS_MOUSE,
+    HID_CLASS_GAMEPAD,
+    HID_CLASSES,
+} HidClass;
+
+// Range of actions changed since the class report was last built.
+// Empty when first is bigger than last.
+typedef struct _HidDirty {
+    uint8_t first;
+    uint8_t last;
+} HidDirty;
+
 typedef enum _GamepadAxis {
     LX,
     LY,
@@ -284,9 +322,25 @@ typedef enum _GamepadAxis {
     RZ
 } GamepadAxis;
 
+// Sources that can feed the same gamepad axis, in priority order.
+typedef enum _HidAxisSource {
+    HID_AXIS_SOURCE_THUMBSTICK,
+    HID_AXIS_SOURCE_GYRO,
+    HID_AXIS_SOURCES,
+} HidAxisSource;
+
+// How the sources of the same axis are combined.
+typedef enum _HidAxisMix {
+    HID_AXIS_MIX_SUM,  // Saturating sum of all the sources.
+    HID_AXIS_MIX_MAX,  // The source with the largest magnitude.
+    HID_AXIS_MIX_PRIORITY,  // The first source (in enum order) that is not zero.
+} HidAxisMix;
+
 void hid_init();
 void hid_thanks();
+void hid_thanks_step();
 void hid_set_allow_communication(bool value);
+void hid_resync();
 
 // Keys.
 void hid_matrix_reset(uint8_t keep);
@@ -298,28 +352,38 @@ void hid_press_later(uint8_t key, uint16_t delay);
 void hid_release_later(uint8_t key, uint16_t delay);
 void hid_press_multiple_later(uint8_t *keys, uint16_t delay);
 void hid_release_multiple_later(uint8_t *keys, uint16_t delay);
-void hid_press_later_callback(alarm_id_t alarm, uint8_t key);
-void hid_release_later_callback(alarm_id_t alarm, uint8_t key);
-void hid_press_multiple_later_callback(alarm_id_t alarm, uint8_t *keys);
-void hid_release_multiple_later_callback(alarm_id_t alarm, uint8_t *keys);
-void hid_macro(uint8_t index);
+void hid_apply_events();
+void hid_set_input_timestamp(uint64_t timestamp);
 
 // Mouse axis.
 void hid_mouse_move(int16_t x, int16_t y);
-void hid_mouse_wheel(int8_t z);
+void hid_mouse_scroll(int16_t vertical, int16_t horizontal);
+void hid_set_scroll_multiplier(uint8_t value);
+uint8_t hid_get_scroll_multiplier();
 
 // Gamepad.
 bool hid_is_axis(uint8_t key);
 bool hid_is_mouse_move(uint8_t key);
-void hid_gamepad_axis(GamepadAxis axis, double value);
+void hid_gamepad_axis(GamepadAxis axis, HidAxisSource source, float value);
+void hid_gamepad_axis_set_mix(GamepadAxis axis, HidAxisMix mix);
 
 // Report.
 bool hid_report_wired();
 bool hid_report_wireless();
+void hid_report_complete(HidClass class);
+void hid_log_stats();
 
 #define HID_REPORT_PRIORITY_RATIO 8
-#define HID_REPLAY_THRESHOLD 16  // Number of cycles since last report to trigger replay.
-#define HID_REPLAY_N_TIMES 4  // How many times it will be replayed.
+#define HID_STATE_WORDS 8  // 256 actions in 32-bit words.
+#define HID_SCROLL_RESOLUTION 8  // Scroll units per wheel detent, when enabled by the host.
+#define HID_EVENT_QUEUE_LEN 32  // Power of two.
+#define HID_WHEEL_SLOTS 128  // Milliseconds per turn of the wheel.
+#define HID_WHEEL_EVENTS 64  // Events pending at the same time.
+#define HID_KEYBOARD_KEYS_END 115  // Last keycode that is sent in the keys array.
+#define HID_KEYBOARD_NKRO_KEYS MODIFIER_INDEX  // Keycodes in the NKRO bitmap.
+#define HID_KEYBOARD_NKRO_BYTES 20
+#define HID_AXIS_MIX_DEFAULT HID_AXIS_MIX_SUM
+#define HID_PENDING_REPORT_SIZE 24  // Largest wired report (NKRO keyboard).
 
 #define REPORT_QUEUE_ITEM_SIZE 20
 #define REPORT_QUEUE_LEN 16
@@ -330,12 +394,19 @@ typedef struct __packed _KeyboardReport {
     uint8_t keycode[6];
 } KeyboardReport;
 
+typedef struct __packed _KeyboardNKROReport {
+    uint8_t modifier;
+    uint8_t keys[HID_KEYBOARD_NKRO_BYTES];  // One bit per keycode.
+} KeyboardNKROReport;
+
+// Scroll and pan are in high resolution units (see HID_SCROLL_RESOLUTION),
+// until converted for the host (see hid.c).
 typedef struct __packed _MouseReport {
     uint8_t buttons;
     int16_t x;
     int16_t y;
-    int8_t scroll;
-    int8_t pan;
+    int16_t scroll;
+    int16_t pan;
 } MouseReport;
 
 typedef struct __packed _GamepadReport {
@@ -348,4 +419,13 @@ typedef struct __packed _GamepadReport {
     uint32_t buttons;
 } GamepadReport;
 
-void hid_report_dongle(uint8_t report_id, uint8_t* payload);
+// Newest report of a class that was not yet accepted by its endpoint.
+typedef struct _HidPending {
+    bool active;
+    uint8_t len;
+    uint8_t report[HID_PENDING_REPORT_SIZE];
+    uint32_t deferred;  // Sends postponed because the endpoint was busy.
+    uint32_t dropped;  // Unsent reports replaced by a newer state.
+} HidPending;
+
+bool hid_report_dongle(uint8_t report_id, uint8_t* payload);
@@ -29,6 +29,8 @@
 
 void imu_init();
 void imu_power_off();
+Vector imu_sample_gyro();
+Vector imu_sample_accel();
 Vector imu_read_gyro();
 Vector imu_read_accel();
 void imu_load_calibration();
@@ -9,6 +9,12 @@
 #define LABEL_DONGLE     "Wireless dongle   "
 #define USB_WAIT_FOR_INIT_MS 1000  // 1 second.
 #define USB_DONGLE_CHECK_US 2000000  // 2 seconds.
+#define LOOP_USB_CHECK_INTERVAL_IN_US 1000000  // 1 second.
+#define LOOP_USB_PUMP_INTERVAL_IN_US 250  // USB stack and WebUSB service.
+#define LOOP_BOARD_LED_INTERVAL_IN_US 100000  // 100 milliseconds.
+#define LOOP_STATS_INTERVAL_IN_US 1000000  // 1 second.
+#define LOOP_SOF_LOCK_GAIN 4  // Fraction of the phase error corrected per tick.
+#define LOOP_SOF_LOCK_MAX_STEP 20  // Microseconds.
 
 #if defined DEVICE_ALPAKKA_V1
     #define REPORT_TIMEOUT_US 500000  // 0.5 seconds.
@@ -27,9 +33,12 @@ uint64_t get_system_clock();
 void set_system_clock(uint64_t time);
 
 DeviceMode loop_get_device_mode();
+int16_t loop_get_sof_lead();
 void loop_set_battery_low(bool state);
 
 void loop_controller_init();
 void loop_dongle_init();
 void loop_llama_init();
+void loop_controller_task();
+void loop_dongle_task();
 void loop_run();
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MACRO_SLOTS 4  // Macros that can run at the same time.
+#define MACRO_LEN 28  // Bytes per sequence in the profile.
+#define MACRO_CHAIN_MAX 8  // Sequences that can be chained after the first one.
+#define MACRO_HOLD_DEFAULT 10  // Milliseconds.
+#define MACRO_GAP_DEFAULT 10  // Milliseconds.
+#define MACRO_DOWN_MAX 4  // Actions held down (MACRO_DOWN) at the same time.
+
+// Cursor of a running macro.
+typedef struct Macro_struct {
+    uint32_t at;  // Timestamp of the next step (microseconds).
+    uint8_t index;  // Macro number (1 to 8), zero if the slot is free.
+    uint8_t step;  // Position in the sequence.
+    uint8_t hold;  // Milliseconds each tap is held.
+    uint8_t gap;  // Milliseconds after each tap is released.
+    uint8_t key;  // Key of the current tap, pending to be released.
+    uint8_t chains;  // Sequences chained so far.
+    uint8_t down[MACRO_DOWN_MAX];  // Actions held down, released on stop.
+    uint8_t down_len;
+} Macro;
+
+void macro_start(uint8_t index);
+void macro_report();
+void macro_reset();
@@ -7,6 +7,7 @@
 #include "dhat.h"
 #include "rotary.h"
 #include "gyro.h"
+#include "hid.h"
 #include "webusb.h"
 #include "common.h"
 #include "config.h"
@@ -64,6 +65,7 @@ struct Profile_struct {
     Dhat dhat;
     Rotary rotary;
     Gyro gyro;
+    HidAxisMix axis_mix;
 };
 Profile Profile_ ();
 
@@ -75,6 +77,7 @@ void profile_set_home_gamepad(bool state);
 void profile_set_active(uint8_t index);
 void profile_set_lock_leds(bool lock);
 void profile_set_reported_inputs(bool value);
+bool profile_get_reported_inputs();
 void profile_notify_protocol_changed(Protocol protocol);
 void profile_update_leds();
 void profile_enable_all(bool value);
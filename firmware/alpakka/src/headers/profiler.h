@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// SysTick is a 24-bit down counter, so stages longer than 2^24 cycles
+// (~76ms at 220MHz) wrap around.
+#define PROFILER_COUNTER_MASK 0x00FFFFFF
+#define PROFILER_BUCKETS 24  // Log2 of the cycles, one bucket per bit.
+
+typedef enum ProfilerStage_enum {
+    PROFILER_TICK = 1,  // The whole main task.
+    PROFILER_CONFIG_SYNC,
+    PROFILER_PROFILE,  // The whole profile_report_active().
+    PROFILER_BUTTONS,  // Including IO expanders and rotary.
+    PROFILER_THUMBSTICKS,  // Including dhat.
+    PROFILER_GYRO,  // Including touch when used as engage.
+    PROFILER_TOUCH,
+    PROFILER_HID_REPORT,
+    PROFILER_UART,
+    PROFILER_GYRO_ABSOLUTE,  // IMU read, orientation math and output.
+    PROFILER_GYRO_INCREMENTAL,  // IMU read, mouse math and output.
+    PROFILER_LATENCY_KEYBOARD,  // Input age when its report is sent (microseconds).
+    PROFILER_LATENCY_MOUSE,
+    PROFILER_LATENCY_GAMEPAD,
+    PROFILER_STAGES,  // Number of stages (plus the unused zero).
+} ProfilerStage;
+
+typedef struct ProfilerHistogram_struct {
+    uint32_t count;
+    uint32_t max;  // Cycles (or microseconds for the latency stages).
+    uint16_t buckets[PROFILER_BUCKETS];
+} ProfilerHistogram;
+
+void profiler_init();
+uint32_t profiler_start();
+void profiler_stop(ProfilerStage stage, uint32_t start);
+void profiler_record(ProfilerStage stage, uint32_t value);
+ProfilerHistogram *profiler_get(ProfilerStage stage);
+void profiler_reset(ProfilerStage stage);
+void profiler_log_latency();
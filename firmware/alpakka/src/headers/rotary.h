@@ -3,20 +3,28 @@
 
 #pragma once
 
+#define ROTARY_TAP_INTERVAL 20  // Milliseconds between the taps of consecutive detents.
+#define ROTARY_TAP_DURATION 10  // Milliseconds.
+#define ROTARY_TAPS_MAX 4  // Taps per report, the rest of the detents wait for these.
+
 typedef enum RotaryDir_enum {
     ROTARY_UP,
     ROTARY_DOWN,
 } RotaryDir;
 
+typedef void (*RotaryCallback)();
+
 typedef struct Rotary_struct Rotary;
 struct Rotary_struct {
     void (*report) (Rotary *self);
     void (*reset) (Rotary *self);
     void (*config_mode) (Rotary *self, uint8_t mode, Actions actions_up, Actions actions_down);
-    bool pending;
-    int8_t increment;
+    volatile bool pending;
+    volatile int16_t increment;  // Detents since the last report.
     int8_t mode;
     uint32_t timestamp;
+    uint32_t taps_start;  // Microseconds.
+    uint32_t taps_duration;  // Microseconds, the rest of the detents wait for the taps.
     // Memory allocation for 5 modes, 2 directions per mode, 4 actions per
     // direction.
     uint8_t actions[5][2][4];
@@ -26,3 +34,4 @@ Rotary Rotary_ ();
 
 void rotary_init();
 void rotary_set_mode(uint8_t value);
+void rotary_set_idle(bool value, RotaryCallback wake);
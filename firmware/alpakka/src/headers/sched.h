@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS 8
+
+typedef void (*SchedCallback)();
+
+typedef struct SchedTask_struct {
+    const char *name;
+    SchedCallback callback;
+    uint32_t period;  // Microseconds.
+    uint64_t deadline;  // Microseconds since boot.
+    uint32_t runs;
+    uint32_t missed;
+    uint32_t used_max;  // Microseconds.
+    uint64_t used_total;  // Microseconds.
+    volatile bool wake;  // Run as soon as possible.
+} SchedTask;
+
+void sched_init();
+uint8_t sched_add(const char *name, SchedCallback callback, uint32_t period);
+void sched_run();
+SchedTask *sched_get_task(uint8_t index);
+void sched_shift(uint8_t index, int32_t delta);
+void sched_set_period(uint8_t index, uint32_t period);
+void sched_wake(uint8_t index);
+uint32_t sched_get_missed(uint8_t index);
+void sched_log_stats();
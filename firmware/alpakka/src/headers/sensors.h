@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "vector.h"
+
+#define SENSORS_ADC_CHANNELS 4
+#define SENSORS_STATS_FREQUENCY 1000  // Milliseconds.
+#define SENSORS_IDLE_INTERVAL_US 500  // Pause between cycles while idle.
+#define SENSORS_IDLE_SLOW_INTERVAL_US 8000  // IMU and touch sampling while idle.
+#define SENSORS_IDLE_ADC_THRESHOLD 64  // Raw ADC change considered activity.
+
+typedef void (*SensorsCallback)();
+
+typedef struct SensorsSnapshot_struct {
+    uint64_t timestamp;  // Microseconds, when the acquisition started.
+    uint32_t sequence;
+    uint16_t adc[SENSORS_ADC_CHANNELS];  // Raw 12-bit values, indexed by channel.
+    uint16_t io_0;
+    uint16_t io_1;
+    Vector gyro;
+    Vector accel;
+    float touch_elapsed;  // Microseconds.
+} SensorsSnapshot;
+
+void sensors_init();
+void sensors_sync();
+SensorsSnapshot *sensors_get();
+uint64_t sensors_get_timestamp();
+bool sensors_is_running();
+bool sensors_is_active();
+void sensors_pause();
+void sensors_resume();
+void sensors_log_stats();
+void sensors_set_idle(bool value, SensorsCallback wake);
@@ -8,6 +8,7 @@
 #define THUMBSTICK_BASELINE_SATURATION 1.65
 #define THUMBSTICK_INNER_RADIUS 0.75
 #define THUMBSTICK_ADDITIONAL_DEADZONE_FOR_BUTTONS 0.05
+#define THUMBSTICK_SCROLL_SPEED 30  // Wheel detents per second, at full deflection.
 
 enum RESPONSE_CURVE
 {
@@ -22,6 +23,7 @@ typedef enum ThumbstickMode_enum {
     THUMBSTICK_MODE_4DIR,
     THUMBSTICK_MODE_ALPHANUMERIC,
     THUMBSTICK_MODE_8DIR,
+    THUMBSTICK_MODE_SCROLL,  // Smooth vertical scroll and horizontal pan.
 } ThumbstickMode;
 
 typedef enum ThumbstickDistance_enum {
@@ -32,7 +34,7 @@ typedef enum ThumbstickDistance_enum {
 typedef struct ThumbstickPosition_struct {
     float x;
     float y;
-    float angle;
+    int16_t angle;  // Binary angle, zero is up and positive is clockwise.
     float radius;
 } ThumbstickPosition;
 
@@ -66,15 +68,18 @@ typedef enum Dir8_enum {
 typedef struct Thumbstick_struct Thumbstick;
 struct Thumbstick_struct {
     void (*report) (Thumbstick *self);
+    ThumbstickPosition (*position) (Thumbstick *self);
     void (*report_4dir_axial) (Thumbstick *self, ThumbstickPosition pos);
     void (*report_4dir_radial) (Thumbstick *self, ThumbstickPosition pos);
     void (*report_8dir) (Thumbstick *self, ThumbstickPosition pos);
     void (*report_alphanumeric) (Thumbstick *self, ThumbstickPosition pos);
+    void (*report_scroll) (Thumbstick *self, ThumbstickPosition pos);
     void (*report_glyphstick) (Thumbstick *self, Glyph input);
     void (*report_daisywheel) (Thumbstick *self, Dir8 dir);
     void (*reset) (Thumbstick *self);
     void (*config_4dir) (Thumbstick *self, Button left, Button right, Button up, Button down, Button push, Button inner, Button outer);
     void (*config_8dir) (Thumbstick *self, Button left, Button right, Button up, Button down, Button ul, Button ur, Button dl, Button dr, Button push);
+    void (*config_scroll) (Thumbstick *self, Button push);
     void (*config_glyphstick) (Thumbstick *self, Actions actions, Glyph glyph);
     void (*config_daisywheel) (Thumbstick *self, uint8_t dir, uint8_t button, Actions actions);
     uint8_t index;
@@ -89,6 +94,11 @@ struct Thumbstick_struct {
     float antideadzone;
     float overlap;
     float saturation;
+    int32_t deadzone_q15;
+    int32_t antideadzone_q15;
+    int32_t saturation_q15;
+    int32_t overlap_cut;  // Binary angle.
+    float scroll_remainder[2];  // Sub-unit scroll and pan not yet reported.
     Button left;
     Button right;
     Button up;
@@ -122,6 +132,7 @@ Thumbstick Thumbstick_ (
 );
 
 void thumbstick_init();
+uint16_t thumbstick_adc_raw(uint8_t pin);
 void thumbstick_report();
 void thumbstick_calibrate();
 void thumbstick_update_deadzone();
@@ -34,3 +34,4 @@
 void touch_init();
 void touch_load_from_config();
 bool touch_status();
+float touch_get_elapsed_multisample();
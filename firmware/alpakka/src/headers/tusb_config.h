@@ -16,17 +16,32 @@
 #define CFG_TUD_VENDOR_RX_BUFSIZE 64
 #define CFG_TUD_VENDOR_TX_BUFSIZE 64
 
-#define CFG_TUD_HID 1
+#define CFG_TUD_HID 3  // Keyboard, mouse and gamepad on their own endpoints.
 #define CFG_TUD_CDC 0
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
 #define CFG_TUD_VENDOR 1
 
-#define ITF_HID 0
+// WebUSB keeps interface 1, where it was before the HID split. Generic protocol
+// uses the last interface for the HID gamepad, while XInput protocols use it
+// for the XInput gamepad.
+#define ITF_HID_KEYBOARD 0
 #define ITF_WEBUSB 1
-#define ITF_XINPUT 2
+#define ITF_HID_MOUSE 2
+#define ITF_XINPUT 3
+#define ITF_HID_GAMEPAD 3
 
-#define ADDR_HID_IN 0x86
+// TinyUSB HID instances, in order of appearance in the configuration.
+#define HID_INSTANCE_KEYBOARD 0
+#define HID_INSTANCE_MOUSE 1
+#define HID_INSTANCE_GAMEPAD 2
+
+#define STRING_INDEX_HID 4
+#define STRING_INDEX_WEBUSB 5
+
+#define ADDR_HID_KEYBOARD_IN 0x86
+#define ADDR_HID_MOUSE_IN 0x87
+#define ADDR_HID_GAMEPAD_IN 0x88
 #define ADDR_WEBUSB_IN 0x83
 #define ADDR_WEBUSB_OUT 0x04
 #define ADDR_XINPUT_IN 0x81
@@ -61,6 +76,9 @@
 #define USB_TEST_VENDOR  0x0170  // Input Labs.
 #define USB_TEST_PRODUCT 0xFF00  // Test.
 
+#define USB_FRAME_US 1000  // Full speed frame interval.
+#define USB_SOF_TIMEOUT_US 3000  // No start-of-frame for this long means no host.
+
 #ifdef DEVICE_IS_ALPAKKA
     #define WEBUSB_ID  'A', 0, '0', 0, '0', 0, '8', 0, '0', 0
 #elif defined DEVICE_DONGLE
@@ -79,7 +97,7 @@
     0x40,    /* .bMaxPacketSize0 */\
     0x0000,  /* .idVendor */\
     0x0000,  /* .idProduct */\
-    0x0114,  /* .bcdDevice */\
+    0x0116,  /* .bcdDevice */\
     0x01,    /* .iManufacturer */\
     0x02,    /* .iProduct */\
     0x03,    /* .iSerialNumber */\
@@ -95,21 +113,25 @@
     0x80,        /* bmAttributes */\
     0xFA         /* bMaxPower */
 
-#define DESCRIPTOR_INTERFACE_HID(report_size) \
+#define DESCRIPTOR_INTERFACE_HID(itf, boot, addr, report_size) \
     TUD_HID_DESCRIPTOR( \
-        ITF_HID,                /* Interface index */\
-        ITF_HID + 4,            /* String index */\
-        HID_ITF_PROTOCOL_NONE,  /* Boot protocol */\
+        itf,                    /* Interface index */\
+        STRING_INDEX_HID,       /* String index */\
+        boot,                   /* Boot protocol */\
         report_size,            /* Report descriptor length */\
-        ADDR_HID_IN,            /* Interface address */\
+        addr,                   /* Interface address */\
         32,                     /* Endpoint buffer size */\
         1                       /* Interface interval (ms) */\
     )
 
+// Offset of the report descriptor length of the keyboard HID descriptor, in
+// the configuration descriptor (configuration, interface, HID descriptor).
+#define DESCRIPTOR_KEYBOARD_REPORT_LEN_INDEX (9 + 9 + 7)
+
 #define DESCRIPTOR_INTERFACE_WEBUSB \
     TUD_VENDOR_DESCRIPTOR( \
         ITF_WEBUSB,       /* Interface index */\
-        ITF_WEBUSB + 4,   /* String index */\
+        STRING_INDEX_WEBUSB,  /* String index */\
         ADDR_WEBUSB_OUT,  /* Address out */\
         ADDR_WEBUSB_IN,   /* Address in */\
         64                /* Size */\
@@ -250,24 +272,93 @@
         HID_REPORT_COUNT( 2                                      ) /* CHANGED */ ,\
         HID_REPORT_SIZE ( 16                                     ) /* CHANGED */ ,\
         HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
-        /* Vertical wheel scroll [-127, 127] */ \
-        HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL                ) ,\
-        HID_LOGICAL_MIN ( 0x81                                   ) ,\
-        HID_LOGICAL_MAX ( 0x7f                                   ) ,\
-        HID_REPORT_COUNT( 1                                      ) ,\
-        HID_REPORT_SIZE ( 8                                      ) ,\
-        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
-      HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER ), \
-        /* Horizontal wheel scroll [-127, 127] */ \
-        HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2           ), \
-        HID_LOGICAL_MIN ( 0x81                                   ), \
-        HID_LOGICAL_MAX ( 0x7f                                   ), \
-        HID_REPORT_COUNT( 1                                      ), \
-        HID_REPORT_SIZE ( 8                                      ), \
-        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ), \
+        /* Vertical wheel scroll [-32767, 32767], with resolution multiplier */ \
+        HID_COLLECTION  ( HID_COLLECTION_LOGICAL                 ) /* CHANGED */ ,\
+          HID_USAGE       ( HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER ) ,\
+          HID_LOGICAL_MIN ( 0                                      ) ,\
+          HID_LOGICAL_MAX ( 1                                      ) ,\
+          HID_PHYSICAL_MIN( 1                                      ) ,\
+          HID_PHYSICAL_MAX( HID_SCROLL_RESOLUTION                  ) ,\
+          HID_REPORT_COUNT( 1                                      ) ,\
+          HID_REPORT_SIZE ( 2                                      ) ,\
+          HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+          HID_PHYSICAL_MIN( 0                                      ) ,\
+          HID_PHYSICAL_MAX( 0                                      ) ,\
+          HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL                ) ,\
+          HID_LOGICAL_MIN_N ( 0x8001, 2                            ) /* CHANGED */ ,\
+          HID_LOGICAL_MAX_N ( 0x7FFF, 2                            ) /* CHANGED */ ,\
+          HID_REPORT_COUNT( 1                                      ) ,\
+          HID_REPORT_SIZE ( 16                                     ) /* CHANGED */ ,\
+          HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+        HID_COLLECTION_END                                          ,\
+        /* Horizontal wheel scroll [-32767, 32767], with resolution multiplier */ \
+        HID_COLLECTION  ( HID_COLLECTION_LOGICAL                 ) /* CHANGED */ ,\
+          HID_USAGE       ( HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER ) ,\
+          HID_LOGICAL_MIN ( 0                                      ) ,\
+          HID_LOGICAL_MAX ( 1                                      ) ,\
+          HID_PHYSICAL_MIN( 1                                      ) ,\
+          HID_PHYSICAL_MAX( HID_SCROLL_RESOLUTION                  ) ,\
+          HID_REPORT_COUNT( 1                                      ) ,\
+          HID_REPORT_SIZE ( 2                                      ) ,\
+          HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+          HID_PHYSICAL_MIN( 0                                      ) ,\
+          HID_PHYSICAL_MAX( 0                                      ) ,\
+          /* 4 bit padding of the feature report */ \
+          HID_REPORT_COUNT( 1                                      ) ,\
+          HID_REPORT_SIZE ( 4                                      ) ,\
+          HID_FEATURE     ( HID_CONSTANT                           ) ,\
+          HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER                ) ,\
+          HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2           ) ,\
+          HID_LOGICAL_MIN_N ( 0x8001, 2                            ) /* CHANGED */ ,\
+          HID_LOGICAL_MAX_N ( 0x7FFF, 2                            ) /* CHANGED */ ,\
+          HID_REPORT_COUNT( 1                                      ) ,\
+          HID_REPORT_SIZE ( 16                                     ) /* CHANGED */ ,\
+          HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+        HID_COLLECTION_END                                          ,\
     HID_COLLECTION_END                                            , \
   HID_COLLECTION_END \
 
+// Keyboard HID definition with one bit per keycode (N-key rollover), instead
+// of the 6 keycodes array of the boot layout.
+// https://github.com/hathach/tinyusb/blob/ae364b1460b91153cd94b4b0303eeda6419ff1d1/src/class/hid/hid_device.h#L182
+#define TUD_HID_REPORT_DESC_KEYBOARD_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP     )                    ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD )                    ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION )                    ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    /* 8 bits Modifier Keys (Shift, Control, Alt) */ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD )                     ,\
+      HID_USAGE_MIN    ( 224                                    )  ,\
+      HID_USAGE_MAX    ( 231                                    )  ,\
+      HID_LOGICAL_MIN  ( 0                                      )  ,\
+      HID_LOGICAL_MAX  ( 1                                      )  ,\
+      HID_REPORT_COUNT ( 8                                      )  ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )  ,\
+    /* Keycodes bitmap */ \
+      HID_USAGE_MIN    ( 0                                      )  ,\
+      HID_USAGE_MAX    ( HID_KEYBOARD_NKRO_KEYS - 1             )  ,\
+      HID_REPORT_COUNT ( HID_KEYBOARD_NKRO_KEYS                 )  ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )  ,\
+    /* Padding to the end of the last byte */ \
+      HID_REPORT_COUNT ( (HID_KEYBOARD_NKRO_BYTES * 8) - HID_KEYBOARD_NKRO_KEYS ) ,\
+      HID_REPORT_SIZE  ( 1                                      )  ,\
+      HID_INPUT        ( HID_CONSTANT                           )  ,\
+    /* 5-bit LED Indicator Kana | Compose | ScrollLock | CapsLock | NumLock */ \
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_LED                   )       ,\
+      HID_USAGE_MIN    ( 1                                       ) ,\
+      HID_USAGE_MAX    ( 5                                       ) ,\
+      HID_REPORT_COUNT ( 5                                       ) ,\
+      HID_REPORT_SIZE  ( 1                                       ) ,\
+      HID_OUTPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE  ) ,\
+      /* led padding */ \
+      HID_REPORT_COUNT ( 1                                       ) ,\
+      HID_REPORT_SIZE  ( 3                                       ) ,\
+      HID_OUTPUT       ( HID_CONSTANT                            ) ,\
+  HID_COLLECTION_END \
+
 // Gamepad HID definition that differs from the default implementation included
 // in TinyUSB. (16bit axis, different button layout).
 // https://github.com/hathach/tinyusb/blob/7bf5923052e5861f54c9cb0581e328f8be26a0a9/src/class/hid/hid_device.h#L315
@@ -301,5 +392,11 @@
     HID_INPUT         ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
   HID_COLLECTION_END
 
+#define USB_REENUMERATE_DETACH_MS 100  // Long enough for the host to see the detach.
+
 bool usb_wait_for_init(int16_t timeout);
+bool usb_reenumerate(int16_t timeout);
 bool usb_is_connected();
+void usb_sof_cb(uint8_t rhport, uint32_t frame_count);
+uint32_t usb_get_sof_timestamp();
+bool usb_sof_is_active();
@@ -2,8 +2,15 @@
 // Copyright (C) 2022, Input Labs Oy.
 
 #pragma once
+#include <stdint.h>
+#include <stdbool.h>
 
-#define UART_RX_BUFFER_SIZE 1024
+#define UART_RX_BUFFER_SIZE 1024  // Power of two, DMA ring.
+#define UART_RX_BUFFER_BITS 10  // Log2 of the buffer size.
+#define UART_RX_FRAME_MAX AT_FRAME_MAX_LEN  // Longest contiguous read.
+#define UART_RX_DMA_COUNT 0xFFFFFFFF  // Transfers until the DMA is restarted.
+#define UART_RX_IDLE_POLL_US 100  // DMA write address checks, about 9 bytes at ESP_DATA_BAUD.
+#define UART_LISTEN_INTERVAL_IN_US 1000000  // 1 second.
 
 // Sequence of control bytes (chosen because these are non-printable, rarely used ASCII codes).
 #define UART_CONTROL_0 30
@@ -11,33 +18,69 @@
 #define UART_CONTROL_2 28
 #define UART_CONTROL_BYTES  UART_CONTROL_0, UART_CONTROL_1, UART_CONTROL_2
 
-#define AT_HEADER_LEN 4
-#define AT_HID_LEN 32
+// Frame: control bytes, command, payload length, payload, and CRC-16 of the
+// command, length and payload (little endian).
+// The ESP relay firmware (esp_llama, not part of this tree) is on the other
+// side of the UART. The controller and dongle images do not embed it, it is
+// flashed by the llama image (esp_flash, see esp.c), which embeds the relay
+// image from esp_llama/build/llama.bin.c. That file must define
+// ESP_LLAMA_AT_PROTOCOL as the AT_PROTOCOL_VERSION it was built for, or the
+// llama build fails, so a relay built for other frames is never flashed. Any
+// change to the frame layout, the commands or their lengths must increment
+// AT_PROTOCOL_VERSION, and the relay be rebuilt for it. The host tests
+// (host/test_wireless_*) cover this side only.
+#define AT_PROTOCOL_VERSION 2  // 1 was the fixed length frames, without CRC.
+#define AT_HEADER_LEN 5
+#define AT_CRC_LEN 2
+#define AT_HID_LEN 32  // Maximum.
+#define AT_HID_DELTA 0x80  // Report ID flag, the payload is a delta.
 #define AT_WEBUSB_LEN 64
 #define AT_BATTERY_LEN 4
 #define AT_USB_PROTOCOL_LEN 1
-#define AT_PAYLOAD_MAX_LEN  (AT_HEADER_LEN + AT_WEBUSB_LEN)
+#define AT_HID_ACK_LEN 4
+#define AT_FRAME_MAX_LEN  (AT_HEADER_LEN + AT_WEBUSB_LEN + AT_CRC_LEN)
+
+#define UART_TX_SLOTS 16  // Frames waiting to be sent, power of two.
+#define UART_TX_FRAME_MAX AT_FRAME_MAX_LEN
+
+// Frames with the same (not none) tag carry the same kind of state, so when
+// the transmit ring is full, a newer one supersedes the older ones: these are
+// removed and the newer one is queued at the end, keeping the order. Untagged
+// frames are never dropped, they replace the oldest tagged one (see uart.c).
+#define UART_TX_TAG_NONE 0
+#define UART_TX_TAG_HID(class) (1 + (class))
+#define UART_TX_TAG_HID_ACK 8
+
+typedef void (*UartCallback)();
+
+typedef struct _UartTxSlot {
+    uint8_t len;
+    uint8_t tag;
+    uint8_t data[UART_TX_FRAME_MAX];
+} UartTxSlot;
 
 typedef enum _UART_AT {
     AT_HID = 1,  // Keyboard, mouse or gamepad report (also Xinput).
     AT_WEBUSB,  // WebUSB relay.
     AT_BATTERY,  // Battery level.
     AT_USB_PROTOCOL,  // USB protocol (Windows/Linux/Genetic) automatic dongle sync.
+    AT_HID_ACK,  // Newest HID report sequence received by the dongle, per class.
 } UART_AT;
 
 void uart_listen_serial();
 void uart_listen_serial_limited();
 
-void uart_rx_buffer_init();
-bool uart_rx_buffer_is_empty();
-bool uart_rx_buffer_is_full();
-uint16_t uart_rx_buffer_available();
-void uart_rx_buffer_consume(uint16_t len);
-bool uart_rx_buffer_putc(uint8_t byte);
-uint8_t uart_rx_buffer_getc();
-uint8_t uart_rx_buffer_peekc();
-void uart_rx_buffer_get(uint8_t *dest, uint16_t len);
-bool uart_rx_buffer_match(uint8_t *pattern, uint8_t len);
-void uart_rx_irq_callback();
+void uart_rx_init();
+void uart_rx_reset();
+uint16_t uart_rx_available();
+uint8_t *uart_rx_peek(uint16_t len);
+void uart_rx_consume(uint16_t len);
+void uart_rx_set_idle_callback(UartCallback callback);
+uint32_t uart_rx_get_bursts();
+
+void uart_tx_init();
+void uart_tx_reset();
+bool uart_tx_send(uint8_t *data, uint8_t len, uint8_t tag);
+void uart_tx_log_stats();
 
 
@@ -3,10 +3,12 @@
 
 #pragma once
 
+// Single precision, so the math maps to the ROM float routines instead of
+// the (much slower) soft-float double ones.
 typedef struct vector_struct {
-    double x;
-    double y;
-    double z;
+    float x;
+    float y;
+    float z;
 } Vector;
 
 typedef struct vector4_struct {
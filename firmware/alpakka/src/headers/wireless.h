@@ -4,6 +4,7 @@
 #pragma once
 #include "ctrl.h"
 #include "config.h"
+#include "hid.h"
 
 #define BATTERY_MIN 2700
 #define BATTERY_MAX 3350
@@ -12,11 +13,20 @@
 
 #define FAKE_PAIR_TIME_MS 2000
 
+#define WIRELESS_ACK_TIMEOUT_US 4000  // Before an unacknowledged report is sent again.
+#define WIRELESS_ACK_TIMEOUT_MAX_US 32000  // Backoff limit, retransmissions never stop.
+#define WIRELESS_REPORT_MAX 20  // Largest report sent over the radio (XInput).
+#define WIRELESS_HISTORY 8  // Frames kept per class, to build deltas against.
+
 void wireless_init();
 void wireless_controller_task();
 void wireless_dongle_task();
+void wireless_uart_commands();
 void wireless_set_uart_data_mode(bool mode);
 
 void wireless_send_hid(uint8_t report_id, void *packet, uint8_t len);
 void wireless_send_webusb(Ctrl ctrl);
 void wireless_send_usb_protocol(Protocol protocol);
+bool wireless_retransmit();
+void wireless_dongle_forward(HidClass class);
+void wireless_log_stats();
@@ -15,7 +15,21 @@ Physical controller --> Profile --> [HID layer] --> HID keyboard
 At the end of each cycle (determined by the polling rate) the HID layer checks
 if the potential new report is different from the last report sent to the
 interfaces (USB keyboard, USB mouse, gamepad...), and sends the report if
-required.
+required. When wired, keyboard, mouse and gamepad are separate USB interfaces
+with their own endpoints, so all of them can be sent in the same cycle. When
+wireless, a single report is sent per cycle according to their priority.
+
+If the endpoint of a class is still busy, the built report is kept in the
+pending slot of the class and the class stays unsynced, so in the next cycle
+the report is built again with the newest state (mouse motion keeps
+accumulating meanwhile) and retried. A pending report that changes before
+being sent is counted as dropped, since the host never saw that state.
+
+The USB stack is also serviced between ticks (see the pump task in loop.c),
+and once the endpoint of a class completes its transfer, the pending report
+of that class is sent right away from the completion callback, instead of
+waiting for the next tick. The callbacks are only allowed to send between
+ticks, so they never see a partially updated state.
 
 The state matrix is a representation of all the actions that could be sent
 (output) and internal operations (procedures) requested by the user. It keep
@@ -28,25 +42,36 @@ to zeros when the user changes the active profile, otherwise the disabled
 profile won't ever trigger the corresponding counter decrease of held buttons
 during the profile change.
 
-The replay feature was introduced as a simple mechanism to prevent stuck inputs
-if the last wireless report is lost (since the protocol does not have
-packet-received confirmation nor any resend logic yet).
-It works by re-sending (replaying) the last report of an specific report type
-several times, and therefore reducing the chances that all these packets are
-lost. To determine what is considered "last" it keeps counters of how many
-polling cycles passed since the last report (per report type), then after
-HID_REPLAY_THRESHOLD is excedeed the last report is replayed a fixed amount of
-times determined by HID_REPLAY_N_TIMES. When HID_REPLAY_N_TIMES is excedeed
-nothing will happen anymore until new inputs are sent, which will reset the
-replay counters.
-Flow diagram: docs/replay.md
+Alongside the counters, a bitset keeps one bit per action which is set while
+its counter is not zero, and each report class (keyboard, mouse, gamepad)
+keeps the range of actions that changed since its report was last built. So
+the reports are built from whole words of the bitset (and only the parts that
+changed), and a reset only needs to visit the actions that are active.
+
+Gamepad axes are mixed in the integer domain: each source (thumbstick, gyro)
+accumulates into its own saturating Q15 slot, the slots are combined according
+to the mix policy of the axis, and the result is quantized to the 16-bit
+report range. The gamepad is only considered unsynced when that quantized
+output changes, so sub-LSB noise does not trigger new reports.
+
+For latency tracing, the producers declare when the input they are reporting
+was sampled (see hid_set_input_timestamp), and every report class keeps the
+timestamp of its oldest input not yet sent. When the report is sent, the age
+of that input is recorded into the profiler latency histogram of the class.
+
+To prevent stuck inputs when a wireless report is lost, the dongle
+acknowledges the reports it receives, and on every cycle the newest report of
+each class whose acknowledgement timed out is sent again until it arrives (see
+wireless.c), instead of blindly replaying the last reports.
 */
 
-#include <tusb.h>
-#include <device/usbd_pvt.h>
+#include <stdlib.h>
+#include <string.h>
 #include "config.h"
 #include "ctrl.h"
 #include "hid.h"
+#include "hal.h"
+#include "tusb_config.h"
 #include "wireless.h"
 #include "profile.h"
 #include "xinput.h"
@@ -55,46 +80,155 @@ Flow diagram: docs/replay.md
 #include "logging.h"
 #include "thanks.h"
 #include "power.h"
+#include "fixed.h"
+#include "macro.h"
+#include "profiler.h"
 
 // Toggle to prevent any further communication. Main use case being turning it
 // off while the protocol is being changed to avoid incoherent outputs.
 static bool hid_allow_communication = true;
 
+// Completion callbacks can send reports (only between wired ticks).
+static bool hid_pump_armed = false;
+
 bool synced_keyboard = false;
 bool synced_mouse = false;
 bool synced_gamepad = false;
 uint8_t priority_mouse = 0;
 uint8_t priority_gamepad = 0;
 
-uint16_t alarms = 0;
-alarm_pool_t *alarm_pool;
+// Deferred events. The queue is written by the producers (see *_later
+// functions) and only read by the main loop, which moves the events into the
+// wheel, a list of events per millisecond slot.
+static HidEvent event_queue[HID_EVENT_QUEUE_LEN];
+static volatile uint8_t event_queue_head = 0;
+static volatile uint8_t event_queue_tail = 0;
+static HidEvent wheel_events[HID_WHEEL_EVENTS];
+static uint8_t wheel_head[HID_WHEEL_SLOTS] = {0,};  // Event index plus one, zero if empty.
+static uint8_t wheel_tail[HID_WHEEL_SLOTS] = {0,};
+static uint8_t wheel_free = 0;  // Free list of events, index plus one.
+static uint32_t wheel_cursor = 0;  // Next millisecond to process.
+
+// Latency tracing, microseconds.
+static uint32_t input_timestamp = 0;  // When the current input was sampled.
+static uint32_t oldest_timestamp[HID_CLASSES] = {0,};  // Oldest input not yet reported.
+static bool oldest_pending[HID_CLASSES] = {false,};
+static uint32_t axis_timestamp = 0;  // Latest gamepad axis input.
+
+// Wired reports waiting for their endpoint.
+static HidPending pending[HID_CLASSES] = {0,};
 
 uint8_t state_matrix[256] = {0,};
+uint32_t state_bits[HID_STATE_WORDS] = {0,};
+static HidDirty dirty[HID_CLASSES] = {{0, 255}, {0, 255}, {0, 255}};
 int16_t mouse_x = 0;
 int16_t mouse_y = 0;
-double gamepad_axis[6] = {0,};
-double gamepad_axis_last[6] = {0,};
-
-// Replay reports.
-static KeyboardReport last_report_keyboard;
-static MouseReport last_report_mouse;
-static GamepadReport last_report_gamepad;
-static XInputReport last_report_xinput;
-
-// Replay state (array to support multiple report types), using ReportType as index.
-// 0=unused, 1=keyboard, 2=mouse, 3=gamepad/xinput.
-static bool report_was_sent[4] = {false,};  // Prevent replay if no report was ever sent.
-static uint8_t cycles_without_reporting[4] = {0,};  // Cycles since the last report.
-static uint8_t replayed_ntimes[4] = {0,};  // How many times the last report was replayed.
+int32_t mouse_scroll[2] = {0,};  // Vertical and horizontal, high resolution units.
+static bool scroll_hires[2] = {false, false};  // Resolution multiplier set by the host.
+static int16_t scroll_remainder[2] = {0,};  // Sub-detent scroll not yet sent.
+int32_t gamepad_axis[6][HID_AXIS_SOURCES] = {{0,},};  // Q15.
+HidAxisMix gamepad_axis_mix[6] = {
+    HID_AXIS_MIX_DEFAULT, HID_AXIS_MIX_DEFAULT, HID_AXIS_MIX_DEFAULT,
+    HID_AXIS_MIX_DEFAULT, HID_AXIS_MIX_DEFAULT, HID_AXIS_MIX_DEFAULT,
+};
+int16_t gamepad_axis_output[6] = {0,};  // Quantized, -BIT_15 to BIT_15.
+int16_t gamepad_axis_output_last[6] = {0,};
+
+// Report parts built from the bitset, only updated within the dirty range.
+static uint8_t cache_keyboard_keys[6] = {0,};
+static uint8_t cache_keyboard_modifiers = 0;
+static uint8_t cache_mouse_buttons = 0;
+static uint16_t cache_gamepad_buttons = 0;  // Matrix order (same as XInput).
+static uint32_t cache_gamepad_buttons_hid = 0;  // HID gamepad report order.
+
+// Bit in the HID gamepad report of each gamepad action (in matrix order).
+// Sorted so the most common assigned buttons are lower and easier to identify
+// in-game. Index 11 is padding and is not reported.
+static const int8_t gamepad_hid_order[16] = {
+    10, 11, 8, 9, 13, 12, 6, 7, 4, 5, 14, -1, 0, 1, 2, 3
+};
 
 void hid_set_allow_communication(bool value) {
     hid_allow_communication = value;
 }
 
+static HidClass hid_class(uint8_t key) {
+    if (key >= GAMEPAD_INDEX) return HID_CLASS_GAMEPAD;
+    if (key >= MOUSE_INDEX) return HID_CLASS_MOUSE;
+    return HID_CLASS_KEYBOARD;
+}
+
+void hid_set_input_timestamp(uint64_t timestamp) {
+    input_timestamp = timestamp;
+}
+
+// Keep the oldest, so the age covers every input within the report.
+static void hid_latency_mark(HidClass class, uint32_t timestamp) {
+    if (oldest_pending[class] && (int32_t)(timestamp - oldest_timestamp[class]) >= 0) return;
+    oldest_timestamp[class] = timestamp;
+    oldest_pending[class] = true;
+}
+
+static void hid_latency_record(HidClass class) {
+    if (!oldest_pending[class]) return;
+    profiler_record(PROFILER_LATENCY_KEYBOARD + class, hal_time_us_32() - oldest_timestamp[class]);
+    oldest_pending[class] = false;
+}
+
+static void hid_set_unsynced(uint8_t key) {
+    HidClass class = hid_class(key);
+    hid_latency_mark(class, input_timestamp);
+    if (class == HID_CLASS_GAMEPAD) synced_gamepad = false;
+    else if (class == HID_CLASS_MOUSE) synced_mouse = false;
+    else synced_keyboard = false;
+}
+
+static void hid_bit_toggle(uint8_t key) {
+    state_bits[key >> 5] ^= (1 << (key & 31));
+    HidDirty *range = &dirty[hid_class(key)];
+    range->first = min(range->first, key);
+    range->last = max(range->last, key);
+}
+
+static bool hid_dirty_overlaps(HidClass class, uint8_t first, uint8_t last) {
+    return dirty[class].first <= last && dirty[class].last >= first;
+}
+
+static void hid_dirty_clear(HidClass class) {
+    dirty[class] = (HidDirty){255, 0};
+}
+
+// Up to 16 consecutive bits of the bitset, starting at the given action.
+static uint16_t hid_bits(uint8_t key, uint8_t len) {
+    uint8_t word = key >> 5;
+    uint64_t bits = state_bits[word];
+    if (word < HID_STATE_WORDS - 1) bits |= (uint64_t)state_bits[word + 1] << 32;
+    return (bits >> (key & 31)) & ((1 << len) - 1);
+}
+
+static void hid_matrix_clear(uint8_t key) {
+    if (state_matrix[key]) hid_bit_toggle(key);
+    state_matrix[key] = 0;
+}
+
+// Send the whole state again, eg: after the host enumerated the device.
+void hid_resync() {
+    for(uint8_t i=0; i<HID_CLASSES; i++) pending[i].active = false;
+    synced_keyboard = false;
+    synced_mouse = false;
+    synced_gamepad = false;
+}
+
 void hid_matrix_reset(uint8_t keep) {
-    for(uint8_t action=0; action<255; action++) {
-        if (action == keep) continue;  // Optionally do not reset specific actions.
-        state_matrix[action] = 0;
+    // Only the actions with an active counter have something to clear.
+    for(uint8_t word=0; word<HID_STATE_WORDS; word++) {
+        uint32_t bits = state_bits[word];
+        while(bits) {
+            uint8_t action = (word << 5) + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (action == keep) continue;  // Optionally do not reset specific actions.
+            hid_matrix_clear(action);
+        }
     }
     synced_keyboard = false;
     synced_mouse = false;
@@ -136,14 +270,14 @@ void hid_procedure_press(uint8_t procedure){
     if (procedure == PROC_ROTARY_MODE_4) rotary_set_mode(4);
     if (procedure == PROC_ROTARY_MODE_5) rotary_set_mode(5);
     // Macros.
-    if (procedure == PROC_MACRO_1) hid_macro(1);
-    if (procedure == PROC_MACRO_2) hid_macro(2);
-    if (procedure == PROC_MACRO_3) hid_macro(3);
-    if (procedure == PROC_MACRO_4) hid_macro(4);
-    if (procedure == PROC_MACRO_5) hid_macro(5);
-    if (procedure == PROC_MACRO_6) hid_macro(6);
-    if (procedure == PROC_MACRO_7) hid_macro(7);
-    if (procedure == PROC_MACRO_8) hid_macro(8);
+    if (procedure == PROC_MACRO_1) macro_start(1);
+    if (procedure == PROC_MACRO_2) macro_start(2);
+    if (procedure == PROC_MACRO_3) macro_start(3);
+    if (procedure == PROC_MACRO_4) macro_start(4);
+    if (procedure == PROC_MACRO_5) macro_start(5);
+    if (procedure == PROC_MACRO_6) macro_start(6);
+    if (procedure == PROC_MACRO_7) macro_start(7);
+    if (procedure == PROC_MACRO_8) macro_start(8);
 }
 
 void hid_procedure_release(uint8_t procedure) {
@@ -153,12 +287,14 @@ void hid_procedure_release(uint8_t procedure) {
 
 void hid_press(uint8_t key) {
     if (key == KEY_NONE) return;
+    else if (key == MOUSE_SCROLL_UP) hid_mouse_scroll(HID_SCROLL_RESOLUTION, 0);
+    else if (key == MOUSE_SCROLL_DOWN) hid_mouse_scroll(-HID_SCROLL_RESOLUTION, 0);
     else if (key >= PROC_INDEX) hid_procedure_press(key);
     else {
+        if (state_matrix[key] == 255) return;  // Do not allow to wrap.
         state_matrix[key] += 1;
-        if (key >= GAMEPAD_INDEX) synced_gamepad = false;
-        else if (key >= MOUSE_INDEX) synced_mouse = false;
-        else synced_keyboard = false;
+        if (state_matrix[key] == 1) hid_bit_toggle(key);
+        hid_set_unsynced(key);
     }
 }
 
@@ -170,9 +306,8 @@ void hid_release(uint8_t key) {
     else {
         if (state_matrix[key] > 0) {  // Do not allow to wrap / go negative.
             state_matrix[key] -= 1;
-            if (key >= GAMEPAD_INDEX) synced_gamepad = false;
-            else if (key >= MOUSE_INDEX) synced_mouse = false;
-            else synced_keyboard = false;
+            if (state_matrix[key] == 0) hid_bit_toggle(key);
+            hid_set_unsynced(key);
         }
     }
 }
@@ -194,88 +329,123 @@ void hid_release_multiple(uint8_t *keys) {
     }
 }
 
-void hid_press_later(uint8_t key, uint16_t delay) {
-    alarm_pool_add_alarm_in_ms(
-        alarm_pool,
-        delay,
-        (alarm_callback_t)hid_press_later_callback,
-        (void*)(uint32_t)key,
-        true
-    );
-    alarms++;
+static uint32_t hid_event_now() {
+    return hal_time_us() / 1000;
 }
 
-void hid_release_later(uint8_t key, uint16_t delay) {
-    alarm_pool_add_alarm_in_ms(
-        alarm_pool,
-        delay,
-        (alarm_callback_t)hid_release_later_callback,
-        (void*)(uint32_t)key,
-        true
-    );
-    alarms++;
+static void hid_event_apply(HidEvent *event) {
+    if (event->type == HID_EVENT_PRESS) hid_press(event->key);
+    if (event->type == HID_EVENT_RELEASE) hid_release(event->key);
+    if (event->type == HID_EVENT_PRESS_MULTIPLE) hid_press_multiple(event->keys);
+    if (event->type == HID_EVENT_RELEASE_MULTIPLE) hid_release_multiple(event->keys);
+    if (event->type == HID_EVENT_THANKS) hid_thanks_step();
 }
 
-void hid_press_multiple_later(uint8_t *keys, uint16_t delay) {
-    alarm_pool_add_alarm_in_ms(
-        alarm_pool,
-        delay,
-        (alarm_callback_t)hid_press_multiple_later_callback,
-        keys,
-        true
-    );
-    alarms++;
+// Move an event into the wheel slot of its due time. Events already due go
+// into the slot that is processed next.
+static void hid_wheel_insert(HidEvent *event) {
+    if (!wheel_free) {
+        // Pool exhausted, better to apply it early than to lose it.
+        warn("HID: Event wheel full\n");
+        hid_event_apply(event);
+        return;
+    }
+    uint8_t index = wheel_free - 1;
+    wheel_free = wheel_events[index].next;
+    if ((int32_t)(event->due - wheel_cursor) < 0) event->due = wheel_cursor;
+    wheel_events[index] = *event;
+    wheel_events[index].next = 0;
+    // Append at the end, so events due at the same time keep their order.
+    uint8_t slot = event->due % HID_WHEEL_SLOTS;
+    if (wheel_tail[slot]) wheel_events[wheel_tail[slot] - 1].next = index + 1;
+    else wheel_head[slot] = index + 1;
+    wheel_tail[slot] = index + 1;
+}
+
+static void hid_wheel_process_slot(uint8_t slot, uint32_t now) {
+    uint8_t previous = 0;
+    uint8_t current = wheel_head[slot];
+    while(current) {
+        HidEvent *event = &wheel_events[current - 1];
+        uint8_t next = event->next;
+        if ((int32_t)(now - event->due) < 0) {
+            // Due in a later turn of the wheel.
+            previous = current;
+            current = next;
+            continue;
+        }
+        // Unlink and free before applying, since the event could enqueue
+        // new ones.
+        if (previous) wheel_events[previous - 1].next = next;
+        else wheel_head[slot] = next;
+        if (wheel_tail[slot] == current) wheel_tail[slot] = previous;
+        HidEvent copy = *event;
+        event->next = wheel_free;
+        wheel_free = current;
+        hid_event_apply(&copy);
+        current = next;
+    }
 }
 
-void hid_release_multiple_later(uint8_t *keys, uint16_t delay) {
-    alarm_pool_add_alarm_in_ms(
-        alarm_pool,
-        delay,
-        (alarm_callback_t)hid_release_multiple_later_callback,
-        keys,
-        true
-    );
-    alarms++;
+// Move the queued events into the wheel.
+static void hid_event_drain() {
+    while(event_queue_tail != event_queue_head) {
+        hal_dmb();
+        HidEvent event = event_queue[event_queue_tail % HID_EVENT_QUEUE_LEN];
+        event_queue_tail++;
+        hid_wheel_insert(&event);
+    }
 }
 
-void hid_press_later_callback(alarm_id_t alarm, uint8_t key) {
-    alarm_pool_cancel_alarm(alarm_pool, alarm);
-    hid_press(key);
-    alarms--;
+// Producer side, it only writes the queue head. The producers and the
+// consumer all run on the main loop, so a full queue is simply moved into the
+// wheel first (the order is kept, and the wheel applies the events early
+// rather than losing them when full).
+static void hid_event_enqueue(HidEventType type, uint8_t key, uint8_t *keys, uint16_t delay) {
+    if ((uint8_t)(event_queue_head - event_queue_tail) == HID_EVENT_QUEUE_LEN) {
+        warn("HID: Event queue full\n");
+        hid_event_drain();
+    }
+    uint8_t head = event_queue_head;
+    event_queue[head % HID_EVENT_QUEUE_LEN] = (HidEvent){
+        .keys = keys,
+        .due = hid_event_now() + delay,
+        .type = type,
+        .key = key,
+    };
+    hal_dmb();
+    event_queue_head = head + 1;
+}
+
+// Consumer side, called at the start of every tick by the main loop. Moves
+// the queued events into the wheel and applies the ones that are due.
+void hid_apply_events() {
+    hid_pump_armed = false;
+    hid_event_drain();
+    hid_set_input_timestamp(hal_time_us());
+    uint32_t now = hid_event_now();
+    if ((int32_t)(now - wheel_cursor) < 0) return;  // Same millisecond.
+    // Visit every slot since the last tick (at most a whole turn).
+    if (now - wheel_cursor >= HID_WHEEL_SLOTS) wheel_cursor = now - (HID_WHEEL_SLOTS - 1);
+    for(; (int32_t)(now - wheel_cursor) >= 0; wheel_cursor++) {
+        hid_wheel_process_slot(wheel_cursor % HID_WHEEL_SLOTS, now);
+    }
 }
 
-void hid_release_later_callback(alarm_id_t alarm, uint8_t key) {
-    alarm_pool_cancel_alarm(alarm_pool, alarm);
-    hid_release(key);
-    alarms--;
+void hid_press_later(uint8_t key, uint16_t delay) {
+    hid_event_enqueue(HID_EVENT_PRESS, key, NULL, delay);
 }
 
-void hid_press_multiple_later_callback(alarm_id_t alarm, uint8_t *keys) {
-    alarm_pool_cancel_alarm(alarm_pool, alarm);
-    hid_press_multiple(keys);
-    alarms--;
+void hid_release_later(uint8_t key, uint16_t delay) {
+    hid_event_enqueue(HID_EVENT_RELEASE, key, NULL, delay);
 }
 
-void hid_release_multiple_later_callback(alarm_id_t alarm, uint8_t *keys) {
-    alarm_pool_cancel_alarm(alarm_pool, alarm);
-    hid_release_multiple(keys);
-    alarms--;
+void hid_press_multiple_later(uint8_t *keys, uint16_t delay) {
+    hid_event_enqueue(HID_EVENT_PRESS_MULTIPLE, 0, keys, delay);
 }
 
-void hid_macro(uint8_t index) {
-    uint8_t section = SECTION_MACRO_1 + ((index - 1) / 2);
-    uint8_t subindex = (index - 1) % 2;
-    CtrlProfile *profile = config_profile_read(profile_get_active_index(false));
-    uint8_t *macro = profile->sections[section].macro.macro[subindex];
-    if (alarms > 0) return;  // Disallows parallel macros. TODO fix.
-    uint16_t time = 10;
-    for(uint8_t i=0; i<28; i++) {
-        if (macro[i] == 0) break;
-        hid_press_later(macro[i], time);
-        time += 10;
-        hid_release_later(macro[i], time);
-        time += 10;
-    }
+void hid_release_multiple_later(uint8_t *keys, uint16_t delay) {
+    hid_event_enqueue(HID_EVENT_RELEASE_MULTIPLE, 0, keys, delay);
 }
 
 bool hid_is_axis(uint8_t key) {
@@ -291,97 +461,228 @@ void hid_mouse_move(int16_t x, int16_t y) {
     mouse_x += x;
     mouse_y += y;
     synced_mouse = false;
+    if (x || y) hid_latency_mark(HID_CLASS_MOUSE, input_timestamp);
     profile_set_reported_inputs(true);
 }
 
-void hid_gamepad_axis(GamepadAxis axis, double value) {
-    gamepad_axis[axis] += value;  // Multiple inputs can be combined.
-    if (value != 0) profile_set_reported_inputs(true);
+// In high resolution units, so a wheel detent is HID_SCROLL_RESOLUTION.
+void hid_mouse_scroll(int16_t vertical, int16_t horizontal) {
+    mouse_scroll[0] += vertical;
+    mouse_scroll[1] += horizontal;
+    synced_mouse = false;
+    hid_latency_mark(HID_CLASS_MOUSE, input_timestamp);
+    profile_set_reported_inputs(true);
 }
 
-MouseReport hid_get_mouse_report() {
-    // Create button bitmask.
-    int8_t buttons = 0;
-    for(int i=0; i<5; i++) {
-        buttons += state_matrix[MOUSE_INDEX + i] << i;
-    }
-    uint8_t scroll = state_matrix[MOUSE_SCROLL_UP] - state_matrix[MOUSE_SCROLL_DOWN];
-    // Create report.
-    MouseReport report = {buttons, mouse_x, mouse_y, scroll, 0};
-    return report;
+// Resolution multiplier feature report, as set by the host. Bits 0-1 for the
+// vertical wheel and bits 2-3 for the horizontal wheel.
+void hid_set_scroll_multiplier(uint8_t value) {
+    scroll_hires[0] = value & 0b0011;
+    scroll_hires[1] = value & 0b1100;
+    scroll_remainder[0] = 0;
+    scroll_remainder[1] = 0;
+    info("HID: Scroll multiplier vertical=%i horizontal=%i\n", scroll_hires[0], scroll_hires[1]);
 }
 
-KeyboardReport hid_get_keyboard_report() {
-    // Keys.
-    uint8_t keys[6] = {0};
-    uint8_t keys_available = 6;
-    for(int i=0; i<=115; i++) {
-        if (state_matrix[i] >= 1) {
-            keys[keys_available - 1] = (uint8_t)i;
-            keys_available--;
-            if (keys_available == 0) {
-                break;
+uint8_t hid_get_scroll_multiplier() {
+    return scroll_hires[0] | (scroll_hires[1] << 2);
+}
+
+// Without the multiplier the host expects whole detents, so the sub-detent
+// part is kept for the next reports.
+static int16_t hid_scroll_to_host(uint8_t axis, int16_t value) {
+    if (scroll_hires[axis]) return value;
+    int32_t total = scroll_remainder[axis] + value;
+    int16_t detents = total / HID_SCROLL_RESOLUTION;
+    scroll_remainder[axis] = total - (detents * HID_SCROLL_RESOLUTION);
+    return detents;
+}
+
+static bool hid_send_mouse(MouseReport *report) {
+    // Checked first, so the scroll remainder is not consumed by a failed send.
+    if (!hal_usb_hid_ready(HID_INSTANCE_MOUSE)) return false;
+    MouseReport converted = *report;
+    converted.scroll = hid_scroll_to_host(0, report->scroll);
+    converted.pan = hid_scroll_to_host(1, report->pan);
+    return hal_usb_hid_report(HID_INSTANCE_MOUSE, REPORT_MOUSE, &converted, sizeof(MouseReport));
+}
+
+int32_t hid_saturated_add(int32_t a, int32_t b) {
+    int32_t result;
+    if (__builtin_add_overflow(a, b, &result)) return b > 0 ? INT32_MAX : INT32_MIN;
+    return result;
+}
+
+// Each input is saturated to the unit range, and multiple inputs from the
+// same source are summed.
+void hid_gamepad_axis(GamepadAxis axis, HidAxisSource source, float value) {
+    int32_t q15 = Q15_FROM_FLOAT(constrain(value, -1, 1));
+    gamepad_axis[axis][source] = hid_saturated_add(gamepad_axis[axis][source], q15);
+    axis_timestamp = input_timestamp;
+    if (q15 != 0) profile_set_reported_inputs(true);
+}
+
+void hid_gamepad_axis_set_mix(GamepadAxis axis, HidAxisMix mix) {
+    gamepad_axis_mix[axis] = mix;
+}
+
+static void hid_update_mouse_cache() {
+    if (hid_dirty_overlaps(HID_CLASS_MOUSE, MOUSE_1, MOUSE_5)) {
+        cache_mouse_buttons = hid_bits(MOUSE_1, 5);
+    }
+    hid_dirty_clear(HID_CLASS_MOUSE);
+}
+
+static void hid_update_keyboard_cache() {
+    if (hid_dirty_overlaps(HID_CLASS_KEYBOARD, 0, HID_KEYBOARD_KEYS_END)) {
+        // The first 6 active keys, filled from the end of the array.
+        memset(cache_keyboard_keys, 0, 6);
+        uint8_t keys_available = 6;
+        uint8_t words = (HID_KEYBOARD_KEYS_END >> 5) + 1;
+        for(uint8_t word=0; word<words && keys_available; word++) {
+            uint32_t bits = state_bits[word];
+            if (word == words - 1) bits &= (2 << (HID_KEYBOARD_KEYS_END & 31)) - 1;
+            while(bits && keys_available) {
+                keys_available--;
+                cache_keyboard_keys[keys_available] = (word << 5) + __builtin_ctz(bits);
+                bits &= bits - 1;
             }
         }
     }
-    // Modifiers.
-    uint8_t modifiers = 0;
-    for(int i=0; i<8; i++) {
-        // Any value bigger than 1 consolidates to 1 (with !!).
-        modifiers += !!state_matrix[MODIFIER_INDEX + i] << i;
+    if (hid_dirty_overlaps(HID_CLASS_KEYBOARD, MODIFIER_INDEX, MODIFIER_INDEX_END)) {
+        cache_keyboard_modifiers = hid_bits(MODIFIER_INDEX, 8);
     }
+    hid_dirty_clear(HID_CLASS_KEYBOARD);
+}
+
+static void hid_update_gamepad_cache() {
+    if (hid_dirty_overlaps(HID_CLASS_GAMEPAD, GAMEPAD_INDEX, GAMEPAD_INDEX_END)) {
+        cache_gamepad_buttons = hid_bits(GAMEPAD_INDEX, 16);
+        cache_gamepad_buttons_hid = 0;
+        uint32_t bits = cache_gamepad_buttons;
+        while(bits) {
+            int8_t order = gamepad_hid_order[__builtin_ctz(bits)];
+            if (order >= 0) cache_gamepad_buttons_hid |= (1 << order);
+            bits &= bits - 1;
+        }
+    }
+    hid_dirty_clear(HID_CLASS_GAMEPAD);
+}
+
+// Straight copy of the bitset, since the keycodes are the matrix indexes.
+KeyboardNKROReport hid_get_keyboard_nkro_report() {
+    KeyboardNKROReport report = {hid_bits(MODIFIER_INDEX, 8)};
+    memcpy(report.keys, state_bits, HID_KEYBOARD_NKRO_BYTES);
+    // Clear the bits after the last keycode (the first modifiers).
+    report.keys[HID_KEYBOARD_NKRO_BYTES - 1] &= (1 << (HID_KEYBOARD_NKRO_KEYS % 8)) - 1;
+    return report;
+}
+
+KeyboardNKROReport hid_keyboard_6kro_to_nkro(KeyboardReport *report) {
+    KeyboardNKROReport nkro = {report->modifier};
+    for(uint8_t i=0; i<6; i++) {
+        uint8_t key = report->keycode[i];
+        if (key == KEY_NONE || key >= HID_KEYBOARD_NKRO_KEYS) continue;
+        nkro.keys[key >> 3] |= (1 << (key & 7));
+    }
+    return nkro;
+}
+
+// The host (typically a BIOS) may switch the keyboard to the boot protocol.
+static bool hid_keyboard_is_boot() {
+    return hal_usb_hid_is_boot(HID_INSTANCE_KEYBOARD);
+}
+
+// NKRO unless disabled for the current protocol, or under the boot protocol.
+bool hid_keyboard_is_nkro() {
+    return config_get_keyboard_nkro() && !hid_keyboard_is_boot();
+}
+
+static bool hid_send_keyboard(KeyboardReport *report) {
+    // Boot protocol reports have no ID.
+    uint8_t report_id = hid_keyboard_is_boot() ? 0 : REPORT_KEYBOARD;
+    return hal_usb_hid_report(HID_INSTANCE_KEYBOARD, report_id, report, sizeof(KeyboardReport));
+}
+
+static bool hid_send_keyboard_nkro(KeyboardNKROReport *report) {
+    return hal_usb_hid_report(HID_INSTANCE_KEYBOARD, REPORT_KEYBOARD, report, sizeof(KeyboardNKROReport));
+}
+
+MouseReport hid_get_mouse_report() {
+    hid_update_mouse_cache();
+    int16_t scroll = constrain(mouse_scroll[0], -BIT_15, BIT_15);
+    int16_t pan = constrain(mouse_scroll[1], -BIT_15, BIT_15);
     // Create report.
-    KeyboardReport report = {modifiers};
-    memcpy(report.keycode, keys, 6);
+    MouseReport report = {cache_mouse_buttons, mouse_x, mouse_y, scroll, pan};
     return report;
 }
 
-double hid_axis(
-    double value,
+KeyboardReport hid_get_keyboard_report() {
+    hid_update_keyboard_cache();
+    KeyboardReport report = {cache_keyboard_modifiers};
+    memcpy(report.keycode, cache_keyboard_keys, 6);
+    return report;
+}
+
+int32_t hid_axis_mix(GamepadAxis axis) {
+    int32_t *sources = gamepad_axis[axis];
+    HidAxisMix mix = gamepad_axis_mix[axis];
+    int32_t value = 0;
+    for(uint8_t i=0; i<HID_AXIS_SOURCES; i++) {
+        if (mix == HID_AXIS_MIX_SUM) {
+            value = hid_saturated_add(value, sources[i]);
+        }
+        else if (mix == HID_AXIS_MIX_MAX) {
+            if (abs(sources[i]) > abs(value)) value = sources[i];
+        }
+        else if (mix == HID_AXIS_MIX_PRIORITY) {
+            if (sources[i]) return sources[i];
+        }
+    }
+    return value;
+}
+
+// Mixed axis value quantized to the report range, from -BIT_15 to BIT_15
+// (or from 0 to BIT_15 for triggers), with digital actions taking precedence.
+int16_t hid_axis(
+    GamepadAxis axis,
     uint8_t matrix_index_pos,
     uint8_t matrix_index_neg
 ) {
+    int32_t value;
     if (matrix_index_neg) {
-        if (state_matrix[matrix_index_neg]) return -1;
-        else if (state_matrix[matrix_index_pos]) return 1;
-        else return constrain(value, -1, 1);
+        if (state_matrix[matrix_index_neg]) value = -Q15_ONE;
+        else if (state_matrix[matrix_index_pos]) value = Q15_ONE;
+        else value = constrain(hid_axis_mix(axis), -Q15_ONE, Q15_ONE);
     } else {
-        if (state_matrix[matrix_index_pos]) return 1;
-        else return constrain(fabs(value), 0, 1);
+        if (state_matrix[matrix_index_pos]) value = Q15_ONE;
+        else value = constrain(abs(hid_axis_mix(axis)), 0, Q15_ONE);
     }
+    return value * BIT_15 / Q15_ONE;
+}
+
+void hid_update_gamepad_axis() {
+    gamepad_axis_output[LX] = hid_axis(LX, GAMEPAD_AXIS_LX, GAMEPAD_AXIS_LX_NEG);
+    gamepad_axis_output[LY] = hid_axis(LY, GAMEPAD_AXIS_LY, GAMEPAD_AXIS_LY_NEG);
+    gamepad_axis_output[LZ] = hid_axis(LZ, GAMEPAD_AXIS_LZ, 0);
+    gamepad_axis_output[RX] = hid_axis(RX, GAMEPAD_AXIS_RX, GAMEPAD_AXIS_RX_NEG);
+    gamepad_axis_output[RY] = hid_axis(RY, GAMEPAD_AXIS_RY, GAMEPAD_AXIS_RY_NEG);
+    gamepad_axis_output[RZ] = hid_axis(RZ, GAMEPAD_AXIS_RZ, 0);
 }
 
 GamepadReport hid_get_gamepad_report() {
-    // Sorted so the most common assigned buttons are lower and easier to
-    // identify in-game.
-    int32_t buttons = (
-        // Any value bigger than 1 consolidates to 1 (with !!).
-        ((!!state_matrix[GAMEPAD_A])      <<  0) +
-        ((!!state_matrix[GAMEPAD_B])      <<  1) +
-        ((!!state_matrix[GAMEPAD_X])      <<  2) +
-        ((!!state_matrix[GAMEPAD_Y])      <<  3) +
-        ((!!state_matrix[GAMEPAD_L1])     <<  4) +
-        ((!!state_matrix[GAMEPAD_R1])     <<  5) +
-        ((!!state_matrix[GAMEPAD_L3])     <<  6) +
-        ((!!state_matrix[GAMEPAD_R3])     <<  7) +
-        ((!!state_matrix[GAMEPAD_LEFT])   <<  8) +
-        ((!!state_matrix[GAMEPAD_RIGHT])  <<  9) +
-        ((!!state_matrix[GAMEPAD_UP])     << 10) +
-        ((!!state_matrix[GAMEPAD_DOWN])   << 11) +
-        ((!!state_matrix[GAMEPAD_SELECT]) << 12) +
-        ((!!state_matrix[GAMEPAD_START])  << 13) +
-        ((!!state_matrix[GAMEPAD_HOME])   << 14)
-    );
-    // Adjust range from [-1,1] to [-32767,32767].
-    int16_t lx_report = hid_axis(gamepad_axis[LX], GAMEPAD_AXIS_LX, GAMEPAD_AXIS_LX_NEG) * BIT_15;
-    int16_t ly_report = hid_axis(gamepad_axis[LY], GAMEPAD_AXIS_LY, GAMEPAD_AXIS_LY_NEG) * BIT_15;
-    int16_t rx_report = hid_axis(gamepad_axis[RX], GAMEPAD_AXIS_RX, GAMEPAD_AXIS_RX_NEG) * BIT_15;
-    int16_t ry_report = hid_axis(gamepad_axis[RY], GAMEPAD_AXIS_RY, GAMEPAD_AXIS_RY_NEG) * BIT_15;
+    hid_update_gamepad_cache();
+    int32_t buttons = cache_gamepad_buttons_hid;
+    // Already in the range [-32767,32767].
+    int16_t lx_report = gamepad_axis_output[LX];
+    int16_t ly_report = gamepad_axis_output[LY];
+    int16_t rx_report = gamepad_axis_output[RX];
+    int16_t ry_report = gamepad_axis_output[RY];
     // HID triggers must be also defined as unsigned in the USB descriptor, and has to be manually
     // value-shifted from signed to unsigned here, otherwise Windows is having erratic behavior and
     // inconsistencies between games (not sure if a bug in Windows' DirectInput or TinyUSB).
-    int16_t lz_report = ((hid_axis(gamepad_axis[LZ], GAMEPAD_AXIS_LZ, 0) * 2) - 1) * BIT_15;
-    int16_t rz_report = ((hid_axis(gamepad_axis[RZ], GAMEPAD_AXIS_RZ, 0) * 2) - 1) * BIT_15;
+    int16_t lz_report = (gamepad_axis_output[LZ] * 2) - BIT_15;
+    int16_t rz_report = (gamepad_axis_output[RZ] * 2) - BIT_15;
     GamepadReport report = {
         lx_report,
         ly_report,
@@ -395,24 +696,18 @@ GamepadReport hid_get_gamepad_report() {
 }
 
 XInputReport hid_get_xinput_report() {
-    int8_t buttons_0 = 0;
-    int8_t buttons_1 = 0;
-    // Button bitmask.
-    // Any value bigger than 1 consolidates to 1 (with !!).
-    for(int i=0; i<8; i++) {
-        buttons_0 += (!!state_matrix[GAMEPAD_INDEX + i]) << i;
-    }
-    for(int i=0; i<8; i++) {
-        buttons_1 += (!!state_matrix[GAMEPAD_INDEX + i + 8]) << i;
-    }
-    // Adjust range from [-1,1] to [-32767,32767].
-    int16_t lx_report = hid_axis(gamepad_axis[LX], GAMEPAD_AXIS_LX, GAMEPAD_AXIS_LX_NEG) * BIT_15;
-    int16_t ly_report = hid_axis(gamepad_axis[LY], GAMEPAD_AXIS_LY, GAMEPAD_AXIS_LY_NEG) * BIT_15;
-    int16_t rx_report = hid_axis(gamepad_axis[RX], GAMEPAD_AXIS_RX, GAMEPAD_AXIS_RX_NEG) * BIT_15;
-    int16_t ry_report = hid_axis(gamepad_axis[RY], GAMEPAD_AXIS_RY, GAMEPAD_AXIS_RY_NEG) * BIT_15;
-    // Adjust range from [0,1] to [0,255].
-    uint16_t lz_report = hid_axis(gamepad_axis[LZ], GAMEPAD_AXIS_LZ, 0) * BIT_8;
-    uint16_t rz_report = hid_axis(gamepad_axis[RZ], GAMEPAD_AXIS_RZ, 0) * BIT_8;
+    hid_update_gamepad_cache();
+    // Button bitmask, same order as the matrix.
+    int8_t buttons_0 = cache_gamepad_buttons & 0xFF;
+    int8_t buttons_1 = cache_gamepad_buttons >> 8;
+    // Already in the range [-32767,32767].
+    int16_t lx_report = gamepad_axis_output[LX];
+    int16_t ly_report = gamepad_axis_output[LY];
+    int16_t rx_report = gamepad_axis_output[RX];
+    int16_t ry_report = gamepad_axis_output[RY];
+    // Adjust range from [0,32767] to [0,255].
+    uint16_t lz_report = gamepad_axis_output[LZ] * BIT_8 / BIT_15;
+    uint16_t rz_report = gamepad_axis_output[RZ] * BIT_8 / BIT_15;
     XInputReport report = {
         .report_id   = 0,
         .report_size = XINPUT_REPORT_SIZE,
@@ -432,117 +727,105 @@ XInputReport hid_get_xinput_report() {
 void hid_reset_mouse() {
     mouse_x = 0;
     mouse_y = 0;
-    state_matrix[MOUSE_SCROLL_UP] = 0;
-    state_matrix[MOUSE_SCROLL_DOWN] = 0;
+    mouse_scroll[0] = 0;
+    mouse_scroll[1] = 0;
 }
 
 void hid_reset_gamepad_axis() {
     // Gamepad axis values being reset so potentially unsent values are not
     // aggregated with the next cycle.
-    for(uint8_t i=0; i<6; i++) gamepad_axis[i] = 0;
+    memset(gamepad_axis, 0, sizeof(gamepad_axis));
 }
 
 void hid_set_gamepad_synced() {
-    for(uint8_t i=0; i<6; i++) gamepad_axis_last[i] = gamepad_axis[i];
+    memcpy(gamepad_axis_output_last, gamepad_axis_output, sizeof(gamepad_axis_output));
     synced_gamepad = true;
     priority_gamepad = 0;
+    hid_latency_record(HID_CLASS_GAMEPAD);
 }
 
 void hid_evaluate_gamepad_synced() {
-    // Only evaluate if wasn't already marked as unsynced (by buttons).
-    if (!synced_gamepad) return;
-    // Evaluate axis.
+    hid_update_gamepad_axis();
+    // Evaluate axis, only the quantized output matters.
     for(uint8_t i=0; i<6; i++) {
-        if (gamepad_axis[i] != gamepad_axis_last[i]) {
+        if (gamepad_axis_output[i] != gamepad_axis_output_last[i]) {
             synced_gamepad = false;
+            hid_latency_mark(HID_CLASS_GAMEPAD, axis_timestamp);
+            return;
         }
     }
 }
 
+// Keep the report as the newest pending state of the class.
+static void *hid_pending_store(HidClass class, void *report, uint8_t len) {
+    HidPending *slot = &pending[class];
+    // Mouse motion is accumulated into the newer report, so only the buttons
+    // (first byte) can be lost.
+    uint8_t compare = (class == HID_CLASS_MOUSE) ? 1 : len;
+    if (slot->active && (slot->len != len || memcmp(slot->report, report, compare))) {
+        slot->dropped++;
+    }
+    memcpy(slot->report, report, len);
+    slot->len = len;
+    slot->active = true;
+    return slot->report;
+}
+
+static bool hid_pending_result(HidClass class, bool sent) {
+    if (sent) pending[class].active = false;
+    else pending[class].deferred++;
+    return sent;
+}
+
 void hid_report_keyboard(bool wired) {
     KeyboardReport report = hid_get_keyboard_report();
-    if (wired) tud_hid_report(REPORT_KEYBOARD, &report, sizeof(report));
+    if (wired && hid_keyboard_is_nkro()) {
+        KeyboardNKROReport nkro = hid_get_keyboard_nkro_report();
+        void *slot = hid_pending_store(HID_CLASS_KEYBOARD, &nkro, sizeof(nkro));
+        if (!hid_pending_result(HID_CLASS_KEYBOARD, hid_send_keyboard_nkro(slot))) return;
+    }
+    else if (wired) {
+        void *slot = hid_pending_store(HID_CLASS_KEYBOARD, &report, sizeof(report));
+        if (!hid_pending_result(HID_CLASS_KEYBOARD, hid_send_keyboard(slot))) return;
+    }
     else wireless_send_hid(REPORT_KEYBOARD, &report, sizeof(report));
     synced_keyboard = true;
-    last_report_keyboard = report;
+    hid_latency_record(HID_CLASS_KEYBOARD);
 }
 
 void hid_report_mouse(bool wired) {
     MouseReport report = hid_get_mouse_report();
-    if (wired) tud_hid_report(REPORT_MOUSE, &report, sizeof(report));
+    if (wired) {
+        // Not reset when deferred, so the motion is sent with the next one.
+        void *slot = hid_pending_store(HID_CLASS_MOUSE, &report, sizeof(report));
+        if (!hid_pending_result(HID_CLASS_MOUSE, hid_send_mouse(slot))) return;
+    }
     else wireless_send_hid(REPORT_MOUSE, &report, sizeof(report));
     hid_reset_mouse();
     synced_mouse = true;
     priority_mouse = 0;
-    last_report_mouse = report;
+    hid_latency_record(HID_CLASS_MOUSE);
 }
 
 void hid_report_gamepad(bool wired) {
     GamepadReport report = hid_get_gamepad_report();
-    if (wired) tud_hid_report(REPORT_GAMEPAD, &report, sizeof(report));
+    if (wired) {
+        void *slot = hid_pending_store(HID_CLASS_GAMEPAD, &report, sizeof(report));
+        bool sent = hal_usb_hid_report(HID_INSTANCE_GAMEPAD, REPORT_GAMEPAD, slot, sizeof(report));
+        if (!hid_pending_result(HID_CLASS_GAMEPAD, sent)) return;
+    }
     else wireless_send_hid(REPORT_GAMEPAD, &report, sizeof(report));
     hid_set_gamepad_synced();
-    last_report_gamepad = report;
 }
 
 void hid_report_xinput(bool wired) {
     XInputReport report = hid_get_xinput_report();
-    if (wired) xinput_send_report(&report);
+    if (wired) {
+        void *slot = hid_pending_store(HID_CLASS_GAMEPAD, &report, sizeof(report));
+        if (!hid_pending_result(HID_CLASS_GAMEPAD, xinput_send_report(slot))) return;
+    }
     else wireless_send_hid(REPORT_XINPUT, &report, sizeof(report));
     hid_set_gamepad_synced();
-    last_report_xinput = report;
-}
-
-void hid_replay_keyboard() {
-    wireless_send_hid(REPORT_KEYBOARD, &last_report_keyboard, sizeof(last_report_keyboard));
-    replayed_ntimes[REPORT_KEYBOARD] += 1;
-    cycles_without_reporting[REPORT_KEYBOARD] = 0;
-}
-
-void hid_replay_mouse() {
-    // Strip incremental data (replay only buttons).
-    last_report_mouse.x = 0;
-    last_report_mouse.y = 0;
-    last_report_mouse.scroll = 0;
-    last_report_mouse.pan = 0;
-    // Replay.
-    wireless_send_hid(REPORT_MOUSE, &last_report_mouse, sizeof(last_report_mouse));
-    replayed_ntimes[REPORT_MOUSE] += 1;
-    cycles_without_reporting[REPORT_MOUSE] = 0;
-}
-
-void hid_replay_gamepad() {
-    wireless_send_hid(REPORT_GAMEPAD, &last_report_gamepad, sizeof(last_report_gamepad));
-    replayed_ntimes[REPORT_GAMEPAD] += 1;
-    cycles_without_reporting[REPORT_GAMEPAD] = 0;
-}
-
-void hid_replay_xinput() {
-    wireless_send_hid(REPORT_XINPUT, &last_report_xinput, sizeof(last_report_xinput));
-    replayed_ntimes[REPORT_GAMEPAD] += 1;
-    cycles_without_reporting[REPORT_GAMEPAD] = 0;
-}
-
-void hid_update_replay_state(ReportType type) {
-    if (type == REPORT_XINPUT) type = REPORT_GAMEPAD; // Gamepad and Xinput counter is shared.
-    nowrap_u8_increment(cycles_without_reporting[REPORT_KEYBOARD]);
-    nowrap_u8_increment(cycles_without_reporting[REPORT_MOUSE]);
-    nowrap_u8_increment(cycles_without_reporting[REPORT_GAMEPAD]);
-    if (type == 0) return;
-    cycles_without_reporting[type] = 0;
-    replayed_ntimes[type] = 0;
-    report_was_sent[type] = true;
-}
-
-bool hid_should_replay(ReportType type) {
-    if (
-        report_was_sent[type] == true &&
-        cycles_without_reporting[type] > HID_REPLAY_THRESHOLD &&
-        replayed_ntimes[type] < HID_REPLAY_N_TIMES
-    ) {
-        return true;
-    }
-    return false;
 }
 
 ReportType hid_get_priority() {
@@ -555,13 +838,6 @@ ReportType hid_get_priority() {
     hid_evaluate_gamepad_synced(); // Special case because accumulative absolute axis.
     if (!synced_mouse) priority_mouse += 1 * HID_REPORT_PRIORITY_RATIO;
     if (!synced_gamepad) priority_gamepad += 1;
-    // Replay.
-    if (synced_keyboard && hid_should_replay(REPORT_KEYBOARD)) return REPORT_REPLAY_KEYBOARD;
-    if (synced_mouse && hid_should_replay(REPORT_MOUSE)) return REPORT_REPLAY_MOUSE;
-    if (synced_gamepad && hid_should_replay(REPORT_GAMEPAD)) {
-        if (config_get_protocol() == PROTOCOL_GENERIC) return REPORT_REPLAY_GAMEPAD;
-        else return REPORT_REPLAY_XINPUT;
-    }
     // Evaluate keyboard / mouse / gamepad.
     if (!synced_keyboard) return REPORT_KEYBOARD;
     if (!synced_mouse && (priority_mouse > priority_gamepad)) return REPORT_MOUSE;
@@ -572,29 +848,50 @@ ReportType hid_get_priority() {
     return 0;
 }
 
+// Every report type has its own endpoint, so all the types that changed are
+// sent in the same tick (if their endpoint is not still busy with the
+// previous report, otherwise they stay pending and are sent once the endpoint
+// completes, or retried in the next tick).
 bool hid_report_wired() {
     if (!hid_allow_communication) return true;
-    ReportType device_to_report = hid_get_priority();
-    tud_task();
-    if (tud_ready()) {
-        if (tud_hid_ready()) {
-            webusb_read();
-            webusb_flush();
-            if (device_to_report == REPORT_KEYBOARD) hid_report_keyboard(true);
-            if (device_to_report == REPORT_MOUSE) hid_report_mouse(true);
-            if (device_to_report == REPORT_GAMEPAD) hid_report_gamepad(true);
-        }
-        if (device_to_report == REPORT_XINPUT) {
-            if (tud_suspended()) tud_remote_wakeup();
-            hid_report_xinput(true);
+    hid_evaluate_gamepad_synced(); // Special case because accumulative absolute axis.
+    hal_usb_task();
+    if (hal_usb_ready()) {
+        if (!synced_keyboard) hid_report_keyboard(true);
+        if (!synced_mouse) hid_report_mouse(true);
+        if (!synced_gamepad) {
+            if (config_get_protocol() == PROTOCOL_GENERIC) {
+                hid_report_gamepad(true);
+            } else {
+                if (hal_usb_suspended()) hal_usb_remote_wakeup();
+                hid_report_xinput(true);
+            }
         }
         hid_reset_gamepad_axis();
+        hid_pump_armed = true;
         return true;
     } else {
         return false;
     }
 }
 
+// Invoked by the USB stack once the previous report of the class was
+// delivered, so the endpoint is free for the pending one.
+void hid_report_complete(HidClass class) {
+    #ifdef DEVICE_DONGLE
+        // The report received over the radio while the endpoint was busy.
+        wireless_dongle_forward(class);
+        return;
+    #endif
+    if (!hid_allow_communication || !hid_pump_armed) return;
+    if (class == HID_CLASS_KEYBOARD && !synced_keyboard) hid_report_keyboard(true);
+    if (class == HID_CLASS_MOUSE && !synced_mouse) hid_report_mouse(true);
+    if (class == HID_CLASS_GAMEPAD && !synced_gamepad) {
+        if (config_get_protocol() == PROTOCOL_GENERIC) hid_report_gamepad(true);
+        else hid_report_xinput(true);
+    }
+}
+
 bool hid_report_wireless() {
     if (!hid_allow_communication) return true;
     ReportType device_to_report = hid_get_priority();
@@ -602,15 +899,9 @@ bool hid_report_wireless() {
     if (device_to_report == REPORT_MOUSE) hid_report_mouse(false);
     if (device_to_report == REPORT_GAMEPAD) hid_report_gamepad(false);
     if (device_to_report == REPORT_XINPUT) hid_report_xinput(false);
-    // Replay.
-    if (device_to_report == REPORT_REPLAY_KEYBOARD) hid_replay_keyboard();
-    if (device_to_report == REPORT_REPLAY_MOUSE) hid_replay_mouse();
-    if (device_to_report == REPORT_REPLAY_GAMEPAD) hid_replay_gamepad();
-    if (device_to_report == REPORT_REPLAY_XINPUT) hid_replay_xinput();
-    // Update replay state.
-    if (device_to_report <= REPORT_XINPUT) {  // Skip update when a report is being replayed.
-        hid_update_replay_state(device_to_report);
-    }
+    // Reports the dongle did not acknowledge in time, even under constant
+    // input of other classes.
+    wireless_retransmit();
     // Post-process.
     hid_reset_gamepad_axis();
     // webusb_read();
@@ -618,33 +909,35 @@ bool hid_report_wireless() {
     return true;
 }
 
-void hid_report_dongle(uint8_t report_id, uint8_t* payload) {
-    tud_task();
-    if (tud_ready()) {
-        if (report_id == REPORT_KEYBOARD) {
-            if (tud_hid_ready()) {
-                tud_hid_report(REPORT_KEYBOARD, payload, sizeof(KeyboardReport));
-            }
-        }
-        if (report_id == REPORT_MOUSE) {
-            if (tud_hid_ready()) {
-                tud_hid_report(REPORT_MOUSE, payload, sizeof(MouseReport));
-            }
-        }
-        if (report_id == REPORT_GAMEPAD) {
-            if (tud_hid_ready()) {
-                tud_hid_report(REPORT_GAMEPAD, payload, sizeof(GamepadReport));
-            }
-        }
-        if (report_id == REPORT_XINPUT) {
-            xinput_send_report((XInputReport*)payload);
+// Returns false if the endpoint did not take the report, so the caller keeps
+// it (see wireless.c). The USB task is run by the dongle loop, not here, since
+// this is also called from the completion callbacks.
+bool hid_report_dongle(uint8_t report_id, uint8_t* payload) {
+    if (!hal_usb_ready()) return false;
+    if (report_id == REPORT_KEYBOARD) {
+        if (!hal_usb_hid_ready(HID_INSTANCE_KEYBOARD)) return false;
+        // The radio link always carries 6KRO reports.
+        if (hid_keyboard_is_nkro()) {
+            KeyboardNKROReport nkro = hid_keyboard_6kro_to_nkro((KeyboardReport*)payload);
+            return hid_send_keyboard_nkro(&nkro);
         }
+        return hid_send_keyboard((KeyboardReport*)payload);
+    }
+    if (report_id == REPORT_MOUSE) {
+        return hid_send_mouse((MouseReport*)payload);
+    }
+    if (report_id == REPORT_GAMEPAD) {
+        if (!hal_usb_hid_ready(HID_INSTANCE_GAMEPAD)) return false;
+        return hal_usb_hid_report(HID_INSTANCE_GAMEPAD, REPORT_GAMEPAD, payload, sizeof(GamepadReport));
+    }
+    if (report_id == REPORT_XINPUT) {
+        return xinput_send_report((XInputReport*)payload);
     }
+    return true;  // Unknown, nothing to keep.
 }
 
 // A not-so-secret easter egg.
-void hid_thanks_(alarm_id_t alarm) {
-    cancel_alarm(alarm);
+void hid_thanks_step() {
     static uint8_t x = 0;
     static bool p = 0;
     static uint8_t r;
@@ -664,14 +957,30 @@ void hid_thanks_(alarm_id_t alarm) {
         p = false;
         x += 1;
     }
-    add_alarm_in_ms(5, (alarm_callback_t)hid_thanks_, NULL, true);
+    hid_event_enqueue(HID_EVENT_THANKS, 0, NULL, 5);
+}
+
+void hid_log_stats() {
+    static const char *names[] = {"keyboard", "mouse", "gamepad"};
+    for(uint8_t i=0; i<HID_CLASSES; i++) {
+        if (!pending[i].deferred) continue;
+        info(
+            "HID: %s deferred=%lu dropped=%lu\n",
+            names[i], pending[i].deferred, pending[i].dropped
+        );
+    }
 }
 
 void hid_thanks() {
-    add_alarm_in_ms(5, (alarm_callback_t)hid_thanks_, NULL, true);
+    hid_event_enqueue(HID_EVENT_THANKS, 0, NULL, 5);
 }
 
 void hid_init() {
     info("INIT: HID\n");
-    alarm_pool = alarm_pool_create(2, 255);
+    // Chain all the events into the free list.
+    for(uint8_t i=0; i<HID_WHEEL_EVENTS; i++) {
+        wheel_events[i].next = (i + 1 < HID_WHEEL_EVENTS) ? i + 2 : 0;
+    }
+    wheel_free = 1;
+    wheel_cursor = hid_event_now();
 }
@@ -4,29 +4,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <pico/stdlib.h>
 #include "imu.h"
 #include "config.h"
 #include "common.h"
 #include "pin.h"
 #include "bus.h"
 #include "vector.h"
+#include "sensors.h"
 #include "logging.h"
 
 uint8_t IMU0 = 0;
 uint8_t IMU1 = 0;
-double offset_gyro_0_x;
-double offset_gyro_0_y;
-double offset_gyro_0_z;
-double offset_gyro_1_x;
-double offset_gyro_1_y;
-double offset_gyro_1_z;
-double offset_accel_0_x;
-double offset_accel_0_y;
-double offset_accel_0_z;
-double offset_accel_1_x;
-double offset_accel_1_y;
-double offset_accel_1_z;
+float offset_gyro_0_x;
+float offset_gyro_0_y;
+float offset_gyro_0_z;
+float offset_gyro_1_x;
+float offset_gyro_1_y;
+float offset_gyro_1_z;
+float offset_accel_0_x;
+float offset_accel_0_y;
+float offset_accel_0_z;
+float offset_accel_1_x;
+float offset_accel_1_y;
+float offset_accel_1_z;
 
 void imu_channel_select() {
     Config *config = config_read();
@@ -50,10 +50,12 @@ void imu_init_single(uint8_t cs, uint8_t gyro_conf) {
 
 void imu_init() {
     info("INIT: IMU\n");
+    sensors_pause();
     imu_channel_select();
     imu_load_calibration();
     imu_init_single(IMU0, IMU_CTRL2_G_500);
     imu_init_single(IMU1, IMU_CTRL2_G_125);
+    sensors_resume();
 }
 
 void imu_power_off_single(uint8_t cs) {
@@ -75,20 +77,20 @@ Vector imu_read_gyro_bits(uint8_t cs) {
     int16_t y =  (((int16_t)buf[1] << 8) | (int16_t)buf[0]);
     int16_t z =  (((int16_t)buf[3] << 8) | (int16_t)buf[2]);
     int16_t x = -(((int16_t)buf[5] << 8) | (int16_t)buf[4]);
-    double offset_x = (cs==PIN_SPI_CS0) ? offset_gyro_0_x : offset_gyro_1_x;
-    double offset_y = (cs==PIN_SPI_CS0) ? offset_gyro_0_y : offset_gyro_1_y;
-    double offset_z = (cs==PIN_SPI_CS0) ? offset_gyro_0_z : offset_gyro_1_z;
+    float offset_x = (cs==PIN_SPI_CS0) ? offset_gyro_0_x : offset_gyro_1_x;
+    float offset_y = (cs==PIN_SPI_CS0) ? offset_gyro_0_y : offset_gyro_1_y;
+    float offset_z = (cs==PIN_SPI_CS0) ? offset_gyro_0_z : offset_gyro_1_z;
     #ifdef DEVICE_ALPAKKA_V0
         return (Vector){
-            (double)x - offset_x,
-            (double)y - offset_y,
-            (double)z - offset_z,
+            (float)x - offset_x,
+            (float)y - offset_y,
+            (float)z - offset_z,
         };
     #else /* DEVICE_ALPAKKA_V1 */
         return (Vector){
-            (double)x - offset_x,
-            -(double)y - offset_y,
-            -(double)z - offset_z,
+            (float)x - offset_x,
+            -(float)y - offset_y,
+            -(float)z - offset_z,
         };
     #endif
 }
@@ -99,28 +101,28 @@ Vector imu_read_accel_bits(uint8_t cs) {
     int16_t x = (((int16_t)buf[1] << 8) | (int16_t)buf[0]);
     int16_t y = (((int16_t)buf[3] << 8) | (int16_t)buf[2]);
     int16_t z = (((int16_t)buf[5] << 8) | (int16_t)buf[4]);
-    double offset_x = (cs==PIN_SPI_CS0) ? offset_accel_0_x : offset_accel_1_x;
-    double offset_y = (cs==PIN_SPI_CS0) ? offset_accel_0_y : offset_accel_1_y;
-    double offset_z = (cs==PIN_SPI_CS0) ? offset_accel_0_z : offset_accel_1_z;
+    float offset_x = (cs==PIN_SPI_CS0) ? offset_accel_0_x : offset_accel_1_x;
+    float offset_y = (cs==PIN_SPI_CS0) ? offset_accel_0_y : offset_accel_1_y;
+    float offset_z = (cs==PIN_SPI_CS0) ? offset_accel_0_z : offset_accel_1_z;
     #ifdef DEVICE_ALPAKKA_V0
         return (Vector){
-            (double)x - offset_x,
-            (double)y - offset_y,
-            (double)z - offset_z,
+            (float)x - offset_x,
+            (float)y - offset_y,
+            (float)z - offset_z,
         };
     #else /* DEVICE_ALPAKKA_V1 */
         return (Vector){
-            -(double)x - offset_x,
-            -(double)y - offset_y,
-            (double)z - offset_z,
+            -(float)x - offset_x,
+            -(float)y - offset_y,
+            (float)z - offset_z,
         };
     #endif
 }
 
 Vector imu_read_gyro_burst(uint8_t cs, uint8_t samples) {
-    double x = 0;
-    double y = 0;
-    double z = 0;
+    float x = 0;
+    float y = 0;
+    float z = 0;
     for(uint8_t i=0; i<samples; i++) {
         Vector sample = imu_read_gyro_bits(cs);
         x += sample.x;
@@ -133,19 +135,19 @@ Vector imu_read_gyro_burst(uint8_t cs, uint8_t samples) {
     return (Vector){x, y, z};
 }
 
-Vector imu_read_gyro() {
+Vector imu_sample_gyro() {
     Vector gyro0 = imu_read_gyro_burst(IMU0, CFG_IMU_TICK_SAMPLES/8*1);
     Vector gyro1 = imu_read_gyro_burst(IMU1, CFG_IMU_TICK_SAMPLES/8*7);
-    double weight = max(abs(gyro1.x), abs(gyro1.y)) / 32768.0;
-    double weight_0 = ramp_mid(weight, 0.2);
-    double weight_1 = 1 - weight_0;
-    double x = (gyro0.x * weight_0) + (gyro1.x * weight_1 / 4);
-    double y = (gyro0.y * weight_0) + (gyro1.y * weight_1 / 4);
-    double z = (gyro0.z * weight_0) + (gyro1.z * weight_1 / 4);
+    float weight = max(fabsf(gyro1.x), fabsf(gyro1.y)) / 32768.0f;
+    float weight_0 = ramp_mid(weight, 0.2f);
+    float weight_1 = 1 - weight_0;
+    float x = (gyro0.x * weight_0) + (gyro1.x * weight_1 / 4);
+    float y = (gyro0.y * weight_0) + (gyro1.y * weight_1 / 4);
+    float z = (gyro0.z * weight_0) + (gyro1.z * weight_1 / 4);
     return (Vector){x, y, z};
 }
 
-Vector imu_read_accel() {
+Vector imu_sample_accel() {
     Vector accel0 = imu_read_accel_bits(IMU0);
     Vector accel1 = imu_read_accel_bits(IMU1);
     return (Vector){
@@ -155,7 +157,17 @@ Vector imu_read_accel() {
     };
 }
 
-void imu_calibrate_single(uint8_t cs, bool mode, double* x, double* y, double* z) {
+Vector imu_read_gyro() {
+    if (sensors_is_active()) return sensors_get()->gyro;
+    return imu_sample_gyro();
+}
+
+Vector imu_read_accel() {
+    if (sensors_is_active()) return sensors_get()->accel;
+    return imu_sample_accel();
+}
+
+void imu_calibrate_single(uint8_t cs, bool mode, float* x, float* y, float* z) {
     char *mode_str = mode ? "accel" : "gyro";
     info("IMU: cs=%i calibrating %s...\n", cs, mode_str);
     double sum_x = 0;
@@ -194,6 +206,7 @@ void imu_calibrate_single(uint8_t cs, bool mode, double* x, double* y, double* z
 }
 
 void imu_load_calibration() {
+    sensors_pause();
     Config *config = config_read();
     offset_gyro_0_x = config->offset_gyro_0_x - (config->offset_gyro_user_x * GYRO_USER_OFFSET_FACTOR);
     offset_gyro_0_y = config->offset_gyro_0_y - (config->offset_gyro_user_y * GYRO_USER_OFFSET_FACTOR);
@@ -207,6 +220,7 @@ void imu_load_calibration() {
     offset_accel_1_x = config->offset_accel_1_x;
     offset_accel_1_y = config->offset_accel_1_y;
     offset_accel_1_z = config->offset_accel_1_z;
+    sensors_resume();
 }
 
 void imu_reset_calibration() {
@@ -225,6 +239,7 @@ void imu_reset_calibration() {
 }
 
 void imu_calibrate() {
+    sensors_pause();
     config_set_gyro_user_offset(0, 0, 0);
     imu_reset_calibration();
     imu_calibrate_single(PIN_SPI_CS0, 0, &offset_gyro_0_x, &offset_gyro_0_y, &offset_gyro_0_z);
@@ -248,4 +263,5 @@ void imu_calibrate() {
         offset_accel_1_z
     );
     imu_load_calibration();
+    sensors_resume();
 }
@@ -23,6 +23,10 @@
 #include "pin.h"
 #include "power.h"
 #include "webusb.h"
+#include "sensors.h"
+#include "sched.h"
+#include "profiler.h"
+#include "macro.h"
 
 // -----------------------------------------------------
 #include "hardware/vreg.h"
@@ -49,6 +53,10 @@ void SetSystemClockFrequency(uint32_t clk_khz, bool increase_voltage)
 // -----------------------------------------------------
 
 static DeviceMode device_mode = WIRED;
+static uint8_t main_task = 0;
+static int16_t sof_lead = 0;
+static bool idle = false;
+static uint64_t last_input_ts = 0;
 static bool battery_low = false;
 static uint64_t system_clock = 0;
 
@@ -57,6 +65,12 @@ DeviceMode loop_get_device_mode()
     return device_mode;
 }
 
+// Measured time between the start of the tick and the next USB frame.
+int16_t loop_get_sof_lead()
+{
+    return sof_lead;
+}
+
 void loop_set_battery_low(bool state)
 {
     battery_low = state;
@@ -153,32 +167,141 @@ static void set_inactive()
 static void board_led()
 {
 #ifdef DEVICE_ALPAKKA_V1
-    static uint8_t i = 0;
     static bool blink = false;
-    i++;
-    if (i == 100)
+    if (!gpio_get(PIN_BATT_STAT_1))
+    {
+        led_board_set(true); // Led on indicates battery is charging.
+    }
+    else
     {
-        i = 0;
-        if (!gpio_get(PIN_BATT_STAT_1))
+        if (battery_low)
         {
-            led_board_set(true); // Led on indicates battery is charging.
+            blink = !blink;
+            led_board_set(blink); // Blinking led if battery is low.
         }
         else
         {
-            if (battery_low)
-            {
-                blink = !blink;
-                led_board_set(blink); // Blinking led if battery is low.
-            }
-            else
-            {
-                led_board_set(false);
-            }
+            led_board_set(false);
         }
     }
 #endif
 }
 
+static void usb_check()
+{
+    // Switch to wired if USB is connected.
+    if (device_mode == WIRELESS && usb_is_connected())
+        set_wired();
+}
+
+static void dongle_usb_check()
+{
+    if (device_mode == WIRELESS && !usb_is_connected())
+        set_inactive();
+    else if (device_mode == INACTIVE && usb_is_connected())
+        power_restart();
+}
+
+// Keep the main tick starting a fixed time before the next USB frame, so the
+// report is built just in time instead of waiting up to a frame in the
+// endpoint. Applies to both HID and XInput since they share the tick.
+static void sof_phase_lock()
+{
+    int16_t target = config_get_sof_lead();
+    if (!target || !usb_sof_is_active())
+    {
+        sof_lead = 0;
+        return;
+    }
+    // Use the planned start of the tick, not the actual wake up, to avoid
+    // feeding the interrupt latency jitter into the loop.
+    SchedTask *task = sched_get_task(main_task);
+    uint32_t tick = (uint32_t)task->deadline;
+    int32_t phase = (int32_t)(tick - usb_get_sof_timestamp()) % USB_FRAME_US;
+    if (phase < 0)
+        phase += USB_FRAME_US;
+    sof_lead = USB_FRAME_US - phase;
+    // Positive error means the tick is too early.
+    int32_t error = sof_lead - target;
+    if (error > USB_FRAME_US / 2)
+        error -= USB_FRAME_US;
+    if (error < -USB_FRAME_US / 2)
+        error += USB_FRAME_US;
+    if (!error)
+        return;
+    int32_t step = error / LOOP_SOF_LOCK_GAIN;
+    if (!step)
+        step = sign(error);
+    step = constrain(step, -LOOP_SOF_LOCK_MAX_STEP, LOOP_SOF_LOCK_MAX_STEP);
+    sched_shift(main_task, step);
+}
+
+static void wake_main_task()
+{
+    sched_wake(main_task);
+}
+
+static void set_idle(bool value)
+{
+    if (idle == value)
+        return;
+    debug("LOOP: Idle %s\n", value ? "on" : "off");
+    idle = value;
+    uint32_t interval = value ? CFG_IDLE_TICK_INTERVAL_IN_US : CFG_TICK_INTERVAL_IN_US;
+    sched_set_period(main_task, interval);
+    button_set_idle(value, wake_main_task);
+    rotary_set_idle(value, wake_main_task);
+#if CFG_DUAL_CORE
+    sensors_set_idle(value, wake_main_task);
+#endif
+}
+
+// Lower the tick rate when there are no inputs for a while, to save battery
+// in wireless mode. Any reported input restores the full rate. Without core1
+// the IMU and touch are naturally throttled too, since they are sampled by the
+// tick itself.
+static void idle_update()
+{
+    uint64_t now = time_us_64();
+    if (device_mode != WIRELESS || profile_get_reported_inputs())
+    {
+        last_input_ts = now;
+        set_idle(false);
+    }
+    else if (now - last_input_ts > CFG_IDLE_TIMEOUT * 1000000)
+    {
+        set_idle(true);
+    }
+}
+
+// Service the USB stack between ticks, so the pending reports are sent as
+// soon as their endpoint completes (see hid.c), and WebUSB does not depend on
+// the tick.
+static void usb_pump()
+{
+    if (device_mode != WIRED)
+        return;
+    tud_task();
+    if (tud_ready())
+    {
+        webusb_read();
+        webusb_flush();
+    }
+}
+
+static void stats()
+{
+    if (logging_get_level() < LOG_DEBUG)
+        return;
+    sched_log_stats();
+    sensors_log_stats();
+    profiler_log_latency();
+    hid_log_stats();
+    wireless_log_stats();
+    if (sof_lead)
+        info("SOF: lead=%i target=%i\n", sof_lead, config_get_sof_lead());
+}
+
 void loop_controller_init()
 {
     led_init();
@@ -188,6 +311,7 @@ void loop_controller_init()
     title(LABEL_CONTROLLER);
     config_init();
     tusb_init();
+    tud_sof_cb_enable(true); // Start-of-frame interrupt, for the phase lock.
 #if DEVICE_ALPAKKA_V0 == 2
     bool usb = usb_wait_for_init(-1);
 #else
@@ -200,6 +324,10 @@ void loop_controller_init()
     touch_init();
     rotary_init();
     imu_init();
+    profiler_init();
+#if CFG_DUAL_CORE
+    sensors_init();
+#endif
     profile_init();
     power_gpio_init();
     wireless_init();
@@ -210,6 +338,16 @@ void loop_controller_init()
         set_wireless();
 #endif
     }
+    sched_init();
+    main_task = sched_add("main", loop_controller_task, CFG_TICK_INTERVAL_IN_US);
+    sched_add("nvm", config_sync, NVM_SYNC_INTERVAL_IN_US);
+    sched_add("uart", uart_listen_serial, UART_LISTEN_INTERVAL_IN_US);
+    sched_add("usb", usb_check, LOOP_USB_CHECK_INTERVAL_IN_US);
+    sched_add("pump", usb_pump, LOOP_USB_PUMP_INTERVAL_IN_US);
+#ifdef DEVICE_ALPAKKA_V1
+    sched_add("led", board_led, LOOP_BOARD_LED_INTERVAL_IN_US);
+#endif
+    sched_add("stats", stats, LOOP_STATS_INTERVAL_IN_US);
     loop_run();
 }
 
@@ -229,22 +367,38 @@ void loop_dongle_init()
     wireless_init();
     set_wireless(); // Dongle is always in wireless mode.
     led_board_set(true);
+    sched_init();
+    main_task = sched_add("main", loop_dongle_task, CFG_TICK_INTERVAL_IN_US);
+    // Dispatch the received frames as soon as each burst ends.
+    uart_rx_set_idle_callback(wake_main_task);
+    sched_add("nvm", config_sync, NVM_SYNC_INTERVAL_IN_US);
+    sched_add("uart", uart_listen_serial, UART_LISTEN_INTERVAL_IN_US);
+    sched_add("usb", dongle_usb_check, USB_DONGLE_CHECK_US);
+    sched_add("stats", stats, LOOP_STATS_INTERVAL_IN_US);
     loop_run();
 }
 
 void loop_controller_task()
 {
-    // Write flash if needed.
-    config_sync();
+    uint32_t tick_start = profiler_start();
+    // Deferred actions that are due.
+    hid_apply_events();
     // Gather values for input sources.
+    uint32_t start = profiler_start();
     profile_report_active();
+    macro_report();
+    profiler_stop(PROFILER_PROFILE, start);
+    idle_update();
     // Report to the correct channel.
     if (device_mode == WIRED)
     {
         static uint64_t last_report_ts = 0;
         uint64_t now = time_us_64();
         // Report to USB.
+        start = profiler_start();
         bool reported = hid_report_wired();
+        profiler_stop(PROFILER_HID_REPORT, start);
+        sof_phase_lock();
         if (reported)
         {
             last_report_ts = now;
@@ -266,25 +420,14 @@ void loop_controller_task()
     if (device_mode == WIRELESS)
     {
         wireless_controller_task();
-        // Switch to wired if USB is connected (check once per second).
-        static uint16_t i = 0;
-        i++;
-        if ((!(i % CFG_TICK_FREQUENCY)) && usb_is_connected())
-            set_wired();
     }
-    // Listen to UART commands.
-    uart_listen_serial();
-    // Update state of board LED.
-    board_led();
+    profiler_stop(PROFILER_TICK, tick_start);
 }
 
 void loop_dongle_task()
 {
-    static uint32_t last = 0;
-    uint32_t now = time_us_32();
     if (device_mode == WIRELESS)
     {
-        config_sync();
         wireless_dongle_task();
         tud_task();
         if (tud_ready())
@@ -292,22 +435,6 @@ void loop_dongle_task()
             webusb_read();
             webusb_flush();
         }
-        uart_listen_serial();
-        if (now > (last + USB_DONGLE_CHECK_US))
-        {
-            last = time_us_32();
-            if (!usb_is_connected())
-                set_inactive();
-        }
-    }
-    if (device_mode == INACTIVE)
-    {
-        if (now > (last + USB_DONGLE_CHECK_US))
-        {
-            last = time_us_32();
-            if (usb_is_connected())
-                power_restart();
-        }
     }
 }
 
@@ -323,44 +450,7 @@ void loop_llama_init()
 void loop_run()
 {
     info("LOOP: Main loop start\n");
-    uint16_t i = 0;
     logging_set_onloop(true);
-    while (true)
-    {
-        i++;
-        // Start timer.
-        uint32_t start = time_us_32();
-// Task.
-#if defined DEVICE_ALPAKKA_V0 || defined DEVICE_ALPAKKA_V1
-        loop_controller_task();
-#endif
-#ifdef DEVICE_DONGLE
-        loop_dongle_task();
-#endif
-        // Calculate used time.
-        uint32_t used = time_us_32() - start;
-        int32_t unused = CFG_TICK_INTERVAL_IN_US - (int32_t)used;
-        // Timing stats.
-        if (logging_get_level() >= LOG_DEBUG)
-        {
-            static float average = 0;
-            static float max = 0;
-            average += used;
-            if (used > max)
-                max = used;
-            if (!(i % CFG_TICK_FREQUENCY))
-            {
-                info("Loop: avg=%.0f max=%.0f\n", average / 1000, max);
-                average = max = 0;
-            }
-        }
-        // Idling control.
-        if (unused > 0)
-            sleep_us((uint32_t)unused);
-        else
-        {
-            info("+");
-            sleep_us(0); // Allow IRQ to take over even if the controller is overwhelmed.
-        };
-    }
+    // Periodic tasks are registered by the init functions.
+    sched_run();
 }
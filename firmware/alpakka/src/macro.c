@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Macros are executed by the main tick, each running macro only keeps a small
+cursor (see Macro struct) into its sequence, which is read directly from the
+active profile. Several macros can run at the same time, each one with its
+own timeline.
+
+A sequence is a list of actions, each one is tapped (pressed, held for the
+hold time, released, and followed by the gap time). Some special values take
+one extra byte as argument, to control the timing or to extend the sequence:
+
+    MACRO_DELAY n  Wait n milliseconds.
+    MACRO_HOLD n   Following taps are held for n milliseconds.
+    MACRO_GAP n    Following taps are followed by n milliseconds.
+    MACRO_DOWN n   Press action n, until MACRO_UP n or the macro ends.
+    MACRO_UP n     Release action n.
+    MACRO_CHAIN n  Continue with the sequence of macro n.
+
+The timestamp of each step is derived from the previous step (and not from
+the tick that executed it), so the timings do not drift. Press and release of
+the same tap never happen in the same tick, otherwise the tap would not reach
+any report.
+*/
+
+#include <stdio.h>
+#include "macro.h"
+#include "hal.h"
+#include "ctrl.h"
+#include "config.h"
+#include "profile.h"
+#include "hid.h"
+#include "common.h"
+#include "logging.h"
+
+static Macro macros[MACRO_SLOTS] = {0,};
+static uint8_t active = 0;
+
+static uint8_t *macro_get_sequence(uint8_t index) {
+    uint8_t section = SECTION_MACRO_1 + ((index - 1) / 2);
+    uint8_t subindex = (index - 1) % 2;
+    CtrlProfile *profile = config_profile_read(profile_get_active_index(false));
+    return profile->sections[section].macro.macro[subindex];
+}
+
+static bool macro_is_valid(uint8_t index) {
+    return index >= 1 && index <= (PROC_MACRO_8 - PROC_MACRO_1 + 1);
+}
+
+// Actions pressed by MACRO_DOWN are tracked, so the ones not released by the
+// sequence itself (ended early, or never released) do not get stuck.
+static void macro_down(Macro *self, uint8_t action) {
+    if (self->down_len == MACRO_DOWN_MAX) {
+        warn("Macro: Too many actions down in macro %i\n", self->index);
+        return;
+    }
+    hid_press(action);
+    self->down[self->down_len++] = action;
+}
+
+static void macro_up(Macro *self, uint8_t action) {
+    hid_release(action);
+    for(uint8_t i=0; i<self->down_len; i++) {
+        if (self->down[i] != action) continue;
+        self->down[i] = self->down[--self->down_len];
+        return;
+    }
+}
+
+static void macro_stop(Macro *self) {
+    if (self->key) hid_release(self->key);
+    for(uint8_t i=0; i<self->down_len; i++) hid_release(self->down[i]);
+    self->down_len = 0;
+    self->index = 0;
+    active--;
+}
+
+// Run all the steps that are due, returns after any tap edge.
+static void macro_run(Macro *self, uint32_t now) {
+    while(self->index && (int32_t)(now - self->at) >= 0) {
+        hid_set_input_timestamp(self->at);  // The step was due at that time.
+        // Release the current tap.
+        if (self->key) {
+            hid_release(self->key);
+            self->key = 0;
+            self->at += self->gap * 1000;
+            return;
+        }
+        // End of the sequence.
+        uint8_t *sequence = macro_get_sequence(self->index);
+        if (self->step >= MACRO_LEN || sequence[self->step] == 0) {
+            macro_stop(self);
+            return;
+        }
+        uint8_t action = sequence[self->step];
+        if (action < MACRO_INDEX) {
+            hid_press(action);
+            self->key = action;
+            self->at += self->hold * 1000;
+            self->step += 1;
+            return;
+        }
+        // Special values with argument.
+        uint8_t arg = (self->step + 1 < MACRO_LEN) ? sequence[self->step + 1] : 0;
+        self->step += 2;
+        if (action == MACRO_DELAY) self->at += arg * 1000;
+        if (action == MACRO_HOLD) self->hold = max(arg, 1);
+        if (action == MACRO_GAP) self->gap = max(arg, 1);
+        if (action == MACRO_DOWN) macro_down(self, arg);
+        if (action == MACRO_UP) macro_up(self, arg);
+        if (action == MACRO_CHAIN) {
+            if (!macro_is_valid(arg) || self->chains == MACRO_CHAIN_MAX) {
+                macro_stop(self);
+                return;
+            }
+            self->index = arg;
+            self->step = 0;
+            self->chains++;
+        }
+    }
+}
+
+// Triggering a macro that is already running has no effect.
+void macro_start(uint8_t index) {
+    if (!macro_is_valid(index)) return;
+    Macro *slot = NULL;
+    for(uint8_t i=0; i<MACRO_SLOTS; i++) {
+        if (macros[i].index == index) return;
+        if (!macros[i].index && !slot) slot = &macros[i];
+    }
+    if (!slot) {
+        warn("Macro: No free slot for macro %i\n", index);
+        return;
+    }
+    *slot = (Macro){
+        .at = hal_time_us_32(),
+        .index = index,
+        .hold = MACRO_HOLD_DEFAULT,
+        .gap = MACRO_GAP_DEFAULT,
+    };
+    active++;
+}
+
+void macro_report() {
+    if (!active) return;
+    uint32_t now = hal_time_us_32();
+    for(uint8_t i=0; i<MACRO_SLOTS; i++) {
+        macro_run(&macros[i], now);
+    }
+    // Keep the device awake while macros are running.
+    profile_set_reported_inputs(true);
+}
+
+// Stop all macros, the pending taps and the actions down are released.
+void macro_reset() {
+    for(uint8_t i=0; i<MACRO_SLOTS; i++) {
+        if (macros[i].index) macro_stop(&macros[i]);
+    }
+}
@@ -3,14 +3,20 @@
 
 #include <hardware/flash.h>
 #include <hardware/sync.h>
+#include <pico/multicore.h>
 #include "common.h"
 #include "nvm.h"
+#include "sensors.h"
 
 void nvm_write(uint32_t addr, uint8_t* buffer, uint32_t size) {
+    // Core1 executes from flash too, so it must be parked during the write.
+    bool lockout = sensors_is_running();
+    if (lockout) multicore_lockout_start_blocking();
     uint32_t interrupts = save_and_disable_interrupts();
     flash_range_erase(addr, max(size, 4096));
     flash_range_program(addr, (const uint8_t*)buffer, size);
     restore_interrupts(interrupts);
+    if (lockout) multicore_lockout_end_blocking();
 }
 
 void nvm_read(uint32_t addr, uint8_t* buffer, uint32_t size) {
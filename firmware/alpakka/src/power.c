@@ -12,6 +12,7 @@
 #include "led.h"
 #include "esp.h"
 #include "imu.h"
+#include "sensors.h"
 #include "loop.h"
 #include "logging.h"
 
@@ -48,7 +49,8 @@ void power_dc_power_save(bool value) {
 }
 
 void power_dormant() {
-    // Turn off ESP and IMUs.
+    // Stop core1 acquisition, then turn off ESP and IMUs.
+    sensors_pause();
     power_dc_power_save(true);
     esp_enable(false);
     imu_power_off();
@@ -2,7 +2,6 @@
 // Copyright (C) 2022, Input Labs Oy.
 
 #include <stdio.h>
-#include <pico/time.h>
 #include <string.h>
 #include "config.h"
 #include "profile.h"
@@ -16,6 +15,12 @@
 #include "common.h"
 #include "power.h"
 #include "wireless.h"
+#include "sensors.h"
+#include "profiler.h"
+#include "hal.h"
+#include "macro.h"
+#include "loop.h"
+#include "tusb_config.h"
 
 Profile profiles[PROFILE_SLOTS];
 uint8_t profile_active_index = -1;
@@ -41,7 +46,10 @@ void Profile__report(Profile *self)
 {
     if (!enabled_all)
         return;
+    uint32_t start = profiler_start();
+    sensors_sync();
     bus_i2c_io_cache_update();
+    hid_set_input_timestamp(sensors_get_timestamp());
     home.report(&home);
     if (enabled_abxy)
     {
@@ -65,13 +73,19 @@ void Profile__report(Profile *self)
     self->l4.report(&self->l4);
     self->r4.report(&self->r4);
     self->rotary.report(&self->rotary);
+    profiler_stop(PROFILER_BUTTONS, start);
+    start = profiler_start();
+    hid_set_input_timestamp(sensors_get_timestamp());
     self->left_thumbstick.report(&self->left_thumbstick);
 #if DEVICE_ALPAKKA_V0 == 1
     self->dhat.report(&self->dhat);
 #elif defined DEVICE_ALPAKKA_V1 || DEVICE_ALPAKKA_V0 == 2
     self->right_thumbstick.report(&self->right_thumbstick);
 #endif
+    profiler_stop(PROFILER_THUMBSTICKS, start);
+    start = profiler_start();
     self->gyro.report(&self->gyro);
+    profiler_stop(PROFILER_GYRO, start);
 }
 
 void Profile__reset(Profile *self)
@@ -154,6 +168,11 @@ void Profile__load_from_config(Profile *self, CtrlProfile *profile)
     self->gyro = Gyro_(
         ctrl_gyro.mode,
         ctrl_gyro.engage);
+    // Zero (the padding of older profiles) is the default.
+    if (ctrl_gyro.axis_mix <= HID_AXIS_MIX_PRIORITY)
+        self->axis_mix = ctrl_gyro.axis_mix;
+    else
+        self->axis_mix = HID_AXIS_MIX_DEFAULT;
     self->gyro.config_x(
         &(self->gyro),
         (int8_t)ctrl_gyro_x.angle_min,
@@ -180,6 +199,7 @@ Profile Profile_()
     profile.report = Profile__report;
     profile.reset = Profile__reset;
     profile.load_from_config = Profile__load_from_config;
+    profile.axis_mix = HID_AXIS_MIX_DEFAULT;
     return profile;
 }
 
@@ -260,6 +280,8 @@ void profile_update_leds()
 
 void profile_reset_all()
 {
+    // Stop running macros.
+    macro_reset();
     // Reset HID state matrix. Optionally keep certain actions.
     hid_matrix_reset(pending_reset_keep);
     // Reset all profiles runtimes.
@@ -275,7 +297,7 @@ void profile_check_home_sleep()
     if (home_is_active && hold_home_to_sleep_ts)
     {
         uint64_t threshold = hold_home_to_sleep_ts + (CFG_HOME_SLEEP_TIME * 1000);
-        if (time_us_64() > threshold)
+        if (hal_time_us() > threshold)
         {
             info("Dormant mode requested by long press home\n");
             power_dormant();
@@ -296,15 +318,22 @@ void profile_report_active()
 #ifdef DEVICE_ALPAKKA_V1
         // Notify dongle so it syncs on the same protocol.
         wireless_send_usb_protocol(profile_protocol_was_changed);
-        sleep_ms(10); // Enough time for wireless packet to be sent.
 #endif
-        power_restart();
+        // Only wait for the host if it is the one being reported to.
+        bool wired = loop_get_device_mode() == WIRED;
+        usb_reenumerate(wired ? USB_WAIT_FOR_INIT_MS : 0);
+        profile_protocol_was_changed = PROTOCOL_UNDEFINED;
+        hid_set_allow_communication(true);
     }
     // Reset all profiles (state) if needed.
     if (pending_reset)
         profile_reset_all();
     // Report active profile.
     Profile *profile = profile_get_active(false);
+    // Set every time, since the active profile may change in many ways (home,
+    // profile selection, or a new configuration from the app).
+    for (GamepadAxis axis = LX; axis <= RZ; axis++)
+        hid_gamepad_axis_set_mix(axis, profile->axis_mix);
     profile_reported_inputs = false;
     profile->report(profile);
     profile_check_home_sleep();
@@ -313,7 +342,7 @@ void profile_report_active()
 void profile_reset_home_sleep(bool now)
 {
     if (now)
-        hold_home_to_sleep_ts = time_us_64();
+        hold_home_to_sleep_ts = hal_time_us();
     else
         hold_home_to_sleep_ts = 0;
 }
@@ -408,6 +437,11 @@ void profile_set_reported_inputs(bool value)
     profile_reported_inputs = value;
 }
 
+bool profile_get_reported_inputs()
+{
+    return profile_reported_inputs;
+}
+
 void profile_enable_all(bool value)
 {
     enabled_all = value;
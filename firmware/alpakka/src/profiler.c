@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Per-stage profiler of the main tick.
+
+Every instrumented stage is measured in CPU cycles using the SysTick counter
+of core0, and each measurement increments one bucket of a log2 histogram
+(bucket N counts the durations between 2^N and 2^(N+1)-1 cycles). The
+histograms can be fetched and reset by the app with the PROFILER_GET message,
+so it is possible to find which stage is blowing the tick budget without a
+debugger attached.
+
+The latency stages use the same histograms, but they record the age of the
+inputs (in microseconds, since the input was sampled) at the moment the report
+that contains them is sent, one stage per report class (see hid.c).
+
+Buckets saturate instead of wrapping around.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "profiler.h"
+#include "hal.h"
+#include "common.h"
+#include "logging.h"
+
+static ProfilerHistogram histograms[PROFILER_STAGES];
+
+uint32_t profiler_start() {
+    return hal_cycles();
+}
+
+void profiler_stop(ProfilerStage stage, uint32_t start) {
+    // SysTick counts down.
+    uint32_t cycles = (start - hal_cycles()) & PROFILER_COUNTER_MASK;
+    profiler_record(stage, cycles);
+}
+
+void profiler_record(ProfilerStage stage, uint32_t value) {
+    uint8_t bucket = min(31 - __builtin_clz(value | 1), PROFILER_BUCKETS - 1);
+    ProfilerHistogram *histogram = &histograms[stage];
+    if (histogram->buckets[bucket] < UINT16_MAX) histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->max = max(histogram->max, value);
+}
+
+ProfilerHistogram *profiler_get(ProfilerStage stage) {
+    return &histograms[stage];
+}
+
+void profiler_reset(ProfilerStage stage) {
+    memset(&histograms[stage], 0, sizeof(ProfilerHistogram));
+}
+
+// Upper bound of the bucket that contains the given percentile.
+static uint32_t profiler_percentile(ProfilerHistogram *histogram, uint8_t percent) {
+    uint32_t target = ((uint64_t)histogram->count * percent) / 100;
+    uint32_t accumulated = 0;
+    for(uint8_t i=0; i<PROFILER_BUCKETS; i++) {
+        accumulated += histogram->buckets[i];
+        if (accumulated > target) return (1 << (i + 1)) - 1;
+    }
+    return histogram->max;
+}
+
+void profiler_log_latency() {
+    static const char *names[] = {"keyboard", "mouse", "gamepad"};
+    for(uint8_t i=0; i<3; i++) {
+        ProfilerHistogram *histogram = &histograms[PROFILER_LATENCY_KEYBOARD + i];
+        if (!histogram->count) continue;
+        info(
+            "Latency: %s n=%lu p50<%lu p99<%lu max=%lu\n",
+            names[i],
+            histogram->count,
+            profiler_percentile(histogram, 50),
+            profiler_percentile(histogram, 99),
+            histogram->max
+        );
+    }
+}
+
+void profiler_init() {
+    info("INIT: Profiler\n");
+    hal_cycles_init(PROFILER_COUNTER_MASK);
+}
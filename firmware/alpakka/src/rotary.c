@@ -4,15 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pico/time.h>
-#include <hardware/gpio.h>
 #include "config.h"
 #include "pin.h"
 #include "profile.h"
 #include "button.h"
 #include "rotary.h"
+#include "hal.h"
 #include "hid.h"
 #include "logging.h"
+#include "common.h"
+
+static volatile RotaryCallback idle_wake = NULL;
+static volatile bool last_a = true;  // Level of A after the last counted edge.
 
 void rotary_set_mode(uint8_t value) {
     Profile* profile = profile_get_active(false);
@@ -20,46 +23,104 @@ void rotary_set_mode(uint8_t value) {
     rotary->mode = value;
 }
 
+// Every edge of A is a detent (in the direction given by B), these accumulate
+// until reported, so a fast spin is not reduced to a single detent. Only the
+// edges that change A from the last counted level count, so the contact bounce
+// that is serviced once A has settled is ignored, and a bounce edge counted
+// while A still bounces is undone by the edge back (with the same B, so in the
+// other direction).
 void rotary_callback(uint gpio, uint32_t events) {
     Profile* profile = profile_get_active(false);
     Rotary* rotary = &(profile->rotary);
-    rotary->timestamp = time_us_32();
-    rotary->increment = gpio_get(PIN_ROTARY_A) ^ gpio_get(PIN_ROTARY_B) ? -1 : 1;
+    bool a = hal_gpio_get(PIN_ROTARY_A);
+    bool b = hal_gpio_get(PIN_ROTARY_B);
+    if (a == last_a) return;
+    last_a = a;
+    int8_t increment = a ^ b ? -1 : 1;
+    rotary->timestamp = hal_time_us_32();
+    rotary->increment = constrain(rotary->increment + increment, -BIT_15, BIT_15);
     rotary->pending = true;
+    RotaryCallback wake = idle_wake;
+    if (wake) wake();
+}
+
+// While idle, a detent wakes the main task right away, like the buttons.
+void rotary_set_idle(bool value, RotaryCallback wake) {
+    idle_wake = value ? wake : NULL;
 }
 
 void rotary_init() {
     info("INIT: Rotary\n");
-    gpio_init(PIN_ROTARY_A);
-    gpio_init(PIN_ROTARY_B);
-    gpio_set_dir(PIN_ROTARY_A, GPIO_IN);
-    gpio_set_dir(PIN_ROTARY_B, GPIO_IN);
-    gpio_pull_up(PIN_ROTARY_A);
-    gpio_pull_up(PIN_ROTARY_B);
-    gpio_set_irq_enabled_with_callback(
+    hal_gpio_init_input(PIN_ROTARY_A, true);
+    hal_gpio_init_input(PIN_ROTARY_B, true);
+    last_a = hal_gpio_get(PIN_ROTARY_A);
+    hal_gpio_irq_callback(
         PIN_ROTARY_A,
-        0b1100,
-        true,
+        HAL_GPIO_EDGE_FALL | HAL_GPIO_EDGE_RISE,
         rotary_callback
     );
 }
 
+static bool rotary_is_scroll(uint8_t *actions) {
+    for(uint8_t i=0; i<ACTIONS_LEN; i++) {
+        if (actions[i] == 0) break;
+        if (actions[i] != MOUSE_SCROLL_UP && actions[i] != MOUSE_SCROLL_DOWN) return false;
+    }
+    return true;
+}
+
+// Scroll actions get all the detents as a single scroll. Other actions are
+// tapped once per detent, ROTARY_TAP_INTERVAL apart so the host sees every
+// tap, and at most ROTARY_TAPS_MAX at once. Returns the detents used.
+static uint16_t rotary_press_detents(uint8_t *actions, uint16_t detents) {
+    if (actions[0] == KEY_NONE) return detents;
+    if (rotary_is_scroll(actions)) {
+        int16_t scroll = constrain(detents * HID_SCROLL_RESOLUTION, 0, BIT_15);
+        hid_mouse_scroll(actions[0] == MOUSE_SCROLL_UP ? scroll : -scroll, 0);
+        profile_set_reported_inputs(true);
+        return detents;
+    }
+    detents = min(detents, ROTARY_TAPS_MAX);
+    hid_press_multiple(actions);
+    hid_release_multiple_later(actions, ROTARY_TAP_DURATION);
+    for(uint16_t detent=1; detent<detents; detent++) {
+        hid_press_multiple_later(actions, detent * ROTARY_TAP_INTERVAL);
+        hid_release_multiple_later(actions, detent * ROTARY_TAP_INTERVAL + ROTARY_TAP_DURATION);
+    }
+    return detents;
+}
+
 void Rotary__report(Rotary *self) {
+    uint32_t now = hal_time_us_32();
     if (
         self->pending &&
-        (time_us_32() > (self->timestamp + CFG_MOUSE_WHEEL_DEBOUNCE))
+        (now > (self->timestamp + CFG_MOUSE_WHEEL_DEBOUNCE)) &&
+        (now - self->taps_start >= self->taps_duration)
     ) {
-        for(uint8_t rotated=0; rotated<abs(self->increment); rotated++) {
-            uint8_t *actions = (
-                self->increment > 0 ?
-                self->actions[self->mode][ROTARY_UP] :
-                self->actions[self->mode][ROTARY_DOWN]
-            );
-            hid_press_multiple(actions);
-            hid_release_multiple_later(actions, 10);
-        }
+        // Taken at once, the callback may add detents meanwhile.
+        uint32_t status = hal_irq_save();
+        int16_t increment = self->increment;
         self->increment = 0;
         self->pending = false;
+        hal_irq_restore(status);
+        hid_set_input_timestamp(self->timestamp);
+        uint8_t *actions = (
+            increment > 0 ?
+            self->actions[self->mode][ROTARY_UP] :
+            self->actions[self->mode][ROTARY_DOWN]
+        );
+        uint16_t detents = abs(increment);
+        uint16_t used = rotary_press_detents(actions, detents);
+        if (used < detents) {
+            // The rest once these taps are done.
+            self->taps_start = now;
+            self->taps_duration = used * ROTARY_TAP_INTERVAL * 1000;
+            status = hal_irq_save();
+            int16_t left = increment > 0 ? detents - used : used - detents;
+            self->increment = constrain(self->increment + left, -BIT_15, BIT_15);
+            self->pending = true;
+            hal_irq_restore(status);
+        }
     }
 }
 
@@ -67,6 +128,8 @@ void Rotary__reset(Rotary *self) {
     self->pending = false;
     self->increment = 0;
     self->timestamp = 0;
+    self->taps_start = 0;
+    self->taps_duration = 0;
     // self->mode = 0;
 }
 
@@ -89,5 +152,7 @@ Rotary Rotary_ () {
     rotary.mode = 0;
     rotary.increment = 0;
     rotary.timestamp = 0;
+    rotary.taps_start = 0;
+    rotary.taps_duration = 0;
     return rotary;
 }
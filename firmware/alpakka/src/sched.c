@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Deadline scheduler for the main loop.
+
+Each task has its own period and an absolute deadline (microseconds since
+boot). The scheduler sleeps until the earliest deadline using a dedicated
+hardware alarm, runs every task that is due (in the order they were added),
+and then advances each deadline by exactly one period. Since deadlines are
+never derived from "now", the sleep overshoot or the time used by the tasks
+does not accumulate as drift, and the report cadence stays locked.
+
+If a task finishes after its next deadline, the skipped periods are counted
+as missed and the deadline jumps forward by whole periods, so the task keeps
+its original phase instead of trying to catch up with a burst of runs.
+
+A task can also be woken up early (eg: from the other core on input activity),
+in which case it runs immediately and continues its period from there.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pico/stdlib.h>
+#include <pico/time.h>
+#include <hardware/timer.h>
+#include "sched.h"
+#include "common.h"
+#include "logging.h"
+
+static SchedTask tasks[SCHED_MAX_TASKS];
+static uint8_t tasks_len = 0;
+static int8_t alarm_num = -1;
+static volatile bool alarm_fired = false;
+static volatile bool wake_pending = false;
+
+static void sched_alarm_callback(uint alarm) {
+    alarm_fired = true;
+}
+
+static void sched_wait_until(uint64_t deadline) {
+    alarm_fired = false;
+    // The alarm reports true if the target is already in the past.
+    if (hardware_alarm_set_target(alarm_num, from_us_since_boot(deadline))) return;
+    // Any other interrupt also wakes the core, so check the flags again.
+    while(!alarm_fired && !wake_pending) __wfe();
+}
+
+static void sched_task_run(SchedTask *task) {
+    uint64_t start = time_us_64();
+    task->callback();
+    uint64_t now = time_us_64();
+    uint32_t used = now - start;
+    task->runs++;
+    task->used_total += used;
+    task->used_max = max(task->used_max, used);
+    task->deadline += task->period;
+    if (now >= task->deadline) {
+        uint32_t late = ((now - task->deadline) / task->period) + 1;
+        task->missed += late;
+        task->deadline += (uint64_t)late * task->period;
+    }
+}
+
+uint8_t sched_add(const char *name, SchedCallback callback, uint32_t period) {
+    if (tasks_len == SCHED_MAX_TASKS) {
+        error("SCHED: Too many tasks\n");
+        exit(1);
+    }
+    tasks[tasks_len] = (SchedTask){
+        .name = name,
+        .callback = callback,
+        .period = period,
+        .deadline = time_us_64() + period,
+    };
+    return tasks_len++;
+}
+
+SchedTask *sched_get_task(uint8_t index) {
+    return &tasks[index];
+}
+
+// Move the current deadline of a task, to adjust its phase.
+void sched_shift(uint8_t index, int32_t delta) {
+    tasks[index].deadline += delta;
+}
+
+// The next deadline is kept, unless the new period would run earlier.
+void sched_set_period(uint8_t index, uint32_t period) {
+    SchedTask *task = &tasks[index];
+    task->period = period;
+    task->deadline = min(task->deadline, time_us_64() + period);
+}
+
+// Safe to call from interrupts or from the other core.
+void sched_wake(uint8_t index) {
+    tasks[index].wake = true;
+    wake_pending = true;
+    __sev();
+}
+
+uint32_t sched_get_missed(uint8_t index) {
+    return tasks[index].missed;
+}
+
+void sched_log_stats() {
+    for(uint8_t i=0; i<tasks_len; i++) {
+        SchedTask *task = &tasks[i];
+        uint32_t average = task->runs ? task->used_total / task->runs : 0;
+        info(
+            "Sched: %s runs=%lu avg=%lu max=%lu missed=%lu\n",
+            task->name, task->runs, average, task->used_max, task->missed
+        );
+        task->runs = 0;
+        task->used_total = 0;
+        task->used_max = 0;
+    }
+}
+
+void sched_run() {
+    info("SCHED: Main loop start\n");
+    // Align the first deadline of every task to the same origin.
+    uint64_t origin = time_us_64();
+    for(uint8_t i=0; i<tasks_len; i++) {
+        tasks[i].deadline = origin + tasks[i].period;
+    }
+    while (true) {
+        uint64_t next = tasks[0].deadline;
+        for(uint8_t i=1; i<tasks_len; i++) {
+            next = min(next, tasks[i].deadline);
+        }
+        sched_wait_until(next);
+        uint64_t now = time_us_64();
+        if (wake_pending) {
+            wake_pending = false;
+            for(uint8_t i=0; i<tasks_len; i++) {
+                if (!tasks[i].wake) continue;
+                tasks[i].wake = false;
+                tasks[i].deadline = now;
+            }
+        }
+        for(uint8_t i=0; i<tasks_len; i++) {
+            if (now >= tasks[i].deadline) sched_task_run(&tasks[i]);
+        }
+    }
+}
+
+void sched_init() {
+    info("INIT: Scheduler\n");
+    alarm_num = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(alarm_num, sched_alarm_callback);
+}
@@ -8,6 +8,7 @@
 #include "uart.h"
 #include "logging.h"
 #include "common.h"
+#include "sensors.h"
 
 void self_test_button_press(const char *buttonName, Button *button)
 {
@@ -15,6 +16,7 @@ void self_test_button_press(const char *buttonName, Button *button)
     while (!button->is_pressed(button))
     {
         uart_listen_serial_limited();
+        sensors_sync();
         bus_i2c_io_cache_update();
         sleep_ms(1);
     }
@@ -78,6 +80,7 @@ void self_test_dhat_press(Dhat *dhat, const char *buttonName, Button *button)
     while (!button->is_pressed(button))
     {
         uart_listen_serial_limited();
+        sensors_sync();
         bus_i2c_io_cache_update();
         dhat->update(dhat);
         sleep_ms(1);
@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Sensor acquisition on the second core.
+
+When enabled, core1 runs a continuous acquisition cycle reading every input
+source that requires bus or timing work: thumbstick ADC channels, both IO
+expanders (I2C), the IMUs (SPI) and the touch surface (charge timing). Core0
+then only runs the profile logic and the reporting, reading the values from a
+snapshot instead of from the hardware.
+
+Each cycle is published through a double buffer: core1 always writes into the
+back buffer and then flips the front index. Every buffer carries a sequence
+counter (odd while being written), so core0 can copy the front buffer without
+locks and simply retry in the rare case core1 lapped it during the copy.
+
+Core0 calls "sensors_sync()" once per tick, so all the consumers within the
+same tick see the same coherent snapshot.
+
+While idle (see "sensors_set_idle()") the buttons and thumbsticks are still
+polled at a high rate, but the IMU and touch are only sampled every few
+milliseconds and core1 sleeps between cycles. Any button edge or thumbstick
+movement calls the wake callback, so core0 can run the tick right away.
+
+Operations that need direct access to the buses (calibration, IMU setup,
+power off) must be wrapped by "sensors_pause()" and "sensors_resume()". While
+paused, the consumers fall back to reading the hardware directly. Flash writes
+use the multicore lockout, since core1 executes from flash too.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pico/stdlib.h>
+#include <pico/multicore.h>
+#include "sensors.h"
+#include "config.h"
+#include "pin.h"
+#include "bus.h"
+#include "imu.h"
+#include "touch.h"
+#include "thumbstick.h"
+#include "common.h"
+#include "logging.h"
+
+typedef struct SensorsBuffer_struct {
+    volatile uint32_t sequence;
+    SensorsSnapshot snapshot;
+} SensorsBuffer;
+
+static SensorsBuffer buffers[2];
+static volatile uint8_t front = 0;
+static SensorsSnapshot current;  // Core0 copy for the current tick.
+
+static volatile bool running = false;
+static volatile bool pause_requested = false;
+static volatile bool paused = false;
+static uint8_t pause_depth = 0;
+
+static volatile bool idle = false;
+static volatile SensorsCallback idle_wake = NULL;
+
+// Stats.
+static volatile uint32_t cycles = 0;
+static uint32_t syncs = 0;
+static uint32_t retries = 0;
+static uint64_t age_total = 0;
+static uint32_t age_max = 0;
+
+static const uint8_t adc_pins[] = {
+    PIN_THUMBSTICK_LX,
+    PIN_THUMBSTICK_LY,
+    #if defined DEVICE_ALPAKKA_V1 || DEVICE_ALPAKKA_V0 == 2
+        PIN_THUMBSTICK_RX,
+        PIN_THUMBSTICK_RY,
+    #endif
+};
+
+static void sensors_acquire_fast(SensorsSnapshot *snapshot) {
+    snapshot->timestamp = time_us_64();
+    for(uint8_t i=0; i<sizeof(adc_pins); i++) {
+        uint8_t pin = adc_pins[i];
+        snapshot->adc[pin - PIN_ADC_FIRST] = thumbstick_adc_raw(pin);
+    }
+    snapshot->io_0 = bus_i2c_read_two(I2C_IO_0, I2C_IO_REG_INPUT);
+    snapshot->io_1 = bus_i2c_read_two(I2C_IO_1, I2C_IO_REG_INPUT);
+}
+
+static void sensors_acquire_slow(SensorsSnapshot *snapshot) {
+    snapshot->gyro = imu_sample_gyro();
+    snapshot->accel = imu_sample_accel();
+    snapshot->touch_elapsed = touch_get_elapsed_multisample();
+}
+
+static void sensors_acquire(SensorsSnapshot *snapshot) {
+    sensors_acquire_fast(snapshot);
+    sensors_acquire_slow(snapshot);
+}
+
+// Compare with the snapshot from when the idle started.
+static bool sensors_is_activity(SensorsSnapshot *snapshot, SensorsSnapshot *reference) {
+    if (snapshot->io_0 != reference->io_0) return true;
+    if (snapshot->io_1 != reference->io_1) return true;
+    for(uint8_t i=0; i<SENSORS_ADC_CHANNELS; i++) {
+        int16_t delta = snapshot->adc[i] - reference->adc[i];
+        if (abs(delta) > SENSORS_IDLE_ADC_THRESHOLD) return true;
+    }
+    return false;
+}
+
+static void sensors_publish(SensorsSnapshot *snapshot) {
+    uint8_t back = !front;
+    buffers[back].sequence++;  // Odd, write in progress.
+    __dmb();
+    buffers[back].snapshot = *snapshot;
+    __dmb();
+    buffers[back].sequence++;  // Even, stable.
+    __dmb();
+    front = back;
+}
+
+static void sensors_core1_task() {
+    multicore_lockout_victim_init();
+    SensorsSnapshot snapshot = {0,};
+    SensorsSnapshot reference = {0,};
+    bool was_idle = false;
+    uint64_t slow_ts = 0;
+    while(true) {
+        if (pause_requested) {
+            paused = true;
+            while(pause_requested) tight_loop_contents();
+            paused = false;
+        }
+        snapshot.sequence++;
+        if (!idle) {
+            was_idle = false;
+            sensors_acquire(&snapshot);
+        } else {
+            if (!was_idle) {
+                was_idle = true;
+                reference = snapshot;
+            }
+            sensors_acquire_fast(&snapshot);
+            if (snapshot.timestamp - slow_ts >= SENSORS_IDLE_SLOW_INTERVAL_US) {
+                slow_ts = snapshot.timestamp;
+                sensors_acquire_slow(&snapshot);
+            }
+            if (sensors_is_activity(&snapshot, &reference)) {
+                // Only once per change, not on every cycle.
+                reference = snapshot;
+                SensorsCallback wake = idle_wake;
+                if (wake) wake();
+            }
+        }
+        sensors_publish(&snapshot);
+        cycles++;
+        if (idle) sleep_us(SENSORS_IDLE_INTERVAL_US);
+    }
+}
+
+void sensors_sync() {
+    if (!sensors_is_active()) return;
+    while(true) {
+        uint8_t index = front;
+        uint32_t sequence = buffers[index].sequence;
+        __dmb();
+        if (!(sequence & 1)) {
+            current = buffers[index].snapshot;
+            __dmb();
+            if (buffers[index].sequence == sequence) break;
+        }
+        retries++;
+    }
+    uint32_t age = time_us_64() - current.timestamp;
+    age_total += age;
+    age_max = max(age_max, age);
+    syncs++;
+}
+
+SensorsSnapshot *sensors_get() {
+    return &current;
+}
+
+// When the inputs of the current tick were sampled.
+uint64_t sensors_get_timestamp() {
+    if (!sensors_is_active()) return time_us_64();
+    return current.timestamp;
+}
+
+bool sensors_is_running() {
+    return running;
+}
+
+// Running and not paused, so the consumers must read from the snapshot.
+bool sensors_is_active() {
+    return running && !pause_depth;
+}
+
+void sensors_pause() {
+    if (!running) return;
+    pause_depth++;
+    if (pause_depth > 1) return;
+    pause_requested = true;
+    while(!paused) tight_loop_contents();
+}
+
+void sensors_resume() {
+    if (!running || !pause_depth) return;
+    pause_depth--;
+    if (pause_depth) return;
+    pause_requested = false;
+    while(paused) tight_loop_contents();
+    // Make sure the snapshot is not older than the pause.
+    uint32_t target = cycles + 2;
+    while((int32_t)(cycles - target) < 0) tight_loop_contents();
+}
+
+// While idle, core1 calls the wake callback on any input activity.
+void sensors_set_idle(bool value, SensorsCallback wake) {
+    idle_wake = wake;
+    idle = value;
+}
+
+void sensors_log_stats() {
+    if (!running) return;
+    static uint32_t last_ts = 0;
+    static uint32_t last_cycles = 0;
+    uint32_t now = time_us_32();
+    if ((now - last_ts) < (SENSORS_STATS_FREQUENCY * 1000)) return;
+    uint32_t rate = (cycles - last_cycles) * 1000000.0 / (now - last_ts);
+    uint32_t age_avg = syncs ? age_total / syncs : 0;
+    info(
+        "Sensors: rate=%lu age_avg=%lu age_max=%lu retries=%lu\n",
+        rate, age_avg, age_max, retries
+    );
+    last_ts = now;
+    last_cycles = cycles;
+    syncs = 0;
+    retries = 0;
+    age_total = 0;
+    age_max = 0;
+}
+
+void sensors_init() {
+    info("INIT: Sensors (core1)\n");
+    // Seed the first snapshot synchronously, so core0 never reads zeros.
+    SensorsSnapshot snapshot = {0,};
+    sensors_acquire(&snapshot);
+    sensors_publish(&snapshot);
+    current = snapshot;
+    multicore_launch_core1(sensors_core1_task);
+    running = true;
+}
@@ -2,19 +2,21 @@
 // Copyright (C) 2022, Input Labs Oy.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
-#include <pico/stdlib.h>
-#include <hardware/adc.h>
 #include "config.h"
 #include "pin.h"
 #include "button.h"
 #include "thumbstick.h"
+#include "hal.h"
 #include "common.h"
 #include "hid.h"
 #include "profile.h"
 #include "logging.h"
 #include "util.h"
+#include "sensors.h"
+#include "fixed.h"
 
 float offset_lx = 0;
 float offset_ly = 0;
@@ -23,6 +25,11 @@ float offset_ry = 0;
 float config_deadzone = 0;
 uint8_t thumbstick_smooth_samples = 0;
 
+// Fixed-point (Q15) copies for the report pipeline.
+static int32_t offsets_q15[4] = {0, 0, 0, 0};  // LX, LY, RX, RY.
+static int32_t config_deadzone_q15 = 0;
+static int32_t smoothed_q15[4] = {0, 0, 0, 0};
+
 // Daisywheel.
 bool daisywheel_used = false;
 Button daisy_a;
@@ -30,35 +37,55 @@ Button daisy_b;
 Button daisy_x;
 Button daisy_y;
 
-float smoothed[4] = {0, 0, 0, 0};
-
 static uint16_t read_filter_adc()
 {
     static const uint8_t SAMPLES = 6;
     int vals[SAMPLES];
     for (int i = 0; i < SAMPLES; i++)
     {
-        vals[i] = adc_read();
+        vals[i] = hal_adc_read();
     }
     return calculate_trimmed_mean(vals, SAMPLES);
 }
 
+uint16_t thumbstick_adc_raw(uint8_t pin)
+{
+    hal_adc_select(pin - PIN_ADC_FIRST);
+    return hal_adc_read();
+}
+
 float thumbstick_adc(uint8_t pin)
 {
-    uint8_t channel = pin - PIN_ADC_FIRST;
-    adc_select_input(channel);
-    float value = ((float)adc_read() - BIT_11) / BIT_11;
+    uint16_t raw;
+    if (sensors_is_active())
+        raw = sensors_get()->adc[pin - PIN_ADC_FIRST];
+    else
+        raw = thumbstick_adc_raw(pin);
+    float value = ((float)raw - BIT_11) / BIT_11;
     return value * THUMBSTICK_BASELINE_SATURATION;
 }
 
-float thumbstick_adc_smoothed(uint8_t pin)
+// Same as thumbstick_adc() but in Q15.
+int32_t thumbstick_adc_q15(uint8_t pin)
+{
+    static const int32_t SATURATION = Q15_FROM_FLOAT(THUMBSTICK_BASELINE_SATURATION);
+    uint16_t raw;
+    if (sensors_is_active())
+        raw = sensors_get()->adc[pin - PIN_ADC_FIRST];
+    else
+        raw = thumbstick_adc_raw(pin);
+    int32_t value = ((int32_t)raw - BIT_11) * (Q15_ONE / BIT_11);
+    return q15_mul(value, SATURATION);
+}
+
+int32_t thumbstick_adc_smoothed_q15(uint8_t pin)
 {
     if (!thumbstick_smooth_samples)
-        return thumbstick_adc(pin);
+        return thumbstick_adc_q15(pin);
     uint8_t channel = pin - PIN_ADC_FIRST;
-    float value = thumbstick_adc(pin);
-    value = smooth(smoothed[channel], value, (float)(thumbstick_smooth_samples)); // Rolling average.
-    smoothed[channel] = value;
+    int32_t value = thumbstick_adc_q15(pin);
+    value = smooth(smoothed_q15[channel], value, thumbstick_smooth_samples); // Rolling average.
+    smoothed_q15[channel] = value;
     return value;
 }
 
@@ -66,6 +93,7 @@ void thumbstick_update_deadzone()
 {
     uint8_t preset = config_get_deadzone_preset();
     config_deadzone = config_get_deadzone_value(preset);
+    config_deadzone_q15 = Q15_FROM_FLOAT(config_deadzone);
 }
 
 void thumbstick_update_offsets()
@@ -75,6 +103,10 @@ void thumbstick_update_offsets()
     offset_ly = config->offset_ts_ly;
     offset_rx = config->offset_ts_rx;
     offset_ry = config->offset_ts_ry;
+    offsets_q15[0] = Q15_FROM_FLOAT(offset_lx);
+    offsets_q15[1] = Q15_FROM_FLOAT(offset_ly);
+    offsets_q15[2] = Q15_FROM_FLOAT(offset_rx);
+    offsets_q15[3] = Q15_FROM_FLOAT(offset_ry);
 }
 
 // Refresh runtime smoothing factor with value from config.
@@ -111,10 +143,12 @@ void thumbstick_calibrate()
     float ly = 0;
     float rx = 0;
     float ry = 0;
+    sensors_pause();
     thumbstick_calibrate_each(PIN_THUMBSTICK_LX, PIN_THUMBSTICK_LY, &lx, &ly);
 #if defined DEVICE_ALPAKKA_V1 || DEVICE_ALPAKKA_V0 == 2
     thumbstick_calibrate_each(PIN_THUMBSTICK_RX, PIN_THUMBSTICK_RY, &rx, &ry);
 #endif
+    sensors_resume();
     config_set_thumbstick_offset(lx, ly, rx, ry);
     thumbstick_update_offsets();
 }
@@ -122,12 +156,12 @@ void thumbstick_calibrate()
 void thumbstick_init()
 {
     info("INIT: Thumbstick\n");
-    adc_init();
-    adc_gpio_init(PIN_THUMBSTICK_LX);
-    adc_gpio_init(PIN_THUMBSTICK_LY);
+    hal_adc_init();
+    hal_adc_gpio_init(PIN_THUMBSTICK_LX);
+    hal_adc_gpio_init(PIN_THUMBSTICK_LY);
 #if defined DEVICE_ALPAKKA_V1 || DEVICE_ALPAKKA_V0 == 2
-    adc_gpio_init(PIN_THUMBSTICK_RX);
-    adc_gpio_init(PIN_THUMBSTICK_RY);
+    hal_adc_gpio_init(PIN_THUMBSTICK_RX);
+    hal_adc_gpio_init(PIN_THUMBSTICK_RY);
 #endif
     thumbstick_update_offsets();
     thumbstick_update_deadzone();
@@ -145,39 +179,42 @@ void thumbstick_init()
 void thumbstick_report_axis(uint8_t axis, float value)
 {
     if (axis == GAMEPAD_AXIS_LX)
-        hid_gamepad_axis(LX, value);
+        hid_gamepad_axis(LX, HID_AXIS_SOURCE_THUMBSTICK, value);
     else if (axis == GAMEPAD_AXIS_LY)
-        hid_gamepad_axis(LY, value);
+        hid_gamepad_axis(LY, HID_AXIS_SOURCE_THUMBSTICK, value);
     else if (axis == GAMEPAD_AXIS_RX)
-        hid_gamepad_axis(RX, value);
+        hid_gamepad_axis(RX, HID_AXIS_SOURCE_THUMBSTICK, value);
     else if (axis == GAMEPAD_AXIS_RY)
-        hid_gamepad_axis(RY, value);
+        hid_gamepad_axis(RY, HID_AXIS_SOURCE_THUMBSTICK, value);
     else if (axis == GAMEPAD_AXIS_LX_NEG)
-        hid_gamepad_axis(LX, -value);
+        hid_gamepad_axis(LX, HID_AXIS_SOURCE_THUMBSTICK, -value);
     else if (axis == GAMEPAD_AXIS_LY_NEG)
-        hid_gamepad_axis(LY, -value);
+        hid_gamepad_axis(LY, HID_AXIS_SOURCE_THUMBSTICK, -value);
     else if (axis == GAMEPAD_AXIS_RX_NEG)
-        hid_gamepad_axis(RX, -value);
+        hid_gamepad_axis(RX, HID_AXIS_SOURCE_THUMBSTICK, -value);
     else if (axis == GAMEPAD_AXIS_RY_NEG)
-        hid_gamepad_axis(RY, -value);
+        hid_gamepad_axis(RY, HID_AXIS_SOURCE_THUMBSTICK, -value);
     else if (axis == GAMEPAD_AXIS_LZ)
-        hid_gamepad_axis(LZ, value);
+        hid_gamepad_axis(LZ, HID_AXIS_SOURCE_THUMBSTICK, value);
     else if (axis == GAMEPAD_AXIS_RZ)
-        hid_gamepad_axis(RZ, value);
+        hid_gamepad_axis(RZ, HID_AXIS_SOURCE_THUMBSTICK, value);
 }
 
-uint8_t thumbstick_get_direction(float angle, float overlap)
+// Angle is a binary angle, and cut is the overlap already converted to the
+// half-width of the exclusive sector (45 degrees with no overlap).
+uint8_t thumbstick_get_direction(int16_t angle, int32_t cut)
 {
-    float a = 45 * (1 - overlap);
-    float b = 180 - a;
+    int32_t a = cut;
+    int32_t b = ANGLE_180 - a;
+    int32_t abs_angle = abs(angle);
     uint8_t mask = 0;
     if (is_between(angle, -b, -a))
         mask += DIR4_MASK_LEFT;
     if (is_between(angle, a, b))
         mask += DIR4_MASK_RIGHT;
-    if (fabs(angle) <= (90 - a))
+    if (abs_angle <= (ANGLE_90 - a))
         mask += DIR4_MASK_UP;
-    if (fabs(angle) >= (90 + a))
+    if (abs_angle >= (ANGLE_90 + a))
         mask += DIR4_MASK_DOWN;
     return mask;
 }
@@ -242,6 +279,12 @@ void thumbstick_from_ctrl(Thumbstick *thumbstick, CtrlProfile *ctrl, uint8_t ind
             Button_from_ctrl(PIN_VIRTUAL, ctrl->sections[SECTION_STICK_DR]),
             Button_from_ctrl(PIN_PUSH, ctrl->sections[SECTION_STICK_PUSH]));
     }
+    if (ctrl_thumbtick.mode == THUMBSTICK_MODE_SCROLL)
+    {
+        thumbstick->config_scroll(
+            thumbstick,
+            Button_from_ctrl(PIN_PUSH, ctrl->sections[SECTION_STICK_PUSH]));
+    }
     if (ctrl_thumbtick.mode == THUMBSTICK_MODE_ALPHANUMERIC)
     {
         // Iterate sections.
@@ -322,6 +365,11 @@ void Thumbstick__config_8dir(
     self->push = push;
 }
 
+void Thumbstick__config_scroll(Thumbstick *self, Button push)
+{
+    self->push = push;
+}
+
 void thumbstick_report_mouse_move(uint8_t action, float thumbstick_value, uint8_t response_curve, uint8_t sensitivity_level, uint8_t exponent_level)
 {
     if (response_curve < 1 || response_curve > 3)
@@ -425,7 +473,7 @@ void Thumbstick__report_4dir_axial(Thumbstick *self, ThumbstickPosition pos)
                 self->inner.virtual_press = true;
             else
                 self->outer.virtual_press = true;
-            uint8_t direction = thumbstick_get_direction(pos.angle, self->overlap);
+            uint8_t direction = thumbstick_get_direction(pos.angle, self->overlap_cut);
             if (direction & DIR4_MASK_LEFT)
                 self->left.virtual_press = true;
             if (direction & DIR4_MASK_RIGHT)
@@ -466,7 +514,7 @@ void Thumbstick__report_4dir_axial(Thumbstick *self, ThumbstickPosition pos)
 
 void Thumbstick__report_4dir_radial(Thumbstick *self, ThumbstickPosition pos)
 {
-    uint8_t direction = thumbstick_get_direction(pos.angle, self->overlap);
+    uint8_t direction = thumbstick_get_direction(pos.angle, self->overlap_cut);
     thumbstick_report_axis(self->left.actions[0], (direction & DIR4_MASK_LEFT) ? pos.radius : 0);
     thumbstick_report_axis(self->right.actions[0], (direction & DIR4_MASK_RIGHT) ? pos.radius : 0);
     thumbstick_report_axis(self->up.actions[0], (direction & DIR4_MASK_UP) ? pos.radius : 0);
@@ -521,7 +569,7 @@ void Thumbstick__report_8dir(Thumbstick *self, ThumbstickPosition pos)
         // Evaluate virtual buttons.
         if (pos.radius > THUMBSTICK_ADDITIONAL_DEADZONE_FOR_BUTTONS)
         {
-            uint8_t direction = thumbstick_get_direction(pos.angle, 0.5); // Fixed overlap.
+            uint8_t direction = thumbstick_get_direction(pos.angle, ANGLE_45 / 2); // Fixed overlap (50%).
             if (direction == DIR4_MASK_LEFT)
                 self->left.virtual_press = true;
             else if (direction == DIR4_MASK_RIGHT)
@@ -625,9 +673,9 @@ void Thumbstick__report_alphanumeric(Thumbstick *self, ThumbstickPosition pos)
 {
     static Glyph input = {0};
     static uint8_t input_index = 0;
-    static float CUT4 = 45;
-    static float CUT4X = 135; // 180-45
-    static float CUT8 = 22.5;
+    static const int32_t CUT4 = ANGLE_45;
+    static const int32_t CUT4X = ANGLE_180 - ANGLE_45;
+    static const int32_t CUT8 = ANGLE_22_5;
     Dir4 dir4 = 0;
     Dir8 dir8 = 0;
     if (pos.radius > 0.7)
@@ -638,9 +686,9 @@ void Thumbstick__report_alphanumeric(Thumbstick *self, ThumbstickPosition pos)
             dir4 = DIR4_LEFT;
         else if (is_between(pos.angle, CUT4, CUT4X))
             dir4 = DIR4_RIGHT;
-        else if (fabs(pos.angle) <= 90 - CUT4)
+        else if (abs(pos.angle) <= ANGLE_90 - CUT4)
             dir4 = DIR4_UP;
-        else if (fabs(pos.angle) >= 90 + CUT4)
+        else if (abs(pos.angle) >= ANGLE_90 + CUT4)
             dir4 = DIR4_DOWN;
         // Detect direction 8.
         if (is_between(pos.angle, -CUT8 * 1, CUT8 * 1))
@@ -657,7 +705,7 @@ void Thumbstick__report_alphanumeric(Thumbstick *self, ThumbstickPosition pos)
             dir8 = DIR8_LEFT;
         else if (is_between(pos.angle, -CUT8 * 3, -CUT8 * 1))
             dir8 = DIR8_UP_LEFT;
-        else if (fabs(pos.angle) >= CUT8 * 7)
+        else if (abs(pos.angle) >= CUT8 * 7)
             dir8 = DIR8_DOWN;
         // Record direction 4.
         if (input_index == 0 || dir4 != input[input_index - 1])
@@ -687,39 +735,83 @@ void Thumbstick__report_alphanumeric(Thumbstick *self, ThumbstickPosition pos)
     }
 }
 
-void Thumbstick__report(Thumbstick *self)
+ThumbstickPosition Thumbstick__position(Thumbstick *self)
 {
-    float offset_x = self->index == 0 ? offset_lx : offset_rx;
-    float offset_y = self->index == 0 ? offset_ly : offset_ry;
-    // Do not report if not calibrated.
-    if (offset_x == 0 && offset_y == 0)
-        return;
+    int32_t offset_x = offsets_q15[self->index * 2];
+    int32_t offset_y = offsets_q15[self->index * 2 + 1];
     // Get values from ADC.
-    float x = thumbstick_adc_smoothed(self->pin_x) - offset_x;
-    float y = thumbstick_adc_smoothed(self->pin_y) - offset_y;
-    x /= self->saturation;
-    y /= self->saturation;
-    x = constrain(x, -1, 1) * (self->invert_x ? -1 : 1);
-    y = constrain(y, -1, 1) * (self->invert_y ? -1 : 1);
+    // All the pipeline is in Q15 fixed-point, to avoid soft-float trigonometry.
+    int32_t saturation = self->saturation_q15;
+    int32_t x = thumbstick_adc_smoothed_q15(self->pin_x) - offset_x;
+    int32_t y = thumbstick_adc_smoothed_q15(self->pin_y) - offset_y;
+    x = constrain(x, -saturation, saturation) * Q15_ONE / saturation;
+    y = constrain(y, -saturation, saturation) * Q15_ONE / saturation;
+    x *= (self->invert_x ? -1 : 1);
+    y *= (self->invert_y ? -1 : 1);
     // Get correct deadzone.
-    float deadzone = self->deadzone_override ? self->deadzone : config_deadzone;
-    deadzone /= self->saturation;
-    // Calculate trigonometry.
-    float angle = atan2(x, -y) * (180 / M_PI);
-    float radius = sqrt(powf(x, 2) + powf(y, 2));
-    radius = constrain(radius, 0, 1);
+    int32_t deadzone = self->deadzone_override ? self->deadzone_q15 : config_deadzone_q15;
+    deadzone = min(deadzone, Q15_ONE) * Q15_ONE / saturation;
+    // Calculate polar coordinates.
+    int16_t angle = fixed_atan2(x, -y);
+    int32_t magnitude = fixed_sqrt((uint32_t)(x * x) + (uint32_t)(y * y));
+    int32_t radius = min(magnitude, Q15_ONE);
     if (radius < deadzone)
     {
         radius = 0;
     }
     else
     {
-        radius = ramp_low(radius, deadzone);
-        radius = ramp_inv(radius, self->antideadzone);
+        // Ramp low (deadzone) and ramp inv (anti-deadzone).
+        radius = (radius - deadzone) * Q15_ONE / max(Q15_ONE - deadzone, 1);
+        radius = Q15_ONE + q15_mul(radius - Q15_ONE, Q15_ONE - self->antideadzone_q15);
+    }
+    // Scale the vector to the new radius, keeping the direction.
+    if (magnitude)
+    {
+        x = x * radius / magnitude;
+        y = y * radius / magnitude;
+    }
+    ThumbstickPosition pos = {
+        Q15_TO_FLOAT(x),
+        Q15_TO_FLOAT(y),
+        angle,
+        Q15_TO_FLOAT(radius),
+    };
+    return pos;
+}
+
+// The scroll speed grows with the square of the deflection, for finer control
+// near the center, and is reported in high resolution units (a fraction of a
+// wheel detent). What does not make a whole unit yet is kept for the next
+// ticks, so slow scrolling is smooth instead of stopping.
+void Thumbstick__report_scroll(Thumbstick *self, ThumbstickPosition pos)
+{
+    static const float UNITS_PER_TICK = (
+        THUMBSTICK_SCROLL_SPEED * HID_SCROLL_RESOLUTION / (float)CFG_TICK_FREQUENCY
+    );
+    // Up (negative y) scrolls up, right pans right.
+    self->scroll_remainder[0] += -pos.y * pos.radius * UNITS_PER_TICK;
+    self->scroll_remainder[1] += pos.x * pos.radius * UNITS_PER_TICK;
+    int16_t scroll = self->scroll_remainder[0];
+    int16_t pan = self->scroll_remainder[1];
+    self->scroll_remainder[0] -= scroll;
+    self->scroll_remainder[1] -= pan;
+    if (scroll || pan)
+        hid_mouse_scroll(scroll, pan);
+    if (pos.radius == 0)
+    {
+        self->scroll_remainder[0] = 0;
+        self->scroll_remainder[1] = 0;
     }
-    x = sin(radians(angle)) * radius;
-    y = -cos(radians(angle)) * radius;
-    ThumbstickPosition pos = {x, y, angle, radius};
+    self->push.report(&self->push);
+}
+
+void Thumbstick__report(Thumbstick *self)
+{
+    // Do not report if not calibrated.
+    if (offsets_q15[self->index * 2] == 0 && offsets_q15[self->index * 2 + 1] == 0)
+        return;
+    ThumbstickPosition pos = self->position(self);
     // Report.
     if (self->mode == THUMBSTICK_MODE_4DIR)
     {
@@ -740,6 +832,10 @@ void Thumbstick__report(Thumbstick *self)
     {
         self->report_alphanumeric(self, pos);
     }
+    else if (self->mode == THUMBSTICK_MODE_SCROLL)
+    {
+        self->report_scroll(self, pos);
+    }
 }
 
 void Thumbstick__reset(Thumbstick *self)
@@ -754,6 +850,12 @@ void Thumbstick__reset(Thumbstick *self)
         self->inner.reset(&self->inner);
         self->outer.reset(&self->outer);
     }
+    if (self->mode == THUMBSTICK_MODE_SCROLL)
+    {
+        self->push.reset(&self->push);
+        self->scroll_remainder[0] = 0;
+        self->scroll_remainder[1] = 0;
+    }
 }
 
 Thumbstick Thumbstick_(
@@ -773,13 +875,16 @@ Thumbstick Thumbstick_(
     Thumbstick thumbstick;
     // Methods.
     thumbstick.report = Thumbstick__report;
+    thumbstick.position = Thumbstick__position;
     thumbstick.report_4dir_axial = Thumbstick__report_4dir_axial;
     thumbstick.report_4dir_radial = Thumbstick__report_4dir_radial;
     thumbstick.report_8dir = Thumbstick__report_8dir;
     thumbstick.report_alphanumeric = Thumbstick__report_alphanumeric;
+    thumbstick.report_scroll = Thumbstick__report_scroll;
     thumbstick.reset = Thumbstick__reset;
     thumbstick.config_4dir = Thumbstick__config_4dir;
     thumbstick.config_8dir = Thumbstick__config_8dir;
+    thumbstick.config_scroll = Thumbstick__config_scroll;
     thumbstick.config_glyphstick = Thumbstick__config_glyphstick;
     thumbstick.report_glyphstick = Thumbstick__report_glyphstick;
     thumbstick.config_daisywheel = Thumbstick__config_daisywheel;
@@ -797,6 +902,12 @@ Thumbstick Thumbstick_(
     thumbstick.antideadzone = antideadzone;
     thumbstick.overlap = overlap;
     thumbstick.saturation = saturation;
+    thumbstick.deadzone_q15 = Q15_FROM_FLOAT(deadzone);
+    thumbstick.antideadzone_q15 = Q15_FROM_FLOAT(antideadzone);
+    thumbstick.saturation_q15 = max(Q15_FROM_FLOAT(saturation), 1);
+    thumbstick.overlap_cut = ANGLE_45 * (1 - overlap);
+    thumbstick.scroll_remainder[0] = 0;
+    thumbstick.scroll_remainder[1] = 0;
     thumbstick.glyphstick_index = 0;
     return thumbstick;
 }
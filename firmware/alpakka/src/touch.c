@@ -40,10 +40,11 @@ There are 2 modes of operation:
 
 #include <stdio.h>
 #include <math.h>
-#include <pico/stdlib.h>
 #include "config.h"
 #include "touch.h"
+#include "hal.h"
 #include "loop.h"
+#include "sensors.h"
 #include "pin.h"
 #include "common.h"
 #include "logging.h"
@@ -74,27 +75,27 @@ void touch_load_from_config() {
 uint8_t touch_get_elapsed() {
     bool timedout = false;
     // Make sure it is settled.
-    uint32_t timer_start = time_us_32();
-    gpio_put(PIN_TOUCH_OUT, polarity_mode);
-    while(gpio_get(PIN_TOUCH_IN) != polarity_mode) {
-        if ((time_us_32() - timer_start) > TOUCH_TIMEOUT) {
+    uint32_t timer_start = hal_time_us_32();
+    hal_gpio_put(PIN_TOUCH_OUT, polarity_mode);
+    while(hal_gpio_get(PIN_TOUCH_IN) != polarity_mode) {
+        if ((hal_time_us_32() - timer_start) > TOUCH_TIMEOUT) {
             return TOUCH_TIMEOUT;
         }
     }
     // Request change and measure.
-    uint32_t timer_settled = time_us_32();
-    gpio_put(PIN_TOUCH_OUT, !polarity_mode);
-    while(gpio_get(PIN_TOUCH_IN) == polarity_mode) {
-        if ((time_us_32() - timer_start) > TOUCH_TIMEOUT) {
+    uint32_t timer_settled = hal_time_us_32();
+    hal_gpio_put(PIN_TOUCH_OUT, !polarity_mode);
+    while(hal_gpio_get(PIN_TOUCH_IN) == polarity_mode) {
+        if ((hal_time_us_32() - timer_start) > TOUCH_TIMEOUT) {
             timedout = true;
             break;
         }
     };
     // Request settle for next cycle.
-    gpio_put(PIN_TOUCH_OUT, polarity_mode);
+    hal_gpio_put(PIN_TOUCH_OUT, polarity_mode);
     // Calculate elapsed (ignore settling time).
     if (timedout) return TOUCH_TIMEOUT;
-    else return time_us_32() - timer_settled;
+    else return hal_time_us_32() - timer_settled;
 }
 
 // Take as many samples as possible within the available time (timeout).
@@ -149,7 +150,11 @@ bool touch_status() {
     static uint32_t disengaged_last_ts = 0;
     static float elapsed_prev = 0;
     // Measure and smooth.
-    float elapsed = touch_get_elapsed_multisample();
+    float elapsed = (
+        sensors_is_active() ?
+        sensors_get()->touch_elapsed :
+        touch_get_elapsed_multisample()
+    );
     float smoothed = (elapsed + elapsed_prev) / 2;
     elapsed_prev = elapsed;
     // Determine threshold.
@@ -164,8 +169,8 @@ bool touch_status() {
     // Periodic debug log.
     if (logging_has_mask(LOG_TOUCH_SENS)) {
         static uint32_t log_last_ts = 0;
-        if (time_us_32() > (log_last_ts + (TOUCH_DEBUG_FREQ * 1000))) {
-            log_last_ts = time_us_32();
+        if (hal_time_us_32() > (log_last_ts + (TOUCH_DEBUG_FREQ * 1000))) {
+            log_last_ts = hal_time_us_32();
             float ratio = sens_from_config < 0 ? threshold_ratio : 0;
             info("e=%.1f t=%.1f r=%.2f\n", elapsed, threshold, ratio);
         }
@@ -173,13 +178,13 @@ bool touch_status() {
     // Debounce check (prioritize stay up to avoid microcuts).
     bool from_engaged_to_disengaged = !engaged && engaged_prev;
     if (from_engaged_to_disengaged) {
-        bool debounce = (time_us_32() - disengaged_last_ts) < (TOUCH_DEBOUNCE * 1000);
+        bool debounce = (hal_time_us_32() - disengaged_last_ts) < (TOUCH_DEBOUNCE * 1000);
         if (debounce) {
             return engaged_prev;
         }
     }
     if (!engaged) {
-        disengaged_last_ts = time_us_32();
+        disengaged_last_ts = hal_time_us_32();
     }
     // Debug log triggered by state change.
     if (engaged != engaged_prev) {
@@ -198,22 +203,19 @@ bool touch_status() {
 // Probe timings and show them in the startup log.
 void touch_log_probe() {
     uint8_t t0 = touch_get_elapsed();
-    sleep_ms(CFG_TICK_INTERVAL_IN_MS);
+    hal_sleep_ms(CFG_TICK_INTERVAL_IN_MS);
     uint8_t t1 = touch_get_elapsed();
-    sleep_ms(CFG_TICK_INTERVAL_IN_MS);
+    hal_sleep_ms(CFG_TICK_INTERVAL_IN_MS);
     uint8_t t2 = touch_get_elapsed();
-    sleep_ms(CFG_TICK_INTERVAL_IN_MS);
+    hal_sleep_ms(CFG_TICK_INTERVAL_IN_MS);
     uint8_t t3 = touch_get_elapsed();
     info("  Touch readings: %ius %ius %ius %ius\n", t0, t1, t2, t3);
 }
 
 void touch_init() {
     info("INIT: Touch\n");
-    gpio_init(PIN_TOUCH_OUT);
-    gpio_set_dir(PIN_TOUCH_OUT, GPIO_OUT);
-    gpio_init(PIN_TOUCH_IN);
-    gpio_set_dir(PIN_TOUCH_IN, GPIO_IN);
-    gpio_set_pulls(PIN_TOUCH_IN, false, false);
+    hal_gpio_init_output(PIN_TOUCH_OUT);
+    hal_gpio_init_input(PIN_TOUCH_IN, false);
     touch_load_from_config();
     touch_log_probe();
 }
@@ -3,6 +3,7 @@
 
 #include <tusb_config.h>
 #include <tusb.h>
+#include <pico/time.h>
 #include "config.h"
 #include "hid.h"
 #include "led.h"
@@ -25,26 +26,38 @@ static const char *const descriptor_string[] = {
     STRING_WEBUSB,
     STRING_XINPUT};
 
-uint8_t const descriptor_report_generic[] = {
+static volatile uint32_t sof_timestamp = 0;
+
+// Each report type has its own interface and interrupt endpoint, so changes
+// in different classes can be sent within the same frame.
+uint8_t const descriptor_report_keyboard[] = {
     TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(REPORT_KEYBOARD)),
-    TUD_HID_REPORT_DESC_MOUSE_CUSTOM(HID_REPORT_ID(REPORT_MOUSE)),
-    TUD_HID_REPORT_DESC_GAMEPAD_CUSTOM(HID_REPORT_ID(REPORT_GAMEPAD)),
 };
 
-uint8_t const descriptor_report_xinput[] = {
-    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(REPORT_KEYBOARD)),
+uint8_t const descriptor_report_keyboard_nkro[] = {
+    TUD_HID_REPORT_DESC_KEYBOARD_NKRO(HID_REPORT_ID(REPORT_KEYBOARD)),
+};
+
+uint8_t const descriptor_report_mouse[] = {
     TUD_HID_REPORT_DESC_MOUSE_CUSTOM(HID_REPORT_ID(REPORT_MOUSE)),
 };
 
+uint8_t const descriptor_report_gamepad[] = {
+    TUD_HID_REPORT_DESC_GAMEPAD_CUSTOM(HID_REPORT_ID(REPORT_GAMEPAD)),
+};
+
 uint8_t descriptor_configuration_generic[] = {
-    DESCRIPTOR_CONFIGURATION(2),
-    DESCRIPTOR_INTERFACE_HID(sizeof(descriptor_report_generic)),
-    DESCRIPTOR_INTERFACE_WEBUSB};
+    DESCRIPTOR_CONFIGURATION(4),
+    DESCRIPTOR_INTERFACE_HID(ITF_HID_KEYBOARD, HID_ITF_PROTOCOL_KEYBOARD, ADDR_HID_KEYBOARD_IN, 0),
+    DESCRIPTOR_INTERFACE_WEBUSB,
+    DESCRIPTOR_INTERFACE_HID(ITF_HID_MOUSE, HID_ITF_PROTOCOL_NONE, ADDR_HID_MOUSE_IN, sizeof(descriptor_report_mouse)),
+    DESCRIPTOR_INTERFACE_HID(ITF_HID_GAMEPAD, HID_ITF_PROTOCOL_NONE, ADDR_HID_GAMEPAD_IN, sizeof(descriptor_report_gamepad))};
 
 uint8_t descriptor_configuration_xinput[] = {
-    DESCRIPTOR_CONFIGURATION(3),
-    DESCRIPTOR_INTERFACE_HID(sizeof(descriptor_report_xinput)),
+    DESCRIPTOR_CONFIGURATION(4),
+    DESCRIPTOR_INTERFACE_HID(ITF_HID_KEYBOARD, HID_ITF_PROTOCOL_KEYBOARD, ADDR_HID_KEYBOARD_IN, 0),
     DESCRIPTOR_INTERFACE_WEBUSB,
+    DESCRIPTOR_INTERFACE_HID(ITF_HID_MOUSE, HID_ITF_PROTOCOL_NONE, ADDR_HID_MOUSE_IN, sizeof(descriptor_report_mouse)),
     DESCRIPTOR_INTERFACE_XINPUT};
 
 uint8_t const *tud_descriptor_device_cb()
@@ -77,28 +90,45 @@ uint8_t const *tud_descriptor_device_cb()
     return (uint8_t const *)&descriptor_device;
 }
 
+// The keyboard report descriptor depends on the protocol, so its length in
+// the HID descriptor is set at runtime (same as the total length).
+static void descriptor_set_keyboard_report_len(uint8_t *descriptor)
+{
+    uint16_t len = sizeof(descriptor_report_keyboard);
+    if (config_get_keyboard_nkro())
+        len = sizeof(descriptor_report_keyboard_nkro);
+    descriptor[DESCRIPTOR_KEYBOARD_REPORT_LEN_INDEX] = len & 0xFF;
+    descriptor[DESCRIPTOR_KEYBOARD_REPORT_LEN_INDEX + 1] = len >> 8;
+}
+
 uint8_t const *tud_descriptor_configuration_cb(uint8_t index)
 {
     debug_uart("USB: tud_descriptor_configuration_cb index=0x%x\n", index);
     if (config_get_protocol() == PROTOCOL_GENERIC)
     {
         descriptor_configuration_generic[2] = sizeof(descriptor_configuration_generic);
+        descriptor_set_keyboard_report_len(descriptor_configuration_generic);
         return descriptor_configuration_generic;
     }
     else
     {
         descriptor_configuration_xinput[2] = sizeof(descriptor_configuration_xinput);
+        descriptor_set_keyboard_report_len(descriptor_configuration_xinput);
         return descriptor_configuration_xinput;
     }
 }
 
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
 {
-    debug_uart("USB: tud_hid_descriptor_report_cb\n");
-    if (config_get_protocol() == PROTOCOL_GENERIC)
-        return descriptor_report_generic;
+    debug_uart("USB: tud_hid_descriptor_report_cb instance=%i\n", instance);
+    if (instance == HID_INSTANCE_KEYBOARD && config_get_keyboard_nkro())
+        return descriptor_report_keyboard_nkro;
+    else if (instance == HID_INSTANCE_KEYBOARD)
+        return descriptor_report_keyboard;
+    else if (instance == HID_INSTANCE_MOUSE)
+        return descriptor_report_mouse;
     else
-        return descriptor_report_xinput;
+        return descriptor_report_gamepad;
 }
 
 const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
@@ -172,6 +202,11 @@ uint16_t tud_hid_get_report_cb(
     uint8_t *buffer,
     uint16_t reqlen)
 {
+    if (instance == HID_INSTANCE_MOUSE && report_type == HID_REPORT_TYPE_FEATURE && reqlen)
+    {
+        buffer[0] = hid_get_scroll_multiplier();
+        return 1;
+    }
     return 0;
 }
 
@@ -180,11 +215,39 @@ void tud_hid_set_report_cb(
     uint8_t report_id,
     hid_report_type_t report_type,
     uint8_t const *buffer,
-    uint16_t bufsize) {}
+    uint16_t bufsize)
+{
+    if (instance == HID_INSTANCE_MOUSE && report_type == HID_REPORT_TYPE_FEATURE && bufsize)
+    {
+        hid_set_scroll_multiplier(buffer[0]);
+    }
+}
+
+// The report reached the host, so the next pending one can be sent now.
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    if (instance == HID_INSTANCE_KEYBOARD)
+        hid_report_complete(HID_CLASS_KEYBOARD);
+    if (instance == HID_INSTANCE_MOUSE)
+        hid_report_complete(HID_CLASS_MOUSE);
+    if (instance == HID_INSTANCE_GAMEPAD)
+        hid_report_complete(HID_CLASS_GAMEPAD);
+}
+
+// The host (typically a BIOS) can switch the keyboard to the boot protocol,
+// in which case the 6KRO layout is sent instead of NKRO (see hid.c).
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+    debug_uart("USB: tud_hid_set_protocol_cb instance=%i protocol=%i\n", instance, protocol);
+}
 
 void tud_mount_cb(void)
 {
     debug_uart("USB: tud_mount_cb\n");
+    // The host enables the resolution multiplier again after enumeration.
+    hid_set_scroll_multiplier(0);
+    // The new host state starts empty.
+    hid_resync();
 }
 
 void tud_umount_cb(void)
@@ -202,6 +265,23 @@ void tud_resume_cb(void)
     debug_uart("USB: tud_resume_cb\n");
 }
 
+// Called from the USB interrupt on every start-of-frame (see xinput_driver).
+void usb_sof_cb(uint8_t rhport, uint32_t frame_count)
+{
+    sof_timestamp = time_us_32();
+}
+
+uint32_t usb_get_sof_timestamp()
+{
+    return sof_timestamp;
+}
+
+// The host sends a start-of-frame every millisecond while not suspended.
+bool usb_sof_is_active()
+{
+    return sof_timestamp && (time_us_32() - sof_timestamp) < USB_SOF_TIMEOUT_US;
+}
+
 // Wait until the USB is able to send/receive data, until timeout
 // (in milliseconds) is reached.
 // Negative timeout means no timeout.
@@ -229,6 +309,26 @@ bool usb_wait_for_init(int16_t timeout)
     return false;
 }
 
+// Detach and attach again, so the host enumerates the device with the
+// descriptors of the current protocol (see the descriptor callbacks), while
+// all the runtime state is kept. Optionally waits until it is ready again.
+bool usb_reenumerate(int16_t timeout)
+{
+    info("USB: Re-enumerating\n");
+    tud_disconnect();
+    sleep_ms(USB_REENUMERATE_DETACH_MS);
+    tud_connect();
+    while (timeout > 0)
+    {
+        tud_task();
+        if (tud_ready())
+            return true;
+        sleep_ms(1);
+        timeout -= 1;
+    }
+    return false;
+}
+
 bool usb_is_connected()
 {
     tud_task();
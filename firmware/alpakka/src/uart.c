@@ -5,11 +5,18 @@
 #include <stdbool.h>
 #include <pico/stdio.h>
 #include <pico/bootrom.h>
+#include <string.h>
 #include <hardware/watchdog.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <hardware/uart.h>
+#include <pico/time.h>
 #include "uart.h"
 #include "config.h"
 #include "self_test.h"
 #include "logging.h"
+#include "profiler.h"
 #include "power.h"
 #include "esp.h"
 
@@ -50,87 +57,268 @@ void uart_listen_serial_do(bool limited) {
     }
 }
 
+// Called periodically by the scheduler (see UART_LISTEN_INTERVAL_IN_US).
 void uart_listen_serial() {
-    static uint16_t i = 0;
-    i += 1;
-    // Execute only once per second.
-    if (i % CFG_TICK_FREQUENCY) return;
+    uint32_t start = profiler_start();
     uart_listen_serial_do(false);
+    profiler_stop(PROFILER_UART, start);
 }
 
 void uart_listen_serial_limited() {
     uart_listen_serial_do(true);
 }
 
-// Ring buffer since RP2040 hardware FIFO is only 32 bytes.
-uint8_t rx_buffer[UART_RX_BUFFER_SIZE];
-static volatile uint16_t write_pos;
-static volatile uint16_t read_pos;
+// Receive ring, written continuously by DMA (the write address wraps around
+// by hardware, so the buffer is aligned to its size), the CPU is not involved
+// per byte. The frames are parsed in place, only a frame that wraps around
+// the end of the ring has its wrapped part copied after the end (see
+// uart_rx_peek), so every frame can be read as contiguous memory.
+// The end of each burst from the ESP is detected by a repeating timer that
+// sees the DMA write address stop moving, so its frames can be dispatched
+// right away. (The UART receive timeout interrupt cannot be used for this,
+// since it only fires while data waits in the FIFO, and the DMA keeps the FIFO
+// empty.) The parsing does not depend on it, since the frames are delimited by
+// their own header, and the ring is also polled every tick.
+static uint8_t rx_buffer[UART_RX_BUFFER_SIZE + UART_RX_FRAME_MAX] __attribute__((aligned(UART_RX_BUFFER_SIZE)));
+static uint16_t rx_read = 0;
+static int8_t rx_channel = -1;
+static volatile UartCallback rx_idle_callback = NULL;
+static volatile uint32_t rx_bursts = 0;
+static repeating_timer_t rx_idle_timer;
+static bool rx_idle_timer_active = false;
+static uint16_t rx_idle_pos = 0;
+static bool rx_idle_moving = false;
 
-void uart_rx_buffer_init() {
-    write_pos = 0;
-    read_pos = 0;
+static uint16_t uart_rx_write_pos() {
+    uint32_t address = dma_channel_hw_addr(rx_channel)->write_addr;
+    // The buffer contents written by DMA must be read after the address.
+    __compiler_memory_barrier();
+    return (address - (uint32_t)rx_buffer) & (UART_RX_BUFFER_SIZE - 1);
 }
 
-bool uart_rx_buffer_is_empty() {
-    // printf("W %i R %i\n", write_pos, read_pos);
-    return write_pos == read_pos;
+// The ring is drained every tick, much faster than the UART can fill it.
+uint16_t uart_rx_available() {
+    if (rx_channel < 0) return 0;
+    return (uart_rx_write_pos() - rx_read) & (UART_RX_BUFFER_SIZE - 1);
 }
 
-bool uart_rx_buffer_is_full() {
-    return ((write_pos + 1) % UART_RX_BUFFER_SIZE) == read_pos;
+// Contiguous view of the next bytes, len must not exceed the available bytes
+// nor UART_RX_FRAME_MAX.
+uint8_t *uart_rx_peek(uint16_t len) {
+    uint16_t end = rx_read + len;
+    if (end > UART_RX_BUFFER_SIZE) {
+        memcpy(&rx_buffer[UART_RX_BUFFER_SIZE], rx_buffer, end - UART_RX_BUFFER_SIZE);
+    }
+    return &rx_buffer[rx_read];
 }
 
-uint16_t uart_rx_buffer_available() {
-    if (write_pos >= read_pos) {
-        return write_pos - read_pos;
-    } else {
-        return UART_RX_BUFFER_SIZE - (read_pos - write_pos);
-    }
+void uart_rx_consume(uint16_t len) {
+    rx_read = (rx_read + len) & (UART_RX_BUFFER_SIZE - 1);
 }
 
-void uart_rx_buffer_consume(uint16_t len) {
-    read_pos = (read_pos + len) % UART_RX_BUFFER_SIZE;
+uint32_t uart_rx_get_bursts() {
+    return rx_bursts;
 }
 
-bool uart_rx_buffer_putc(uint8_t byte) {
-    if (uart_rx_buffer_is_full()) {
-        warn("UART: RX buffer full\n");
-        return false;
+// Every UART_RX_IDLE_POLL_US, a burst ended if the write address moved since
+// the previous check and not since then.
+static bool uart_rx_idle_timer_callback(repeating_timer_t *timer) {
+    uint16_t pos = uart_rx_write_pos();
+    if (pos != rx_idle_pos) {
+        rx_idle_pos = pos;
+        rx_idle_moving = true;
+    } else if (rx_idle_moving) {
+        rx_idle_moving = false;
+        rx_bursts++;
+        UartCallback callback = rx_idle_callback;
+        if (callback) callback();
     }
-    rx_buffer[write_pos] = byte;
-    write_pos = (write_pos + 1) % UART_RX_BUFFER_SIZE;
     return true;
 }
 
-uint8_t uart_rx_buffer_getc() {
-    uint8_t byte = rx_buffer[read_pos];
-    uart_rx_buffer_consume(1);
-    return byte;
+// Only needed while someone listens to the idle events.
+static void uart_rx_idle_timer_start() {
+    if (rx_idle_timer_active || rx_channel < 0 || !rx_idle_callback) return;
+    rx_idle_pos = uart_rx_write_pos();
+    rx_idle_moving = false;
+    // Negative interval, between the starts of the callbacks.
+    add_repeating_timer_us(-UART_RX_IDLE_POLL_US, uart_rx_idle_timer_callback, NULL, &rx_idle_timer);
+    rx_idle_timer_active = true;
+}
+
+static void uart_rx_idle_timer_stop() {
+    if (!rx_idle_timer_active) return;
+    cancel_repeating_timer(&rx_idle_timer);
+    rx_idle_timer_active = false;
+}
+
+// Called when the line goes idle after receiving data, from the interrupt.
+void uart_rx_set_idle_callback(UartCallback callback) {
+    rx_idle_callback = callback;
+    if (callback) uart_rx_idle_timer_start();
+    else uart_rx_idle_timer_stop();
+}
+
+// The transfer count is finite, so the DMA is restarted if it ever runs out
+// (after 2^32 bytes). The write address keeps its position in the ring.
+static void uart_rx_dma_irq_callback() {
+    if (!dma_channel_get_irq1_status(rx_channel)) return;
+    dma_channel_acknowledge_irq1(rx_channel);
+    dma_channel_set_trans_count(rx_channel, UART_RX_DMA_COUNT, true);
+}
+
+// Stop receiving, eg: before the UART is used by the bootloader.
+void uart_rx_reset() {
+    if (rx_channel < 0) return;
+    uart_rx_idle_timer_stop();
+    dma_channel_abort(rx_channel);
+    dma_channel_acknowledge_irq1(rx_channel);
+    rx_read = 0;
+}
+
+void uart_rx_init() {
+    if (rx_channel < 0) {
+        rx_channel = dma_claim_unused_channel(true);
+        irq_add_shared_handler(DMA_IRQ_1, uart_rx_dma_irq_callback, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    } else {
+        uart_rx_reset();
+    }
+    dma_channel_config config = dma_channel_get_default_config(rx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, UART_RX_BUFFER_BITS);
+    channel_config_set_dreq(&config, uart_get_dreq(ESP_UART, false));
+    dma_channel_configure(
+        rx_channel,
+        &config,
+        rx_buffer,
+        &uart_get_hw(ESP_UART)->dr,
+        UART_RX_DMA_COUNT,
+        true
+    );
+    dma_channel_set_irq1_enabled(rx_channel, true);
+    irq_set_enabled(DMA_IRQ_1, true);
+    uart_rx_idle_timer_start();
+}
+
+// Transmit ring of whole frames, fed to the UART by DMA so the senders never
+// wait for the serialization. The frame at the tail is the one being sent
+// while busy, each completion starts the next one from the DMA interrupt.
+static UartTxSlot tx_slots[UART_TX_SLOTS];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+static volatile bool tx_busy = false;
+static int8_t tx_channel = -1;
+static uint32_t tx_replaced = 0;
+static uint32_t tx_dropped = 0;
+
+static void uart_tx_start() {
+    if (tx_busy || tx_head == tx_tail) return;
+    UartTxSlot *slot = &tx_slots[tx_tail % UART_TX_SLOTS];
+    tx_busy = true;
+    dma_channel_transfer_from_buffer_now(tx_channel, slot->data, slot->len);
 }
 
-uint8_t uart_rx_buffer_peekc() {
-    return rx_buffer[read_pos];
+static void uart_tx_irq_callback() {
+    if (!dma_channel_get_irq1_status(tx_channel)) return;
+    dma_channel_acknowledge_irq1(tx_channel);
+    tx_tail++;
+    tx_busy = false;
+    uart_tx_start();
 }
 
-void uart_rx_buffer_get(uint8_t *dest, uint16_t len) {
-    for(uint8_t i=0; i<len; i++) {
-        dest[i] = rx_buffer[read_pos + i];
+// Remove the pending frames (not the one being sent) superseded by a new frame
+// with the given tag: all of the same tag, otherwise the oldest with any tag
+// (always the latter for an untagged frame). The rest keep their order, so the
+// new frame (appended after them) never goes out before older state. Returns
+// false if nothing was removed.
+static bool uart_tx_remove_replaceable(uint8_t tag) {
+    uint8_t first = tx_busy ? tx_tail + 1 : tx_tail;
+    bool same = false;
+    for(uint8_t i=first; i!=tx_head; i++) {
+        if (tag != UART_TX_TAG_NONE && tx_slots[i % UART_TX_SLOTS].tag == tag) same = true;
     }
-    uart_rx_buffer_consume(len);
+    bool removed = false;
+    uint8_t write = first;
+    for(uint8_t read=first; read!=tx_head; read++) {
+        UartTxSlot *slot = &tx_slots[read % UART_TX_SLOTS];
+        bool remove = same ? slot->tag == tag : (!removed && slot->tag != UART_TX_TAG_NONE);
+        if (remove) {
+            removed = true;
+            continue;
+        }
+        if (write != read) tx_slots[write % UART_TX_SLOTS] = *slot;
+        write++;
+    }
+    tx_head = write;
+    return removed;
 }
 
-bool uart_rx_buffer_match(uint8_t *pattern, uint8_t len) {
-    if (len > uart_rx_buffer_available()) return false;
-    for(uint8_t i=0; i<len; i++) {
-        if (rx_buffer[read_pos+i] != pattern[i]) return false;
+// Returns false if the frame was discarded. The tagged frames (HID reports and
+// their acknowledgements) are sent again until acknowledged, so these can be
+// discarded or replaced when the ring is full. The untagged ones (WebUSB and
+// the USB protocol) are never discarded: they take the place of the oldest
+// tagged frame, or wait for the frames ahead of them to be sent.
+bool uart_tx_send(uint8_t *data, uint8_t len, uint8_t tag) {
+    if (len > UART_TX_FRAME_MAX) return false;
+    uint32_t irq = save_and_disable_interrupts();
+    bool full = (uint8_t)(tx_head - tx_tail) == UART_TX_SLOTS;
+    if (full && uart_tx_remove_replaceable(tag)) {
+        tx_replaced++;
+        full = false;
     }
-    return true;
+    while(full && tag == UART_TX_TAG_NONE) {
+        // Only untagged frames pending, these leave at the UART rate.
+        restore_interrupts(irq);
+        tight_loop_contents();
+        irq = save_and_disable_interrupts();
+        full = (uint8_t)(tx_head - tx_tail) == UART_TX_SLOTS;
+    }
+    if (!full) {
+        UartTxSlot *slot = &tx_slots[tx_head % UART_TX_SLOTS];
+        memcpy(slot->data, data, len);
+        slot->len = len;
+        slot->tag = tag;
+        tx_head++;
+        uart_tx_start();
+    } else {
+        tx_dropped++;
+    }
+    restore_interrupts(irq);
+    return !full;
+}
+
+// Discard everything pending, eg: before the UART is used by the bootloader.
+void uart_tx_reset() {
+    if (tx_channel < 0) return;
+    uint32_t irq = save_and_disable_interrupts();
+    dma_channel_abort(tx_channel);
+    dma_channel_acknowledge_irq1(tx_channel);
+    tx_head = 0;
+    tx_tail = 0;
+    tx_busy = false;
+    restore_interrupts(irq);
 }
 
-void uart_rx_irq_callback() {
-    while(uart_is_readable(ESP_UART)) {
-        char c = uart_getc(ESP_UART);
-        uart_rx_buffer_putc(c);
+void uart_tx_log_stats() {
+    if (!tx_replaced && !tx_dropped) return;
+    info("UART: TX replaced=%lu dropped=%lu\n", tx_replaced, tx_dropped);
+}
+
+void uart_tx_init() {
+    if (tx_channel >= 0) {
+        uart_tx_reset();
+        return;
     }
+    tx_channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(tx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, uart_get_dreq(ESP_UART, true));
+    dma_channel_configure(tx_channel, &config, &uart_get_hw(ESP_UART)->dr, NULL, 0, false);
+    dma_channel_set_irq1_enabled(tx_channel, true);
+    irq_add_shared_handler(DMA_IRQ_1, uart_tx_irq_callback, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
 }
@@ -6,9 +6,9 @@
 
 Vector vector_normalize(Vector v) {
     float mag = (v.x*v.x) + (v.y*v.y) + (v.z*v.z);
-    if (fabs(mag - 1.0) > 0.0001) {  // Tolerance.
-        mag = sqrt(mag);
-        return (Vector){v.x/mag, v.y/mag, v.z/mag};
+    if (fabsf(mag - 1.0f) > 0.0001f) {  // Tolerance.
+        float inv = 1.0f / sqrtf(mag);  // Single division.
+        return (Vector){v.x*inv, v.y*inv, v.z*inv};
     }
     return v;
 }
@@ -45,22 +45,19 @@ Vector vector_smooth(Vector a, Vector b, float weight) {
 }
 
 float vector_lenght(Vector v) {
-    return sqrt(
-        powf(fabs(v.x), 2) +
-        powf(fabs(v.y), 2) +
-        powf(fabs(v.z), 2)
-    );
+    return sqrtf((v.x*v.x) + (v.y*v.y) + (v.z*v.z));
 }
 
 Vector4 quaternion(Vector vector, float rotation /*radians*/) {
     // https://en.wikipedia.org/wiki/Conversion_between_quaternions_and_Euler_angles
     vector = vector_normalize(vector);
-    float theta = rotation / 2;
+    float theta = rotation * 0.5f;
+    float s = sinf(theta);
     return (Vector4){
-        vector.x * sin(theta),
-        vector.y * sin(theta),
-        vector.z * sin(theta),
-        cos(theta)
+        vector.x * s,
+        vector.y * s,
+        vector.z * s,
+        cosf(theta)
     };
 }
 
@@ -78,9 +75,19 @@ Vector4 qconjugate(Vector4 q) {
     return (Vector4){-q.x, -q.y, -q.z, q.r};
 }
 
+// Equivalent to q * v * conjugate(q) for unit quaternions, but expanded as
+// v + r*t + (q x t) with t = 2 * (q x v), which needs 18 multiplications
+// instead of 32.
 Vector qrotate(Vector4 q1, Vector v) {
-    Vector4 q2 = (Vector4){v.x, v.y, v.z, 0};
-    return qvector(qmultiply(qmultiply(q1, q2), qconjugate(q1)));
+    Vector u = {q1.x, q1.y, q1.z};
+    Vector t = vector_cross_product(u, v);
+    t = (Vector){t.x * 2, t.y * 2, t.z * 2};
+    Vector c = vector_cross_product(u, t);
+    return vector_normalize((Vector){
+        v.x + (q1.r * t.x) + c.x,
+        v.y + (q1.r * t.y) + c.y,
+        v.z + (q1.r * t.z) + c.z
+    });
 }
 
 Vector qvector(Vector4 q) {
@@ -16,6 +16,7 @@
 #include "power.h"
 #include "loop.h"
 #include "wireless.h"
+#include "profiler.h"
 
 uint8_t webusb_buffer[WEBUSB_BUFFER_SIZE] = {0,};
 uint16_t webusb_ptr_in = 0;
@@ -27,6 +28,8 @@ static bool webusb_pending_status_share = false;
 static uint8_t webusb_pending_config_share = 0;
 static uint8_t webusb_pending_profile_share = 0;
 static uint8_t webusb_pending_section_share = 0;
+static uint16_t webusb_pending_profiler_share = 0;  // Bitmask of stages.
+static uint16_t webusb_pending_profiler_reset = 0;  // Bitmask of stages.
 
 void webusb_flush_force() {
     uint16_t i = 0;
@@ -81,7 +84,8 @@ bool webusb_flush() {
         !webusb_pending_status_share &&
         !webusb_pending_config_share &&
         !webusb_pending_profile_share &&
-        !webusb_pending_section_share
+        !webusb_pending_section_share &&
+        !webusb_pending_profiler_share
     ) {
         return true;
     }
@@ -108,6 +112,16 @@ bool webusb_flush() {
             webusb_pending_profile_share = 0;
             webusb_pending_section_share = 0;
         }
+    } else if (webusb_pending_profiler_share) {
+        uint8_t stage = __builtin_ctz(webusb_pending_profiler_share);
+        ctrl = ctrl_profiler_share(stage);
+        bool sent = webusb_transfer(ctrl);
+        if (sent) {
+            // Reset only once the data is out, so nothing is lost.
+            if (webusb_pending_profiler_reset & (1 << stage)) profiler_reset(stage);
+            webusb_pending_profiler_share &= ~(1 << stage);
+            webusb_pending_profiler_reset &= ~(1 << stage);
+        }
     } else {
         uint8_t len = constrain(webusb_ptr_in-webusb_ptr_out, 0, CTRL_MAX_PAYLOAD_SIZE);
         uint8_t *offset_ptr = webusb_buffer + webusb_ptr_out;
@@ -170,6 +184,16 @@ void webusb_handle_config_get(Ctrl_cfg_type key) {
     webusb_pending_config_share = key;
 }
 
+// Stage zero means all stages.
+void webusb_handle_profiler_get(uint8_t stage, bool reset) {
+    debug("WebUSB: Received profiler GET from app\n");
+    uint16_t mask = 0;
+    if (stage == 0) mask = ((1 << PROFILER_STAGES) - 1) & ~1;
+    else if (stage < PROFILER_STAGES) mask = 1 << stage;
+    webusb_pending_profiler_share |= mask;
+    if (reset) webusb_pending_profiler_reset |= mask;
+}
+
 void webusb_handle_section_get(uint8_t profile, uint8_t section) {
     webusb_pending_profile_share = profile;
     webusb_pending_section_share = section;
@@ -216,6 +240,9 @@ void webusb_handle(Ctrl ctrl) {
     if (ctrl.message_type == PROFILE_OVERWRITE) {
         config_profile_overwrite(ctrl.payload[0], ctrl.payload[1]);
     }
+    if (ctrl.message_type == PROFILER_GET) {
+        webusb_handle_profiler_get(ctrl.payload[0], ctrl.payload[1]);
+    }
 }
 
 void webusb_read() {
@@ -1,16 +1,50 @@
 // SPDX-License-Identifier: GPL-2.0-only
 // Copyright (C) 2022, Input Labs Oy.
 
+/*
+The HID reports sent over the radio are not guaranteed to arrive, so every
+AT_HID frame carries a sequence number (one sequence per report class), and
+the dongle answers with AT_HID_ACK frames containing the newest sequence it
+received of each class.
+
+The controller keeps the newest report of each class until it is
+acknowledged. Since every report contains the whole state of its class (except
+the mouse motion), older unacknowledged reports are simply replaced by newer
+ones, and only the newest one is sent again if its acknowledgement does not
+arrive in time. The timeouts are checked on every tick, even while other
+classes keep sending new reports, and each retransmission doubles the timeout
+of its class (up to WIRELESS_ACK_TIMEOUT_MAX_US). The newest state is never
+given up on, otherwise a lost release would leave a stuck input. Retransmissions
+keep the same sequence number, so the dongle can discard the duplicates
+(otherwise the mouse motion would be applied twice).
+
+AT_HID frames have variable length (see the frame layout in uart.h). Both
+sides keep the last frames of each class, so the controller can send only the
+bytes that changed since the last report acknowledged by the dongle, and the
+dongle rebuilds the full report from its own copy of that report. Whichever
+of the delta and the whole report is shorter is sent. The retransmissions are
+always sent in full, in case the delta base was lost.
+
+Every frame is protected by a CRC-16, so a corrupted frame is simply discarded
+(and handled like a lost one), instead of reaching the USB reports.
+
+The dongle acknowledges a report as soon as it is received, so it keeps the
+newest report of each class until the USB endpoint takes it, same as the wired
+reports (see hid.c). It is sent again when the endpoint completes the previous
+report, and on every cycle of the dongle task. A newer report of the class
+replaces it, with the mouse motion of both added together.
+*/
+
 #include <stdio.h>
 #include <string.h>
-#include <pico/time.h>
-#include <hardware/uart.h>
 #include "wireless.h"
+#include "hal.h"
 #include "config.h"
 #include "pin.h"
 #include "hid.h"
 #include "loop.h"
 #include "logging.h"
+#include "profiler.h"
 #include "common.h"
 #include "uart.h"
 #include "esp.h"
@@ -19,21 +53,64 @@
 
 static bool uart_data_mode = false;
 
+// Report of a class, as sent by the controller or as received by the dongle.
+typedef struct WirelessFrame_struct {
+    uint8_t seq;
+    uint8_t report_id;
+    uint8_t len;
+    uint8_t report[WIRELESS_REPORT_MAX];
+} WirelessFrame;
+
+// Last frames of a class, so the deltas can be built (and rebuilt) against
+// any of them.
+typedef struct WirelessHistory_struct {
+    WirelessFrame frames[WIRELESS_HISTORY];
+    uint8_t newest;  // Index of the newest frame.
+    uint8_t count;
+} WirelessHistory;
+
+static WirelessHistory history[HID_CLASSES] = {0,};
+
+// Controller side.
+static uint8_t seq_next[HID_CLASSES] = {0,};
+static bool unacked[HID_CLASSES] = {false,};  // The newest frame is not acknowledged.
+static uint32_t sent_at[HID_CLASSES] = {0,};  // Microseconds.
+static uint32_t timeout[HID_CLASSES] = {0,};  // Microseconds, with backoff.
+static bool acked[HID_CLASSES] = {false,};  // A base for the deltas is known.
+static uint8_t acked_seq[HID_CLASSES] = {0,};
+static uint32_t stat_sent = 0;
+static uint32_t stat_retransmits = 0;
+static uint32_t stat_bytes = 0;  // Payload bytes of the first transmissions.
+
+// Dongle side.
+static uint8_t received_mask = 0;  // Classes received at least once.
+static bool ack_pending = false;
+static uint32_t stat_received = 0;
+static uint32_t stat_lost = 0;  // Sequence gaps.
+static uint32_t stat_duplicates = 0;
+static uint32_t stat_undecodable = 0;  // Deltas against an unknown base.
+static WirelessFrame forward[HID_CLASSES];  // Newest report to send to the USB.
+static bool forward_pending[HID_CLASSES] = {false,};
+static uint32_t stat_deferred = 0;  // Sends postponed because the endpoint was busy.
+
+// Both sides.
+static uint32_t stat_corrupted = 0;  // Frames with invalid header or CRC.
+
 void wireless_set_uart_data_mode(bool mode) {
     info("RF: data_mode=%i\n", mode);
     uart_data_mode = mode;
+    uart_tx_reset();
+    uart_rx_reset();
     if (mode) {
         esp_restart();
-        uart_deinit(ESP_UART);
-        uart_init(ESP_UART, ESP_DATA_BAUD);
+        hal_uart_deinit();
+        hal_uart_init(ESP_DATA_BAUD);
         info("RF: UART1 init (%i)\n", ESP_DATA_BAUD);
-        uart_rx_buffer_init();
-        irq_set_exclusive_handler(UART1_IRQ, uart_rx_irq_callback);
-        irq_set_enabled(UART1_IRQ, true);
-        uart_set_irq_enables(ESP_UART, true, false);  // RX - TX
+        uart_tx_init();
+        uart_rx_init();
     } else {
-        uart_deinit(ESP_UART);
-        uart_init(ESP_UART, ESP_BOOTLOADER_BAUD);
+        hal_uart_deinit();
+        hal_uart_init(ESP_BOOTLOADER_BAUD);
         info("RF: UART1 init (%i)\n", ESP_BOOTLOADER_BAUD);
     }
 }
@@ -45,124 +122,418 @@ void wireless_init() {
         esp_init();
         // Secondary UART.
         info("RF: UART1 init (%i)\n", ESP_BOOTLOADER_BAUD);
-        uart_init(ESP_UART, ESP_BOOTLOADER_BAUD);
-        gpio_set_function(PIN_UART1_TX, GPIO_FUNC_UART);
-        gpio_set_function(PIN_UART1_RX, GPIO_FUNC_UART);
+        hal_uart_init(ESP_BOOTLOADER_BAUD);
+        hal_gpio_set_function(PIN_UART1_TX, HAL_GPIO_FUNC_UART);
+        hal_gpio_set_function(PIN_UART1_RX, HAL_GPIO_FUNC_UART);
     #endif
 }
 
+// CRC-16/CCITT (polynomial 0x1021, initial 0xFFFF), one nibble at a time.
+static const uint16_t crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+static uint16_t wireless_crc16(uint8_t *data, uint16_t len) {
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i=0; i<len; i++) {
+        crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+// Wrap the payload into an AT frame (see uart.h) and queue it.
+static bool wireless_send_frame(uint8_t command, void *payload, uint8_t len, uint8_t tag) {
+    if (AT_HEADER_LEN + len + AT_CRC_LEN > UART_TX_FRAME_MAX) return false;
+    uint8_t frame[UART_TX_FRAME_MAX] = {UART_CONTROL_BYTES, command, len};
+    memcpy(&frame[AT_HEADER_LEN], payload, len);
+    uint16_t crc = wireless_crc16(&frame[3], 2 + len);
+    frame[AT_HEADER_LEN + len] = crc & 0xFF;
+    frame[AT_HEADER_LEN + len + 1] = crc >> 8;
+    return uart_tx_send(frame, AT_HEADER_LEN + len + AT_CRC_LEN, tag);
+}
+
+static HidClass wireless_class(uint8_t report_id) {
+    if (report_id == REPORT_KEYBOARD) return HID_CLASS_KEYBOARD;
+    if (report_id == REPORT_MOUSE) return HID_CLASS_MOUSE;
+    return HID_CLASS_GAMEPAD;  // Gamepad or XInput.
+}
+
+static WirelessFrame *wireless_history_newest(HidClass class) {
+    return &history[class].frames[history[class].newest];
+}
+
+static WirelessFrame *wireless_history_find(HidClass class, uint8_t seq) {
+    WirelessHistory *self = &history[class];
+    for(uint8_t i=0; i<self->count; i++) {
+        uint8_t index = (self->newest + WIRELESS_HISTORY - i) % WIRELESS_HISTORY;
+        if (self->frames[index].seq == seq) return &self->frames[index];
+    }
+    return NULL;
+}
+
+static void wireless_history_push(HidClass class, WirelessFrame *frame) {
+    WirelessHistory *self = &history[class];
+    if (self->count) self->newest = (self->newest + 1) % WIRELESS_HISTORY;
+    self->count = min(self->count + 1, WIRELESS_HISTORY);
+    self->frames[self->newest] = *frame;
+}
+
+// Only the bytes that differ from the base are sent, after a bitmask of
+// which bytes are present. Returns the payload length.
+static uint8_t wireless_encode_delta(uint8_t *payload, WirelessFrame *frame, WirelessFrame *base) {
+    uint8_t mask_len = (frame->len + 7) / 8;
+    uint8_t *mask = payload;
+    uint8_t len = mask_len;
+    memset(mask, 0, mask_len);
+    for(uint8_t i=0; i<frame->len; i++) {
+        if (frame->report[i] == base->report[i]) continue;
+        mask[i / 8] |= (1 << (i % 8));
+        payload[len++] = frame->report[i];
+    }
+    return len;
+}
+
+// The delta is only used if it is shorter than the whole report (it is not
+// when most of the bytes changed, because of the bitmask and the base
+// sequence). Returns the payload length.
+static uint8_t wireless_write_hid(WirelessFrame *frame, WirelessFrame *base) {
+    uint8_t payload[AT_HID_LEN];
+    payload[0] = frame->report_id;
+    payload[1] = frame->seq;
+    uint8_t len = 2;
+    uint8_t delta[WIRELESS_REPORT_MAX + (WIRELESS_REPORT_MAX + 7) / 8];
+    uint8_t delta_len = base ? wireless_encode_delta(delta, frame, base) : 0;
+    if (base && 1 + delta_len < frame->len) {
+        payload[0] |= AT_HID_DELTA;
+        payload[2] = base->seq;
+        memcpy(&payload[3], delta, delta_len);
+        len += 1 + delta_len;
+    } else {
+        memcpy(&payload[2], frame->report, frame->len);
+        len += frame->len;
+    }
+    HidClass class = wireless_class(frame->report_id);
+    wireless_send_frame(AT_HID, payload, len, UART_TX_TAG_HID(class));
+    sent_at[class] = hal_time_us_32();
+    return len;
+}
+
+// The report replaces any unacknowledged report of the same class. It is sent
+// as a delta against the last acknowledged report, if it is still known.
 void wireless_send_hid(uint8_t report_id, void *payload, uint8_t len) {
-    uint8_t message[AT_HEADER_LEN+AT_HID_LEN] = {UART_CONTROL_BYTES, AT_HID, report_id,};
-    memcpy(&message[AT_HEADER_LEN+1], payload, len);
-    uart_write_blocking(ESP_UART, message, AT_HEADER_LEN+AT_HID_LEN);
+    HidClass class = wireless_class(report_id);
+    WirelessFrame frame = {
+        .seq = seq_next[class]++,
+        .report_id = report_id,
+        .len = min(len, WIRELESS_REPORT_MAX),
+    };
+    memcpy(frame.report, payload, frame.len);
+    WirelessFrame *base = acked[class] ? wireless_history_find(class, acked_seq[class]) : NULL;
+    if (base && (base->report_id != frame.report_id || base->len != frame.len)) base = NULL;
+    wireless_history_push(class, &frame);
+    stat_bytes += wireless_write_hid(wireless_history_newest(class), base);
+    unacked[class] = true;
+    timeout[class] = WIRELESS_ACK_TIMEOUT_US;
+    stat_sent++;
 }
 
+// Send again the newest report of every class whose acknowledgement did not
+// arrive in time, always in full since its base may be the one that was lost.
+// Returns false if there was nothing to send.
+bool wireless_retransmit() {
+    uint32_t now = hal_time_us_32();
+    bool sent = false;
+    for(uint8_t i=0; i<HID_CLASSES; i++) {
+        if (!unacked[i]) continue;
+        if (now - sent_at[i] < timeout[i]) continue;
+        wireless_write_hid(wireless_history_newest(i), NULL);
+        timeout[i] = min(timeout[i] * 2, WIRELESS_ACK_TIMEOUT_MAX_US);
+        stat_retransmits++;
+        sent = true;
+    }
+    return sent;
+}
+
+static void wireless_handle_hid_ack(uint8_t *payload) {
+    uint8_t mask = payload[0];
+    for(uint8_t i=0; i<HID_CLASSES; i++) {
+        if (!(mask & (1 << i))) continue;
+        uint8_t seq = payload[1+i];
+        // Acknowledgements of frames no longer in the history are useless as
+        // a base, and may even be from before a restart of the controller.
+        if (!wireless_history_find(i, seq)) continue;
+        acked[i] = true;
+        acked_seq[i] = seq;
+        if (unacked[i] && wireless_history_newest(i)->seq == seq) unacked[i] = false;
+    }
+}
+
+static void wireless_send_hid_ack() {
+    uint8_t payload[AT_HID_ACK_LEN] = {received_mask,};
+    for(uint8_t i=0; i<HID_CLASSES; i++) {
+        payload[1+i] = wireless_history_newest(i)->seq;
+    }
+    wireless_send_frame(AT_HID_ACK, payload, AT_HID_ACK_LEN, UART_TX_TAG_HID_ACK);
+}
+
+// Rebuild the full report from a delta payload (see wireless_encode_delta).
+static bool wireless_decode_delta(WirelessFrame *frame, WirelessFrame *base, uint8_t *payload, uint8_t len) {
+    uint8_t mask_len = (base->len + 7) / 8;
+    uint8_t index = mask_len;
+    if (len < mask_len) return false;
+    frame->len = base->len;
+    for(uint8_t i=0; i<frame->len; i++) {
+        if (payload[i / 8] & (1 << (i % 8))) {
+            if (index >= len) return false;
+            frame->report[i] = payload[index++];
+        } else {
+            frame->report[i] = base->report[i];
+        }
+    }
+    return true;
+}
+
+static int16_t wireless_motion_add(int16_t a, int16_t b) {
+    return constrain(a + b, -BIT_15, BIT_15);
+}
+
+// Keep the report for the USB, replacing the one not yet sent, but not its
+// mouse motion.
+static void wireless_forward_store(HidClass class, WirelessFrame *frame) {
+    WirelessFrame *slot = &forward[class];
+    if (forward_pending[class] && slot->report_id == REPORT_MOUSE && frame->report_id == REPORT_MOUSE) {
+        MouseReport older;
+        MouseReport newer;
+        memcpy(&older, slot->report, sizeof(MouseReport));
+        memcpy(&newer, frame->report, sizeof(MouseReport));
+        newer.x = wireless_motion_add(older.x, newer.x);
+        newer.y = wireless_motion_add(older.y, newer.y);
+        newer.scroll = wireless_motion_add(older.scroll, newer.scroll);
+        newer.pan = wireless_motion_add(older.pan, newer.pan);
+        *slot = *frame;
+        memcpy(slot->report, &newer, sizeof(MouseReport));
+    } else {
+        *slot = *frame;
+    }
+    forward_pending[class] = true;
+}
+
+// Send the kept report of the class to the USB, if the endpoint takes it.
+void wireless_dongle_forward(HidClass class) {
+    if (!forward_pending[class]) return;
+    // Cleared first, sending can complete the report of another class.
+    forward_pending[class] = false;
+    if (!hid_report_dongle(forward[class].report_id, forward[class].report)) {
+        forward_pending[class] = true;
+        stat_deferred++;
+    }
+}
+
+// Dongle side, the payload is the report ID (with the delta flag), the
+// sequence, and then either the whole report or the base sequence and delta.
+static void wireless_receive_hid(uint8_t *payload, uint8_t len) {
+    if (len < 3) return;
+    WirelessFrame frame = {
+        .seq = payload[1],
+        .report_id = payload[0] & ~AT_HID_DELTA,
+    };
+    HidClass class = wireless_class(frame.report_id);
+    bool known = received_mask & (1 << class);
+    if (payload[0] & AT_HID_DELTA) {
+        WirelessFrame *base = known ? wireless_history_find(class, payload[2]) : NULL;
+        // Not acknowledged, so the controller sends it again in full.
+        if (!base || !wireless_decode_delta(&frame, base, &payload[3], len - 3)) {
+            stat_undecodable++;
+            return;
+        }
+    } else {
+        frame.len = min(len - 2, WIRELESS_REPORT_MAX);
+        memcpy(frame.report, &payload[2], frame.len);
+    }
+    ack_pending = true;
+    WirelessFrame *newest = wireless_history_newest(class);
+    // Retransmission of a report already applied. The content is compared
+    // too, so a restarted controller (with a new sequence) is not ignored.
+    if (
+        known &&
+        frame.seq == newest->seq &&
+        frame.len == newest->len &&
+        !memcmp(frame.report, newest->report, frame.len)
+    ) {
+        stat_duplicates++;
+        return;
+    }
+    if (known) {
+        uint8_t gap = frame.seq - newest->seq - 1;
+        if (gap < 128) stat_lost += gap;
+    }
+    received_mask |= (1 << class);
+    wireless_history_push(class, &frame);
+    stat_received++;
+    wireless_forward_store(class, &frame);
+    wireless_dongle_forward(class);
+}
+
+void wireless_log_stats() {
+    #ifdef DEVICE_DONGLE
+        if (!stat_received) return;
+        info(
+            "RF: received=%lu lost=%lu duplicates=%lu undecodable=%lu deferred=%lu corrupted=%lu bursts=%lu\n",
+            stat_received, stat_lost, stat_duplicates, stat_undecodable, stat_deferred, stat_corrupted,
+            uart_rx_get_bursts()
+        );
+    #else
+        if (!stat_sent) return;
+        info(
+            "RF: sent=%lu bytes_avg=%lu retransmits=%lu corrupted=%lu\n",
+            stat_sent, stat_bytes / stat_sent, stat_retransmits, stat_corrupted
+        );
+    #endif
+    uart_tx_log_stats();
+}
+
+
 void wireless_send_webusb(Ctrl ctrl) {
     ctrl.protocol_flags = CTRL_FLAG_WIRELESS;
-    uint8_t message[AT_HEADER_LEN+AT_WEBUSB_LEN] = {UART_CONTROL_BYTES, AT_WEBUSB,};
-    memcpy(&message[AT_HEADER_LEN], (uint8_t*)&ctrl, AT_WEBUSB_LEN);
-    uart_write_blocking(ESP_UART, message, AT_HEADER_LEN+AT_WEBUSB_LEN);
+    wireless_send_frame(AT_WEBUSB, &ctrl, AT_WEBUSB_LEN, UART_TX_TAG_NONE);
 }
 
 void wireless_send_usb_protocol(Protocol protocol) {
-    uint8_t message[AT_HEADER_LEN+AT_USB_PROTOCOL_LEN] = {UART_CONTROL_BYTES, AT_USB_PROTOCOL,};
-    message[AT_HEADER_LEN] = protocol;
-    uart_write_blocking(ESP_UART, message, AT_HEADER_LEN+AT_USB_PROTOCOL_LEN);
+    uint8_t payload = protocol;
+    wireless_send_frame(AT_USB_PROTOCOL, &payload, AT_USB_PROTOCOL_LEN, UART_TX_TAG_NONE);
 }
 
-void wireless_uart_commands() {
-    static uint8_t i = 0;
-    static uint8_t command = 0;
-    static uint8_t payload[AT_PAYLOAD_MAX_LEN] = {0,};
-    while(!uart_rx_buffer_is_empty()) {
-        char c = uart_rx_buffer_getc();
-        // Check control bytes.
-        if (i < 3) {
-            if (
-                (i==0 && c==UART_CONTROL_0) ||
-                (i==1 && c==UART_CONTROL_1) ||
-                (i==2 && c==UART_CONTROL_2)
-            ) {
-                i += 1;
-            } else {
-                i = 0;
-                // Redirect to RP2040 uart log.
-                info("%c", c);
+static void wireless_handle_frame(uint8_t command, uint8_t *payload, uint8_t len) {
+    if (command == AT_HID) {
+        wireless_receive_hid(payload, len);
+    }
+    else if (command == AT_HID_ACK) {
+        wireless_handle_hid_ack(payload);
+    }
+    else if (command == AT_WEBUSB) {
+        Ctrl ctrl = {0,};
+        memcpy(&ctrl, payload, AT_WEBUSB_LEN);
+        #ifdef DEVICE_DONGLE
+            // Ctrl message from controller, gets read at dongle uart,
+            // and sent to the USB.
+            webusb_transfer_wired(ctrl);
+        #else
+            // Ctrl message from dongle, gets read at controller uart,
+            // and is handled as if received via USB.
+            webusb_handle(ctrl);
+        #endif
+    }
+    else if (command == AT_BATTERY) {
+        #ifdef DEVICE_ALPAKKA_V1
+            // Convert to 32 bit.
+            uint32_t battery_level = 0;
+            memcpy(&battery_level, payload, 4);
+            // Optional logging.
+            if (logging_has_mask(LOG_WIRELESS)) {
+                float normalized = ((float)battery_level - BATTERY_MIN) / BATTERY_CAPACITY;
+                float percentage = fmax(0, fmin(100, normalized * 100));
+                info("RF: Battery at %.0f%% (%lu)\n", percentage, battery_level);
             }
-        }
-        // Get AT command.
-        else if (i == 3) {
-            if (c >= AT_HID && c <= AT_USB_PROTOCOL) {
-                command = c;
-                i += 1;
+            if (battery_level < BATTERY_LOW_THRESHOLD) {
+                loop_set_battery_low(true);
+                static bool battery_low_was_triggered = false;
+                if (!battery_low_was_triggered) {
+                    config_set_problem(PROBLEM_LOW_BATTERY, true);
+                    battery_low_was_triggered = true;
+                }
             } else {
-                i = 0;
-                warn("UART: AT command unknown %i\n", c);
+                loop_set_battery_low(false);
             }
+        #endif
+    }
+    else if (command == AT_USB_PROTOCOL) {
+        config_set_protocol(payload[0]);
+    }
+}
+
+// Payload length allowed for each command (exact, except for AT_HID).
+static bool wireless_frame_is_valid(uint8_t command, uint8_t len) {
+    if (command == AT_HID) return len <= AT_HID_LEN;
+    if (command == AT_WEBUSB) return len == AT_WEBUSB_LEN;
+    if (command == AT_BATTERY) return len == AT_BATTERY_LEN;
+    if (command == AT_USB_PROTOCOL) return len == AT_USB_PROTOCOL_LEN;
+    if (command == AT_HID_ACK) return len == AT_HID_ACK_LEN;
+    return false;
+}
+
+// Anything that is not a frame is the ESP log, redirected to the RP2040 log
+// up to the next possible frame. While resynchronizing after a corrupted
+// frame, the bytes are discarded instead, since they are most likely the rest
+// of that frame.
+static void wireless_uart_skip(uint16_t available, bool discard) {
+    uint16_t len = min(available, UART_RX_FRAME_MAX);
+    uint8_t *text = uart_rx_peek(len);
+    uint16_t run = 1;
+    while(run < len && text[run] != UART_CONTROL_0) run++;
+    if (!discard) info("%.*s", run, text);
+    uart_rx_consume(run);
+}
+
+// Dispatch every complete frame in the receive ring, reading them in place.
+// An incomplete frame stays in the ring until the rest of it arrives.
+// A frame with an invalid header or CRC only discards its first byte, and the
+// scan continues from the next control byte, so a valid frame that follows
+// (or that was hidden inside a bogus length) is found without waiting for
+// more data than one frame.
+void wireless_uart_commands() {
+    static const uint8_t control[] = {UART_CONTROL_BYTES};
+    static bool resync = false;
+    while(true) {
+        uint16_t available = uart_rx_available();
+        if (!available) return;
+        uint8_t *frame = uart_rx_peek(min(available, AT_HEADER_LEN));
+        uint8_t checked = min(available, sizeof(control));
+        if (memcmp(frame, control, checked)) {
+            wireless_uart_skip(available, resync);
+            continue;
         }
-        // Get payload.
-        else {
-            payload[i-AT_HEADER_LEN] = c;
-            i += 1;
-            // Payload complete.
-            if (command==AT_HID && i==AT_HEADER_LEN+AT_HID_LEN) {
-                hid_report_dongle(payload[0], &payload[1]);
-                i = 0;
-                command = 0;
-            }
-            else if (command==AT_WEBUSB && i==AT_HEADER_LEN+AT_WEBUSB_LEN) {
-                Ctrl ctrl = {0,};
-                memcpy(&ctrl, payload, AT_WEBUSB_LEN);
-                #ifdef DEVICE_DONGLE
-                    // Ctrl message from controller, gets read at dongle uart,
-                    // and sent to the USB.
-                    webusb_transfer_wired(ctrl);
-                #else
-                    // Ctrl message from dongle, gets read at controller uart,
-                    // and is handled as if received via USB.
-                    webusb_handle(ctrl);
-                #endif
-                i = 0;
-                command = 0;
-            }
-            else if (command==AT_BATTERY && i==AT_HEADER_LEN+AT_BATTERY_LEN) {
-                #ifdef DEVICE_ALPAKKA_V1
-                    // Convert to 32 bit.
-                    uint32_t battery_level = 0;
-                    memcpy(&battery_level, payload, 4);
-                    // Optional logging.
-                    if (logging_has_mask(LOG_WIRELESS)) {
-                        float normalized = ((float)battery_level - BATTERY_MIN) / BATTERY_CAPACITY;
-                        float percentage = fmax(0, fmin(100, normalized * 100));
-                        info("RF: Battery at %.0f%% (%lu)\n", percentage, battery_level);
-                    }
-                    if (battery_level < BATTERY_LOW_THRESHOLD) {
-                        loop_set_battery_low(true);
-                        static bool battery_low_was_triggered = false;
-                        if (!battery_low_was_triggered) {
-                            config_set_problem(PROBLEM_LOW_BATTERY, true);
-                            battery_low_was_triggered = true;
-                        }
-                    } else {
-                        loop_set_battery_low(false);
-                    }
-                #endif
-                i = 0;
-                command = 0;
-            }
-            else if (command==AT_USB_PROTOCOL && i==AT_HEADER_LEN+AT_USB_PROTOCOL_LEN) {
-                config_set_protocol(payload[0]);
-            }
+        if (available < AT_HEADER_LEN) return;
+        uint8_t command = frame[3];
+        uint8_t len = frame[4];
+        if (!wireless_frame_is_valid(command, len)) {
+            stat_corrupted++;
+            resync = true;
+            uart_rx_consume(1);
+            continue;
         }
+        uint16_t frame_len = AT_HEADER_LEN + len + AT_CRC_LEN;
+        if (available < frame_len) return;
+        frame = uart_rx_peek(frame_len);
+        uint16_t crc = frame[AT_HEADER_LEN + len] | (frame[AT_HEADER_LEN + len + 1] << 8);
+        if (crc != wireless_crc16(&frame[3], 2 + len)) {
+            stat_corrupted++;
+            resync = true;
+            uart_rx_consume(1);
+            continue;
+        }
+        resync = false;
+        wireless_handle_frame(command, &frame[AT_HEADER_LEN], len);
+        uart_rx_consume(frame_len);
     }
 }
 
 void wireless_controller_task() {
+    uint32_t start = profiler_start();
     hid_report_wireless();
+    profiler_stop(PROFILER_HID_REPORT, start);
     wireless_uart_commands();
 }
 
 void wireless_dongle_task() {
     // led_task();
+    // Reports the endpoint did not take, in case no completion comes.
+    for(uint8_t i=0; i<HID_CLASSES; i++) wireless_dongle_forward(i);
     wireless_uart_commands();
+    // One acknowledgement for all the reports received in this cycle.
+    if (ack_pending) {
+        wireless_send_hid_ack();
+        ack_pending = false;
+    }
 }
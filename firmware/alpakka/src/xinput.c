@@ -5,6 +5,7 @@
 #include <device/usbd_pvt.h>
 #include "xinput.h"
 #include "tusb_config.h"
+#include "hid.h"
 #include "logging.h"
 
 const uint8_t ep_in[] = {DESCRIPTOR_ENDPOINT_XINPUT_IN};
@@ -53,6 +54,9 @@ static bool xinput_xfer_cb(
     uint32_t xferred_bytes
 ) {
     // printf("xinput_xfer_cb\n");
+    if (ep_addr == ADDR_XINPUT_IN && result == XFER_RESULT_SUCCESS) {
+        hid_report_complete(HID_CLASS_GAMEPAD);
+    }
     return true;
 }
 
@@ -62,7 +66,7 @@ static usbd_class_driver_t const xinput_driver = {
     .open            = xinput_open,
     .control_xfer_cb = xinput_control_xfer_cb,
     .xfer_cb         = xinput_xfer_cb,
-    .sof             = NULL
+    .sof             = usb_sof_cb  // Invoked in interrupt context.
 };
 
 usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count) {